@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "write_buffer_manager.h"
+
+namespace kvstore {
+
+// Bump allocator for memtables. Memory is handed out from large blocks and
+// only released all at once when the arena is destroyed. Allocation is safe
+// from many threads: the fast path is a single atomic add on the current
+// block, and only a thread that overflows it takes the lock to start a
+// new block.
+class Arena {
+public:
+    // Blocks are reported to `write_buffer_manager` when given
+    explicit Arena(WriteBufferManager* write_buffer_manager = nullptr);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Returned memory is aligned for any scalar type
+    char* Allocate(size_t bytes);
+
+    // Bytes obtained from the system, including unused block tails
+    size_t MemoryUsage() const {
+        return memory_usage_.load(std::memory_order_relaxed);
+    }
+    // Bytes handed out so far, including alignment padding
+    size_t AllocatedBytes() const;
+
+private:
+    struct Block {
+        std::atomic<size_t> used;
+        size_t size;
+        char* data;
+    };
+
+    static constexpr size_t kBlockSize = 64 * 1024;
+    static constexpr size_t kAlignment = alignof(std::max_align_t);
+
+    WriteBufferManager* write_buffer_manager_;
+    std::atomic<Block*> current_;
+    std::atomic<size_t> memory_usage_;
+    mutable std::mutex mutex_;
+    // Guarded by mutex_
+    std::vector<std::unique_ptr<char[]>> allocations_;
+    std::vector<std::unique_ptr<Block>> blocks_;
+
+    char* AllocateLarge(size_t bytes);
+    char* AllocateFallback(size_t bytes, Block* full);
+    Block* NewBlock(size_t size);
+};
+
+} // namespace kvstore
+
+#endif // ARENA_H
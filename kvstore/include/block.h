@@ -0,0 +1,96 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace kvstore {
+
+// Builds a sorted block of key/value pairs. Keys are delta-encoded against
+// the previous key; every `restart_interval` entries the full key is stored
+// and its offset recorded as a restart point for binary search.
+//
+// Entry:   shared(varint) non_shared(varint) value_len(varint)
+//          key_delta[non_shared] value[value_len]
+// Trailer: restart_offset(fixed32) * num_restarts, num_restarts(fixed32)
+class BlockBuilder {
+public:
+    explicit BlockBuilder(int restart_interval = 16);
+
+    // Keys must be added in non-decreasing order
+    void Add(std::string_view key, std::string_view value);
+    std::string_view Finish();
+    void Reset();
+
+    size_t CurrentSizeEstimate() const;
+    bool Empty() const { return buffer_.empty(); }
+    std::string_view LastKey() const { return last_key_; }
+
+private:
+    int restart_interval_;
+    std::string buffer_;
+    std::vector<uint32_t> restarts_;
+    int counter_;
+    bool finished_;
+    std::string last_key_;
+};
+
+// Read-only view of a block produced by BlockBuilder
+class Block {
+public:
+    // Reads `contents` in place; the memory must outlive the block
+    explicit Block(std::string_view contents);
+    // Takes ownership of the block contents
+    explicit Block(std::string&& contents);
+
+    Block(const Block&) = delete;
+    Block& operator=(const Block&) = delete;
+
+    size_t Size() const { return data_.size(); }
+
+    class Iterator {
+    public:
+        explicit Iterator(const Block& block);
+
+        bool Valid() const { return current_ < restarts_offset_; }
+        bool Corrupted() const { return corrupted_; }
+        std::string_view key() const { return key_; }
+        std::string_view value() const { return value_; }
+
+        void SeekToFirst();
+        // Positions at the first entry with key >= target
+        void Seek(std::string_view target);
+        void Next();
+
+    private:
+        std::string_view data_;
+        uint32_t restarts_offset_;
+        uint32_t num_restarts_;
+        uint32_t current_;
+        uint32_t next_;
+        std::string key_;
+        std::string_view value_;
+        bool corrupted_;
+
+        uint32_t RestartPoint(uint32_t index) const;
+        void SeekToRestartPoint(uint32_t index);
+        bool ParseNextEntry();
+        void MarkCorrupted();
+    };
+
+    Iterator NewIterator() const { return Iterator(*this); }
+
+private:
+    std::string owned_;
+    std::string_view data_;
+    uint32_t restarts_offset_;
+    uint32_t num_restarts_;
+
+    void ParseRestarts();
+};
+
+} // namespace kvstore
+
+#endif // BLOCK_H
@@ -3,29 +3,51 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include "filter.h"
 
 namespace kvstore {
 
-class BloomFilter {
+// Blocked Bloom filter. A key's hash picks one 64-byte cache line and sets
+// one bit in each of its eight 64-bit words, so a lookup touches a single
+// line and the probes are independent, branch-free word operations the
+// compiler can vectorize. Hashing is one non-allocating 64-bit hash.
+class BloomFilter : public KeyFilter {
 public:
     BloomFilter(size_t expected_elements, double false_positive_rate = 0.01);
     
-    void Add(const std::string& key);
-    bool MayContain(const std::string& key) const;
+    void Add(std::string_view key);
+    using KeyFilter::MayContain;
     
-    // Serialization
+    // Builders that do not know the key count up front collect one Hash64
+    // per key and size the filter at the end
+    void AddHash(uint64_t hash);
+    bool MayContainHash(uint64_t hash) const override;
+    size_t MemoryUsage() const override { return lines_.size() * sizeof(CacheLine); }
+    FilterType Type() const override { return FilterType::kBloom; }
+    
+    // Serialization. Deserialize returns a filter that matches every key if
+    // `data` is malformed, so a bad filter never hides a key.
     std::vector<uint8_t> Serialize() const;
     static BloomFilter Deserialize(const std::vector<uint8_t>& data);
+    static bool Deserialize(std::string_view data, BloomFilter& filter);
     
-    size_t Size() const { return bits_.size(); }
-    size_t NumHashes() const { return num_hashes_; }
+    size_t Size() const { return lines_.size() * kBitsPerLine; }
+    size_t NumHashes() const { return kWordsPerLine; }
     
 private:
-    std::vector<bool> bits_;
-    size_t num_hashes_;
+    static constexpr size_t kWordsPerLine = 8;
+    static constexpr size_t kBitsPerLine = kWordsPerLine * 64;
+    
+    struct alignas(64) CacheLine {
+        uint64_t words[kWordsPerLine];
+    };
+    
+    std::vector<CacheLine> lines_;
     
-    std::vector<uint64_t> Hash(const std::string& key) const;
+    size_t LineIndex(uint64_t hash) const;
+    static void ProbeMasks(uint64_t hash, uint64_t* masks);
 };
 
 } // namespace kvstore
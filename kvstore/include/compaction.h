@@ -4,39 +4,121 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <functional>
+#include <set>
 #include "sstable.h"
+#include "version.h"
 
 namespace kvstore {
 
 class Compaction {
 public:
+    // When each level is due for compaction
     struct Strategy {
-        size_t level;
-        size_t max_files_per_level;
-        size_t size_ratio;
+        // Level 0 is compacted once it holds this many tables (0 never)
+        size_t level0_file_trigger;
+        // Size target of level 1; each deeper level's is `multiplier`
+        // times the one above
+        uint64_t base_level_bytes;
+        uint64_t multiplier;
+        // Non-zero selects time-window compaction instead: every table
+        // stays in level 0, bucketed by the window (of this many ms) its
+        // newest entry falls in. Tables are only merged with neighbours of
+        // the same window: in the newest window once level0_file_trigger
+        // of them pile up, in older windows into one table per window.
+        uint64_t time_window_ms = 0;
+        
+        uint64_t MaxBytesForLevel(int level) const;
+    };
+    
+    // Tables from `level` and the tables of output_level they overlap,
+    // which are merged into new tables for output_level
+    struct Pick {
+        int level = 0;
+        int output_level = 1;
+        SSTableList inputs;
+        SSTableList overlaps;
+        // Key range of all of them
+        std::string smallest;
+        std::string largest;
+        // False when the outputs must be one table however large: a
+        // time-window merge split by size would leave the window with
+        // several tables and be picked again
+        bool split_outputs = true;
     };
     
+    // Merges `input_files` (oldest first) into tables of about
+    // options.target_file_size bytes, named by calls to `next_output_file`,
+    // and appends their names to `output_files`. Tombstones may only be
+    // dropped when no older table outside the inputs can hold the deleted
+    // keys. The inputs are streamed, so memory stays around one block per
+    // input however much data they hold. Fails without output if an input
+    // cannot be read in full.
+    //
+    // Large compactions are split into up to `max_subcompactions` disjoint
+    // key ranges merged on their own threads; `next_output_file` must then
+    // be safe to call concurrently.
     static bool CompactSSTables(
         const std::vector<std::string>& input_files,
-        const std::string& output_file,
-        bool compression = true
+        const std::function<std::string()>& next_output_file,
+        const SSTableOptions& options,
+        std::vector<std::string>& output_files,
+        bool drop_tombstones = false,
+        size_t max_subcompactions = 1
     );
     
-    static std::vector<std::string> SelectFilesForCompaction(
-        const std::vector<std::unique_ptr<SSTable>>& sstables,
-        size_t threshold
-    );
+    // Scores each level against its target, level 0 by table count and
+    // deeper levels by size, and picks inputs from the worst level scoring
+    // at least 1. Picks never include tables in `compacting`, so they can
+    // run alongside the compactions already holding those. Returns false
+    // when no level is due.
+    static bool PickCompaction(const Version& version, const Strategy& strategy,
+                               const std::set<const SSTable*>& compacting,
+                               Pick& pick);
+    // How far the levels are over their targets: the bytes compactions
+    // still have to move down
+    static uint64_t EstimatePendingBytes(const Version& version,
+                                         const Strategy& strategy);
+    // Level 0 tables that compaction has yet to merge, as compared with the
+    // level 0 stall triggers; under time-window compaction only the longest
+    // run of one window counts
+    static size_t Level0Backlog(const Version& version, const Strategy& strategy);
+    // Tables whose newest entry is older than `cutoff` (ms since epoch)
+    static std::vector<std::pair<int, std::shared_ptr<SSTable>>> ExpiredTables(
+        const Version& version, uint64_t cutoff);
     
 private:
+    // Merges the inputs' keys in [*begin, *end), a null bound being open
+    static bool CompactRange(
+        const std::vector<std::unique_ptr<SSTable>>& tables,
+        const std::string* begin,
+        const std::string* end,
+        const std::function<std::string()>& next_output_file,
+        const SSTableOptions& options,
+        uint64_t file_order,
+        bool drop_tombstones,
+        std::vector<std::string>& output_files);
+    static bool PickTimeWindowCompaction(const Version& version,
+                                         const Strategy& strategy,
+                                         const std::set<const SSTable*>& compacting,
+                                         Pick& pick);
+    
+    // An input positioned at its next entry. Ordered by key, then newest
+    // first: by sequence, and for version 1 tables (all sequence 0) by
+    // input position, later inputs being newer.
     struct MergeEntry {
-        SSTableEntry entry;
+        SSTable::Iterator* iter;
         size_t source_index;
         
         bool operator>(const MergeEntry& other) const {
-            if (entry.key != other.entry.key) {
-                return entry.key > other.entry.key;
+            int cmp = iter->key().compare(other.iter->key());
+            if (cmp != 0) {
+                return cmp > 0;
+            }
+            if (iter->sequence() != other.iter->sequence()) {
+                return iter->sequence() < other.iter->sequence();
             }
-            return entry.timestamp < other.entry.timestamp;
+            return source_index < other.source_index;
         }
     };
 };
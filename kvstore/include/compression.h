@@ -0,0 +1,86 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace kvstore {
+
+// Stored in every block trailer and in the table header, so the values are
+// part of the on-disk format
+enum class CompressionType : uint8_t {
+    kNone = 0,
+    kLZ4 = 1,
+};
+
+const char* CompressionTypeName(CompressionType type);
+
+// In-tree LZ4 block-format codec. Level 1 does a single hash probe per
+// position; higher levels walk a hash chain (up to 2^level candidates) for
+// longer matches at the cost of compression speed. Decompression speed does
+// not depend on the level.
+namespace lz4 {
+
+constexpr int kMinLevel = 1;
+constexpr int kMaxLevel = 9;
+// Matches can reach at most 64 KB back, so that bounds a useful dictionary
+constexpr size_t kMaxDictionarySize = 64 * 1024;
+
+// Hash table (plus optional chain) of 4-byte sequence positions
+struct MatchTable {
+    int hash_log = 0;
+    std::vector<int32_t> head;
+    std::vector<uint16_t> chain;   // distance back to the previous candidate
+    size_t base = 0;               // position of chain[0]
+    bool use_chain = false;
+
+    void Init(size_t base_pos, size_t num_positions, bool chain_enabled);
+    void Insert(const uint8_t* buf, size_t pos);
+    void Search(const uint8_t* buf, size_t ip, size_t match_limit, int attempts,
+                size_t& best_len, size_t& best_pos) const;
+};
+
+// A dictionary prepared for compression: its match table is built once and
+// then searched read-only for every block, so blocks never rehash it
+class Dictionary {
+public:
+    Dictionary(std::string data, int level);
+
+    std::string_view data() const { return data_; }
+    const MatchTable& table() const { return table_; }
+
+private:
+    std::string data_;
+    MatchTable table_;
+};
+
+// Appends the compressed form of `input` to `output`. With a dictionary,
+// matches may refer back into the dictionary contents.
+void Compress(std::string_view input, int level, std::string& output,
+              const Dictionary* dictionary = nullptr);
+
+// Decodes exactly `raw_size` bytes into `output`. Returns false on
+// malformed input instead of reading or writing out of bounds.
+bool Decompress(std::string_view input, size_t raw_size, std::string& output,
+                std::string_view dictionary = {});
+
+} // namespace lz4
+
+// Builds a dictionary of at most `max_size` bytes out of the fixed-size
+// segments whose 8-byte substrings recur most often across `samples`
+std::string TrainDictionary(const std::vector<std::string_view>& samples,
+                            size_t max_size);
+
+// Block-level wrappers. A compressed block is varint32(raw size) followed
+// by the codec payload.
+void CompressBlock(CompressionType type, int level, std::string_view raw,
+                   std::string& output,
+                   const lz4::Dictionary* dictionary = nullptr);
+bool DecompressBlock(CompressionType type, std::string_view compressed,
+                     std::string& output, std::string_view dictionary = {});
+
+} // namespace kvstore
+
+#endif // COMPRESSION_H
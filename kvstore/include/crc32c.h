@@ -0,0 +1,37 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kvstore {
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it and a table-driven version otherwise; both give the same result.
+namespace crc32c {
+
+// Extends `crc` (the CRC of some earlier data) with `data`
+uint32_t Extend(uint32_t crc, const char* data, size_t n);
+
+inline uint32_t Value(const char* data, size_t n) { return Extend(0, data, n); }
+
+bool IsHardwareAccelerated();
+
+// A CRC computed over data that itself contains CRCs is weak, so stored
+// CRCs are masked first
+constexpr uint32_t kMaskDelta = 0xa282ead8u;
+
+inline uint32_t Mask(uint32_t crc) {
+    return ((crc >> 15) | (crc << 17)) + kMaskDelta;
+}
+
+inline uint32_t Unmask(uint32_t masked) {
+    uint32_t rot = masked - kMaskDelta;
+    return (rot >> 17) | (rot << 15);
+}
+
+} // namespace crc32c
+
+} // namespace kvstore
+
+#endif // CRC32C_H
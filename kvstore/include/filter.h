@@ -0,0 +1,42 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace kvstore {
+
+// Stored as the last byte of every SSTable filter block, so the values are
+// part of the on-disk format
+enum class FilterType : uint8_t {
+    kNone = 0,
+    kBloom = 1,     // blocked Bloom filter, ~1% false positives
+    kXor = 2,       // xor filter, ~0.4% at about the same bits per key
+};
+
+const char* FilterTypeName(FilterType type);
+
+// Read side of a per-table key filter. Keys are hashed once with Hash64 and
+// every filter works from that hash.
+class KeyFilter {
+public:
+    virtual ~KeyFilter() = default;
+
+    virtual bool MayContainHash(uint64_t hash) const = 0;
+    virtual size_t MemoryUsage() const = 0;
+    virtual FilterType Type() const = 0;
+
+    bool MayContain(std::string_view key) const;
+};
+
+// Builds filter block contents from one hash per key; empty for kNone
+std::string BuildFilterBlock(FilterType type, std::vector<uint64_t> hashes);
+// Returns nullptr if the block is empty or malformed
+std::unique_ptr<KeyFilter> ParseFilterBlock(std::string_view block);
+
+} // namespace kvstore
+
+#endif // FILTER_H
@@ -0,0 +1,75 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace kvstore {
+
+// Fixed-width little-endian encoding
+void PutFixed32(std::string& dst, uint32_t value);
+void PutFixed64(std::string& dst, uint64_t value);
+uint32_t DecodeFixed32(const char* ptr);
+uint64_t DecodeFixed64(const char* ptr);
+// In place, for fields patched after encoding
+void EncodeFixed32(char* dst, uint32_t value);
+void EncodeFixed64(char* dst, uint64_t value);
+
+// Variable-length encoding (7 bits per byte, high bit = continuation)
+void PutVarint32(std::string& dst, uint32_t value);
+void PutVarint64(std::string& dst, uint64_t value);
+void PutLengthPrefixed(std::string& dst, std::string_view value);
+
+// Decoders consume from the front of `input` and return false on truncation
+bool GetVarint32(std::string_view& input, uint32_t& value);
+bool GetVarint64(std::string_view& input, uint64_t& value);
+bool GetLengthPrefixed(std::string_view& input, std::string_view& value);
+
+// Location of a block inside an SSTable file
+struct BlockHandle {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+
+    void EncodeTo(std::string& dst) const;
+    bool DecodeFrom(std::string_view& input);
+};
+
+// Fixed-size tail of every SSTable. A reader locates all other metadata
+// from this single read at the end of the file.
+//
+// metaindex, index, filter, properties handles (fixed64 offset + size each)
+// format_version (fixed32), magic (fixed64)
+struct Footer {
+    static constexpr uint64_t kTableMagicNumber = 0x6c6f6773656e7472ull;
+    // 2 added sequence numbers to data block entries; version 1 tables are
+    // still read, with every entry at sequence 0
+    static constexpr uint32_t kFormatVersion = 2;
+    static constexpr size_t kEncodedLength = 4 * 16 + 4 + 8;
+
+    BlockHandle metaindex_handle;
+    BlockHandle index_handle;
+    BlockHandle filter_handle;
+    BlockHandle properties_handle;
+    uint32_t format_version = kFormatVersion;
+
+    void EncodeTo(std::string& dst) const;
+    // Reads kEncodedLength bytes; fails on a bad magic or unknown version
+    bool DecodeFrom(const char* ptr);
+};
+
+// Every block is followed by one byte naming its compression type
+inline constexpr size_t kBlockTrailerSize = 1;
+// Metaindex entry naming the compression dictionary block
+inline constexpr char kDictionaryBlockName[] = "compression.dictionary";
+// Metaindex entry naming the filter over key prefixes
+inline constexpr char kPrefixFilterBlockName[] = "filter.prefix";
+// Data block values start with a flags byte, then varint64 sequence (from
+// format version 2), varint64 timestamp and the user value
+inline constexpr uint8_t kEntryDeleted = 0x01;
+// Sequence numbers share a 64-bit tag with an 8-bit entry type in memory
+inline constexpr uint64_t kMaxSequenceNumber = (uint64_t{1} << 56) - 1;
+
+} // namespace kvstore
+
+#endif // FORMAT_H
@@ -0,0 +1,14 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <string_view>
+#include <cstdint>
+
+namespace kvstore {
+
+// Fast non-cryptographic 64-bit hash (MurmurHash64A). Never allocates.
+uint64_t Hash64(std::string_view data, uint64_t seed = 0);
+
+} // namespace kvstore
+
+#endif // HASH_H
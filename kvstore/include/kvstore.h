@@ -4,23 +4,136 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <chrono>
 #include <vector>
 #include <map>
+#include <set>
 #include "memtable.h"
 #include "sstable.h"
+#include "version.h"
+#include "compaction.h"
+#include "scheduler.h"
 #include "wal.h"
+#include "write_batch.h"
 #include "bloom_filter.h"
 #include "lru_cache.h"
+#include "write_buffer_manager.h"
+#include "write_controller.h"
+#include "rate_limiter.h"
 
 namespace kvstore {
 
+// How far a write has to get before it is acknowledged
+enum class Durability {
+    kNone,      // memtable only; lost if the process dies before a flush
+    kBuffered,  // WAL handed to the OS; survives a process crash
+    kSync,      // WAL synced to disk before returning
+    kPeriodic,  // like kBuffered, but the WAL is synced at least every
+                // wal_sync_interval_ms
+};
+
+enum class CompactionStyle {
+    kLeveled,
+    // For append-mostly, time-keyed data: tables stay in level 0 grouped
+    // by the time window of their newest entry and are only merged within
+    // a window, so old windows are not rewritten over and over
+    kTimeWindow,
+};
+
 struct Config {
     std::string data_dir = "./data";
+    // For writes that do not choose their own
+    Durability durability = Durability::kBuffered;
+    size_t wal_sync_interval_ms = 100;
+    // WALs whose memtables are flushed are kept (up to this many) and
+    // overwritten by later WALs, so appends reuse allocated blocks instead of
+    // extending a file; 0 deletes them
+    size_t recycle_wal_count = 4;
+    // Threads inserting replayed WAL records into memtables when the store
+    // opens, while the opening thread reads and verifies the log; 1 replays
+    // on the opening thread alone
+    size_t wal_recovery_threads = 4;
     size_t memtable_size_mb = 64;
+    // Full memtables wait in a queue for the background flush thread;
+    // writers stall only once this many are waiting. Flushes have a thread
+    // of their own, so they never wait behind compactions.
+    size_t max_immutable_memtables = 2;
+    // Backpressure when flushes or compactions fall behind. Past a slowdown
+    // threshold writes are delayed, at a rate falling from
+    // delayed_write_rate_mb towards zero as the stop threshold nears; at
+    // the stop threshold they wait for background work. Delays also start
+    // once max_immutable_memtables - 1 memtables are queued (if at least 3
+    // are allowed). A zero pending-bytes limit disables that signal.
+    size_t level0_slowdown_writes_trigger = 20;
+    size_t level0_stop_writes_trigger = 36;
+    uint64_t soft_pending_compaction_bytes_limit = 64ull << 30;
+    uint64_t hard_pending_compaction_bytes_limit = 256ull << 30;
+    size_t delayed_write_rate_mb = 16;
+    // Level 0 is compacted into level 1 once it holds compaction_threshold
+    // tables. Each deeper level is compacted into the next once it outgrows
+    // its size target: max_bytes_for_level_base_mb for level 1, and
+    // max_bytes_for_level_multiplier times the level above for the rest.
     size_t compaction_threshold = 4;
+    size_t max_bytes_for_level_base_mb = 256;
+    size_t max_bytes_for_level_multiplier = 10;
+    CompactionStyle compaction_style = CompactionStyle::kLeveled;
+    uint64_t compaction_window_ms = 60 * 60 * 1000;
+    // Tables whose newest entry is older than this are deleted whole,
+    // without being read, when compaction next runs; 0 keeps everything.
+    // Expired entries sharing a table with newer ones stay until it goes.
+    uint64_t ttl_seconds = 0;
+    // Background threads for compactions. Compactions over disjoint sets
+    // of tables run side by side.
+    size_t max_background_compactions = 2;
+    // Threads one compaction is split across, each merging its own key
+    // range into separate tables; a compaction smaller than this many
+    // output tables uses fewer. 1 keeps each compaction on one thread.
+    size_t max_subcompactions = 1;
     size_t cache_size_mb = 128;
     bool enable_compression = true;
+    int compression_level = 1;          // 1 (fastest) to 9 (smallest)
+    size_t compression_dict_kb = 16;    // trained per SSTable, 0 disables
+    size_t block_size_kb = 4;
+    size_t target_file_size_mb = 64;    // compaction output split size
     bool enable_bloom_filter = true;
+    FilterType filter_type = FilterType::kBloom;
+    // Tables produced by compactions that include the oldest table hold
+    // most of the data, so they get the smaller filter
+    FilterType bottommost_filter_type = FilterType::kXor;
+    // Scans whose bounds share a prefix skip tables whose prefix filter
+    // rules it out, e.g. NewDelimitedPrefixExtractor(':', 2) for
+    // "log:<service>:" keys. Null disables prefix filters.
+    std::shared_ptr<const PrefixExtractor> prefix_extractor;
+    // Shared by every store that should fit in one memtable budget; a store
+    // flushes its memtable once the manager reports the budget is reached.
+    // Null leaves memtable_size_mb as the only limit.
+    std::shared_ptr<WriteBufferManager> write_buffer_manager;
+    // Paces flush and compaction writes so they leave disk bandwidth to
+    // reads, flushes first. WAL appends are foreground writes and are not
+    // paced. Shared by the stores on one disk; an auto-tuned limiter
+    // follows the largest compaction debt among them. Null leaves
+    // background writes unthrottled.
+    std::shared_ptr<RateLimiter> rate_limiter;
+};
+
+// A consistent point-in-time view of a store. It pins the memtables and
+// tables that were current when it was taken, so reads through it need no
+// lock and are not torn by later writes, flushes or compactions. Whatever
+// it pins stays in memory or on disk until it is released.
+class Snapshot {
+public:
+    uint64_t GetSequenceNumber() const { return sequence_; }
+
+private:
+    friend class KVStore;
+    uint64_t sequence_ = 0;
+    std::shared_ptr<MemTable> memtable_;
+    std::shared_ptr<const MemTableList> immutables_;
+    std::shared_ptr<const Version> version_;
 };
 
 class KVStore {
@@ -29,55 +142,218 @@ public:
     ~KVStore();
 
     // Basic operations
+    // Concurrent writers are committed in groups: one of them appends
+    // everyone's records to the WAL with a single write (and at most one
+    // sync) while the others wait for it
     bool Put(const std::string& key, const std::string& value);
-    bool Get(const std::string& key, std::string& value);
+    bool Put(const std::string& key, const std::string& value,
+             Durability durability);
+    // Reads without a snapshot see the latest writes
+    bool Get(const std::string& key, std::string& value,
+             const Snapshot* snapshot = nullptr);
     bool Delete(const std::string& key);
+    bool Delete(const std::string& key, Durability durability);
     
-    // Batch operations
+    // Batch operations. A batch is applied atomically: after a crash and
+    // to every reader, either all of it is there or none of it.
+    bool Write(const WriteBatch& batch);
+    bool Write(const WriteBatch& batch, Durability durability);
     bool PutBatch(const std::vector<std::pair<std::string, std::string>>& entries);
+    bool PutBatch(const std::vector<std::pair<std::string, std::string>>& entries,
+                  Durability durability);
     
     // Range scan
     std::vector<std::pair<std::string, std::string>> Scan(
         const std::string& start_key,
         const std::string& end_key,
-        size_t limit = 1000
+        size_t limit = 1000,
+        const Snapshot* snapshot = nullptr
     );
     
+    // Range scan restricted to values written within [min_timestamp,
+    // max_timestamp] (ms since epoch). Each key is reported as of
+    // max_timestamp; tables outside the window are skipped up front.
+    std::vector<std::pair<std::string, std::string>> ScanTimeRange(
+        const std::string& start_key,
+        const std::string& end_key,
+        uint64_t min_timestamp,
+        uint64_t max_timestamp,
+        size_t limit = 1000,
+        const Snapshot* snapshot = nullptr
+    );
+    
+    // Every write gets the next sequence number; a snapshot sees the writes
+    // up to the last one assigned when it was taken. Each snapshot must be
+    // released exactly once.
+    const Snapshot* GetSnapshot();
+    void ReleaseSnapshot(const Snapshot* snapshot);
+    
     // Statistics
     struct Stats {
         size_t total_keys;
         size_t total_size_bytes;
-        size_t memtable_size;
+        size_t memtable_size;           // bytes reserved by the memtable arena
+        size_t memtable_allocated_bytes; // part of it holding entries
+        size_t num_immutable_memtables;  // waiting to be flushed
         size_t num_sstables;
+        std::vector<size_t> num_sstables_per_level; // level 0 first
         size_t cache_hits;
         size_t cache_misses;
+        size_t raw_data_bytes;      // SSTable data blocks before compression
+        size_t stored_data_bytes;   // SSTable data blocks as written
+        double compression_ratio;   // raw / stored, 1.0 when uncompressed
+        size_t num_tombstones;      // deletions persisted in SSTables
+        uint64_t oldest_timestamp;  // SSTable entry time range (ms), 0 if none
+        uint64_t newest_timestamp;
+        size_t filter_memory_bytes; // filters loaded so far
+        uint64_t pending_compaction_bytes;
+        size_t num_running_compactions;
+        WriteStallCondition write_stall_condition;
+        uint64_t write_delayed_micros; // total time writers were throttled
+        uint64_t write_stopped_micros; // total time writers were blocked
+        // From the rate limiter, so across every store sharing it; 0 without
+        uint64_t rate_limited_bytes;     // background writes that had to wait
+        uint64_t rate_limit_wait_micros; // total time they waited
+        uint64_t last_sequence;
+        size_t num_snapshots;
+        uint64_t num_writes;        // Put/Delete/PutBatch/Write calls committed
+        uint64_t num_write_groups;  // WAL commits those were grouped into
+        uint64_t num_wal_syncs;
     };
     Stats GetStats() const;
     
     // Maintenance
     void Compact();
+    // Flushes the memtable and waits until every queued memtable is on disk
     void Flush();
     
 private:
     Config config_;
-    std::unique_ptr<MemTable> memtable_;
-    std::unique_ptr<MemTable> immutable_memtable_;
-    std::vector<std::unique_ptr<SSTable>> sstables_;
-    std::unique_ptr<WAL> wal_;
+    // mutex_ guards these pointers only. Readers copy them under the lock and
+    // then search without it, so disk reads never block writers.
+    std::shared_ptr<MemTable> memtable_;
+    // Full memtables waiting for the flush thread, oldest first. Readers
+    // consult them between the memtable and the SSTables.
+    std::shared_ptr<const MemTableList> immutable_memtables_;
+    std::shared_ptr<const Version> version_;
+    // Log of the edits that produced version_, rewritten whole on each
+    // open. manifest_mutex_ serializes appends; it is taken before mutex_.
+    std::unique_ptr<WAL> manifest_;
+    std::mutex manifest_mutex_;
+    // Each memtable has its own WAL, removed once the memtable is flushed.
+    // immutable_logs_ holds the WAL numbers of immutable_memtables_.
+    std::shared_ptr<WAL> wal_;
+    uint64_t log_number_;
+    std::deque<uint64_t> immutable_logs_;
+    // Retired WAL files waiting for reuse, by their old numbers
+    std::deque<uint64_t> recycled_logs_;
     std::unique_ptr<LRUCache> cache_;
     
     mutable std::mutex mutex_;
-    mutable std::mutex compaction_mutex_;
     
-    bool should_flush_;
-    size_t next_sstable_id_;
+    std::atomic<size_t> next_sstable_id_;
+    
+    // A write waiting in writers_. A null batch asks the leader to switch
+    // the memtable instead.
+    struct Writer {
+        const WriteBatch* batch;
+        Durability durability;
+        bool done = false;
+        bool ok = false;
+        std::condition_variable cv;
+    };
+    // Guarded by mutex_. The front writer leads: it commits a group of the
+    // writers behind it with mutex_ released, and only it may switch the
+    // memtable or WAL.
+    std::deque<Writer*> writers_;
+    bool wal_unsynced_;
+    std::chrono::steady_clock::time_point last_wal_sync_;
+    uint64_t num_writes_;
+    uint64_t num_write_groups_;
+    uint64_t num_wal_syncs_;
+    // Sequence of the newest write visible to readers, guarded by mutex_
+    uint64_t last_sequence_;
+    std::set<const Snapshot*> snapshots_;
+    
+    // Background work, guarded by mutex_. Flushes run one at a time, in
+    // queue order, as high priority jobs; compactions as low priority ones.
+    std::unique_ptr<Scheduler> scheduler_;
+    bool flush_scheduled_;
+    size_t scheduled_compactions_;
+    // Inputs of running compactions, which no other compaction may pick
+    std::set<const SSTable*> compacting_;
+    // The queue shrank, a flush failed, a compaction finished or the stall
+    // condition changed
+    std::condition_variable flush_done_cv_;
+    bool flush_error_;
+    bool shutting_down_;
+    // Keeps periodic durability on schedule
+    std::thread sync_thread_;
+    std::condition_variable sync_cv_;       // shutdown
+    
+    // Guarded by mutex_
+    WriteController write_controller_;
+    uint64_t pending_compaction_bytes_;
     
     // Private methods
-    void FlushMemTable();
+    bool WriteImpl(const WriteBatch* batch, Durability durability);
+    // Picks the writers that join the leader's group, the leader first
+    void BuildWriteGroup(std::vector<Writer*>& group, size_t& group_bytes);
+    // Syncs the WAL if periodic durability is due; called by the sync
+    // thread, which wakes up every wal_sync_interval_ms
+    void MaybePeriodicSync(std::unique_lock<std::mutex>& lock);
+    // The current memtables and tables, pinned under mutex_
+    Snapshot CurrentView() const;
+    // Queues the memtable for flushing and starts a new one. Called with
+    // mutex_ held; waits while the queue is full.
+    void SwitchMemTable(std::unique_lock<std::mutex>& lock);
+    // Applies write backpressure before a write of `bytes`. Called with
+    // mutex_ held, which it releases while waiting.
+    void DelayWrite(std::unique_lock<std::mutex>& lock, size_t bytes);
+    // Re-derives the stall condition after the LSM shape changed. Called
+    // under mutex_.
+    void UpdateWriteStallCondition();
+    // Called under mutex_ after a write
+    bool MemTableFull() const;
+    // Called under mutex_
+    void MaybeScheduleFlush();
+    void MaybeScheduleCompaction();
+    // Flushes queued memtables until none are left
+    void BackgroundFlush();
+    // Runs one compaction and schedules the next if more are due
+    void BackgroundCompaction();
+    void BackgroundSync();
+    bool WriteLevel0Table(const MemTable& memtable, const std::string& filename,
+                          size_t id) const;
+    // Builds the version from the MANIFEST, or from every table in level 0
+    // for stores without one, and starts a new MANIFEST
     void LoadSSTables();
-    void MaybeCompact();
+    // Appends the edit to the MANIFEST and syncs it. Called without
+    // mutex_; the caller installs the edit afterwards. Flushes only add
+    // level 0 tables and concurrent compactions never share tables, so
+    // edits logged concurrently never touch the same tables.
+    bool LogVersionEdit(VersionEdit& edit);
+    Compaction::Strategy GetCompactionStrategy() const;
+    // Returns true if a compaction ran or tables expired. Safe to call from
+    // several threads; each picks tables the others are not compacting.
+    bool MaybeCompact();
+    // Deletes the tables past ttl_seconds that no compaction holds
+    bool DropExpiredTables();
     void RecoverFromWAL();
+    // Opens the WAL for a new memtable, reusing a retired file if there is
+    // one. Called under mutex_.
+    std::shared_ptr<WAL> NewWAL(uint64_t number);
+    // Called under mutex_ once the log's memtable is durably flushed
+    void RetireWAL(uint64_t number);
+    std::string GetWALPath(uint64_t number) const;
+    std::string GetRecycledWALPath(uint64_t number) const;
     std::string GetSSTablePath(size_t id) const;
+    std::string GetManifestPath() const;
+    SSTableOptions GetSSTableOptions(bool bottommost = false) const;
+    // Whether a table can hold keys in [start_key, end_key], judged from
+    // its properties and prefix filter
+    bool TableMayOverlap(const SSTable& sstable, const std::string& start_key,
+                         const std::string& end_key) const;
 };
 
 } // namespace kvstore
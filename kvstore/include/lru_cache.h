@@ -5,6 +5,8 @@
 #include <unordered_map>
 #include <list>
 #include <mutex>
+#include <array>
+#include <cstdint>
 
 namespace kvstore {
 
@@ -15,6 +17,13 @@ public:
     bool Get(const std::string& key, std::string& value);
     void Put(const std::string& key, const std::string& value);
     void Invalidate(const std::string& key);
+
+    // Readers that look a value up without holding the writer's lock take a
+    // generation first and insert with PutIfGeneration, which refuses the
+    // insert if the key may have been invalidated in between.
+    uint64_t Generation(const std::string& key) const;
+    bool PutIfGeneration(const std::string& key, const std::string& value,
+                         uint64_t generation);
     void Clear();
     
     size_t Size() const { return current_size_; }
@@ -35,12 +44,18 @@ private:
     size_t hits_;
     size_t misses_;
     
+    // Invalidation counters, striped by key hash
+    static constexpr size_t kGenerationStripes = 64;
+    std::array<uint64_t, kGenerationStripes> generations_;
+    
     std::list<CacheEntry> lru_list_;
     std::unordered_map<std::string, std::list<CacheEntry>::iterator> cache_map_;
     
     mutable std::mutex mutex_;
     
     void Evict();
+    void PutLocked(const std::string& key, const std::string& value);
+    size_t Stripe(const std::string& key) const;
     size_t EstimateSize(const std::string& key, const std::string& value) const;
 };
 
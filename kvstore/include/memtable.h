@@ -1,52 +1,115 @@
 #ifndef MEMTABLE_H
 #define MEMTABLE_H
 
-#include <map>
 #include <string>
-#include <mutex>
-#include <chrono>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "arena.h"
+#include "format.h"
+#include "write_buffer_manager.h"
 
 namespace kvstore {
 
-struct Entry {
-    std::string value;
-    bool is_deleted;
-    std::chrono::system_clock::time_point timestamp;
-    
-    Entry() : is_deleted(false), timestamp(std::chrono::system_clock::now()) {}
-    Entry(const std::string& v) : value(v), is_deleted(false), 
-        timestamp(std::chrono::system_clock::now()) {}
-    Entry(const std::string& v, bool deleted) : value(v), is_deleted(deleted),
-        timestamp(std::chrono::system_clock::now()) {}
-};
-
+// Concurrent skiplist memtable. Every Put and Delete inserts a new version
+// ordered by (key ascending, sequence descending), so nothing is ever
+// modified in place: readers traverse without locks, and inserts link
+// themselves in with compare-and-swap. Reads take a snapshot sequence and
+// see only versions written at or before it. Keys, values and skiplist nodes all
+// live in one arena, so dropping a flushed memtable is a single release.
 class MemTable {
 public:
-    MemTable() : size_bytes_(0) {}
+    // Memory is charged to `write_buffer_manager` when one is given
+    explicit MemTable(std::shared_ptr<WriteBufferManager> write_buffer_manager = nullptr);
+    ~MemTable();
+    
+    MemTable(const MemTable&) = delete;
+    MemTable& operator=(const MemTable&) = delete;
+    
+    // Safe to call from many threads at once. Sequence numbers come from
+    // the caller and must be unique. A `timestamp` of 0 stamps the entry
+    // with the current time; replay passes the time the write was logged.
+    void Put(std::string_view key, std::string_view value, uint64_t sequence,
+             uint64_t timestamp = 0);
+    void Delete(std::string_view key, uint64_t sequence, uint64_t timestamp = 0);
+    // Returns false for a tombstone and reports it through `is_deleted`
+    bool Get(const std::string& key, std::string& value,
+             bool* is_deleted = nullptr,
+             uint64_t snapshot = kMaxSequenceNumber) const;
     
-    void Put(const std::string& key, const std::string& value);
-    bool Get(const std::string& key, std::string& value) const;
-    void Delete(const std::string& key);
+    // Number of distinct keys
+    size_t Size() const { return num_keys_.load(std::memory_order_relaxed); }
+    // Memory reserved from the system, which is what counts against budgets
+    size_t SizeBytes() const { return arena_.MemoryUsage(); }
+    // Part of SizeBytes() actually holding entries and nodes
+    size_t AllocatedBytes() const { return arena_.AllocatedBytes(); }
+    bool IsEmpty() const { return Size() == 0; }
     
-    size_t Size() const { return table_.size(); }
-    size_t SizeBytes() const { return size_bytes_; }
-    bool IsEmpty() const { return table_.empty(); }
+    // Called once no more writes will come, e.g. when a flush starts, so
+    // the write buffer manager stops counting this memtable as mutable
+    void MarkImmutable();
     
-    // Iterator support for flushing to SSTable
-    using Iterator = std::map<std::string, Entry>::const_iterator;
-    Iterator Begin() const { return table_.begin(); }
-    Iterator End() const { return table_.end(); }
+    struct Node;
     
-    void Clear();
+    // Visits the newest version of each key visible at the snapshot, in
+    // key order. Iterating while other threads insert is safe; entries
+    // added behind the iterator are simply not seen.
+    class Iterator {
+    public:
+        Iterator(const Node* node, uint64_t snapshot);
+        
+        std::string_view key() const;
+        std::string_view value() const;
+        bool is_deleted() const;
+        // Milliseconds since the epoch at which the entry was written
+        uint64_t timestamp() const;
+        uint64_t sequence() const;
+        
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const { return node_ == other.node_; }
+        bool operator!=(const Iterator& other) const { return node_ != other.node_; }
+        
+    private:
+        const Node* node_;
+        uint64_t snapshot_;
+        
+        // Moves past versions newer than the snapshot
+        void SkipInvisible();
+    };
+    
+    Iterator Begin(uint64_t snapshot = kMaxSequenceNumber) const;
+    // Positioned at the first key >= `key`
+    Iterator Seek(std::string_view key,
+                  uint64_t snapshot = kMaxSequenceNumber) const;
+    Iterator End() const { return Iterator(nullptr, kMaxSequenceNumber); }
     
 private:
-    std::map<std::string, Entry> table_;
-    size_t size_bytes_;
-    mutable std::mutex mutex_;
+    static constexpr int kMaxHeight = 12;
+    
+    // Declared before the arena, which reports to it until destroyed
+    std::shared_ptr<WriteBufferManager> write_buffer_manager_;
+    bool immutable_;
+    Arena arena_;
+    Node* head_;
+    std::atomic<int> max_height_;
+    std::atomic<size_t> num_keys_;
     
-    size_t EstimateSize(const std::string& key, const Entry& entry) const;
+    void Add(std::string_view key, std::string_view value, bool is_deleted,
+             uint64_t sequence, uint64_t timestamp);
+    void Insert(Node* node, int height);
+    Node* NewNode(const char* entry, int height);
+    // First node at or after (key, sequence)
+    const Node* FindGreaterOrEqual(std::string_view key, uint64_t sequence) const;
+    void FindSpliceForLevel(std::string_view key, uint64_t sequence,
+                            Node* before, Node* after, int level,
+                            Node** out_prev, Node** out_next) const;
+    static int RandomHeight();
 };
 
+using MemTableList = std::vector<std::shared_ptr<MemTable>>;
+
 } // namespace kvstore
 
 #endif // MEMTABLE_H
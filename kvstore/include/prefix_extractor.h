@@ -0,0 +1,35 @@
+#ifndef PREFIX_EXTRACTOR_H
+#define PREFIX_EXTRACTOR_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+
+namespace kvstore {
+
+// Maps a key to the prefix that scans are issued for, e.g. "log:web:" for
+// "log:web:2024-01-01T00:00:00". SSTables keep a filter over the prefixes
+// of their keys so prefix scans can skip tables without reading them.
+//
+// Every key that starts with a prefix P must transform to P, so a range
+// whose two bounds share a prefix only holds keys with that prefix.
+class PrefixExtractor {
+public:
+    virtual ~PrefixExtractor() = default;
+
+    // Keys outside the domain have no prefix and are left out of the filter
+    virtual bool InDomain(std::string_view key) const = 0;
+    virtual std::string_view Transform(std::string_view key) const = 0;
+    // Stored with each table; a filter is only used by the same extractor
+    virtual std::string Name() const = 0;
+};
+
+// The first `length` bytes of the key
+std::shared_ptr<const PrefixExtractor> NewFixedPrefixExtractor(size_t length);
+// Everything up to and including the `count`-th `delimiter`
+std::shared_ptr<const PrefixExtractor> NewDelimitedPrefixExtractor(
+    char delimiter, size_t count);
+
+} // namespace kvstore
+
+#endif // PREFIX_EXTRACTOR_H
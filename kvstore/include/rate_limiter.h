@@ -0,0 +1,81 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace kvstore {
+
+enum class IOPriority {
+    kHigh,  // flushes: writers stall while they wait
+    kLow,   // compactions
+};
+
+// Caps the rate of background writes with a token bucket, so flushes and
+// compactions leave disk bandwidth to reads. Tokens accrue at the rate up
+// to a burst of one refill period's worth; a write waits until enough
+// have accrued. High priority writes are served before low priority ones
+// that are waiting.
+//
+// In auto-tuned mode the rate starts well below the limit and rises
+// towards it as the stores report compaction debt, so compactions get the
+// whole budget only when they are falling behind.
+//
+// Thread-safe; one limiter may be shared by stores on the same disk.
+class RateLimiter {
+public:
+    explicit RateLimiter(uint64_t bytes_per_second, bool auto_tuned = false);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Blocks until `bytes` may be written
+    void Request(uint64_t bytes, IOPriority priority);
+
+    // `debt` in [0, 1] says how close `caller`'s compactions are to
+    // stalling its writes. Each caller's latest report is kept and the rate
+    // follows the worst of them, so a store sharing the limiter cannot
+    // undo another's backlog. Ignored unless auto-tuned.
+    void Tune(const void* caller, double debt);
+    // Drops `caller`'s report, for a store that is closing
+    void RemoveCaller(const void* caller);
+    void SetBytesPerSecond(uint64_t bytes_per_second);
+    // The current rate, below the limit while auto-tuned and idle
+    uint64_t GetBytesPerSecond() const;
+
+    // Bytes of requests that had to wait, and how long they waited
+    uint64_t BytesThrottled() const;
+    uint64_t MicrosWaited() const;
+
+private:
+    // Tokens accrue for at most this long, which bounds bursts
+    static constexpr uint64_t kRefillPeriodMicros = 100 * 1000;
+    static constexpr uint64_t kMinBytesPerSecond = 64 * 1024;
+    // Share of the limit an auto-tuned limiter runs at without debt
+    static constexpr double kMinAutoTunedShare = 0.1;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t max_rate_;
+    uint64_t rate_;
+    bool auto_tuned_;
+    std::map<const void*, double> debts_;
+    // Tokens on hand, at most Burst()
+    double available_;
+    std::chrono::steady_clock::time_point last_refill_;
+    size_t high_waiters_;
+    uint64_t bytes_throttled_;
+    uint64_t micros_waited_;
+
+    double Burst() const;
+    void Refill();
+    void UpdateRate();
+    double MaxDebt() const;
+};
+
+} // namespace kvstore
+
+#endif // RATE_LIMITER_H
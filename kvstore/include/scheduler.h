@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kvstore {
+
+enum class JobPriority {
+    kHigh,  // flushes: writers stall while they wait
+    kLow,   // compactions
+};
+
+// Runs background jobs on a fixed pool of threads per priority, so a
+// flush never queues behind long compactions. Idle threads sleep on a
+// condition variable until a job is scheduled.
+class Scheduler {
+public:
+    Scheduler(size_t high_threads, size_t low_threads);
+    // Waits for running jobs; queued ones are dropped
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    void Schedule(JobPriority priority, std::function<void()> job);
+
+private:
+    struct Pool {
+        std::deque<std::function<void()>> queue;
+        std::vector<std::thread> threads;
+        std::condition_variable cv;
+    };
+
+    std::mutex mutex_;
+    Pool pools_[2];
+    bool shutting_down_;
+
+    Pool& GetPool(JobPriority priority) {
+        return pools_[static_cast<int>(priority)];
+    }
+    void Run(Pool& pool);
+};
+
+} // namespace kvstore
+
+#endif // SCHEDULER_H
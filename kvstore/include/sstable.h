@@ -4,8 +4,17 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <fstream>
-#include "bloom_filter.h"
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <string_view>
+#include "block.h"
+#include "filter.h"
+#include "compression.h"
+#include "format.h"
+#include "prefix_extractor.h"
+#include "rate_limiter.h"
+#include "table_properties.h"
 
 namespace kvstore {
 
@@ -14,68 +23,177 @@ struct SSTableEntry {
     std::string value;
     bool is_deleted;
     uint64_t timestamp;
+    // Global write order; 0 for entries from version 1 tables
+    uint64_t sequence = 0;
 };
 
-struct SSTableIndex {
-    std::string key;
-    uint64_t offset;
-    uint32_t size;
+struct SSTableOptions {
+    size_t block_size = 4 * 1024;
+    int block_restart_interval = 16;
+    CompressionType compression = CompressionType::kLZ4;
+    int compression_level = 1;
+    // When non-zero, values are sampled to train a shared compression
+    // dictionary of up to this many bytes, stored once in the table
+    size_t max_dict_bytes = 0;
+    FilterType filter_type = FilterType::kBloom;
+    // When set, a second filter over key prefixes is stored for scans
+    std::shared_ptr<const PrefixExtractor> prefix_extractor;
+    // Compaction starts a new output table once this size is reached
+    uint64_t target_file_size = 64 * 1024 * 1024;
+    // Paces the builder's writes when set
+    std::shared_ptr<RateLimiter> rate_limiter;
+    IOPriority io_priority = IOPriority::kLow;
 };
 
+// The table file is memory-mapped read-only and all read operations are
+// const and stateless, so any number of threads may read one SSTable
+// concurrently without locking.
+//
+// File layout:
+//   data blocks | dictionary | filter | prefix filter | properties |
+//   metaindex | index | footer
+// Opening a table reads only the footer and the small metadata blocks it
+// points to; the index is searched in place in the mapping.
 class SSTable {
 public:
     explicit SSTable(const std::string& filename);
     ~SSTable();
+
+    SSTable(const SSTable&) = delete;
+    SSTable& operator=(const SSTable&) = delete;
     
-    // Read operations
-    bool Get(const std::string& key, std::string& value);
+    // Read operations. Get returns false for a tombstone and, if
+    // `is_deleted` is given, reports it so callers can stop searching
+    // older tables.
+    bool Get(const std::string& key, std::string& value,
+             bool* is_deleted = nullptr) const;
     std::vector<SSTableEntry> Scan(const std::string& start_key, 
                                      const std::string& end_key,
-                                     size_t limit = 1000);
+                                     size_t limit = 1000) const;
+    
+    // Walks the entries in key order, holding one data block at a time.
+    // The table must outlive the iterator, and key() and value() are only
+    // good until it moves.
+    class Iterator {
+    public:
+        explicit Iterator(const SSTable& table);
+        
+        Iterator(const Iterator&) = delete;
+        Iterator& operator=(const Iterator&) = delete;
+        
+        bool Valid() const { return valid_; }
+        // Set when a block or entry could not be read; the iterator stops
+        // there instead of skipping it
+        bool Corrupted() const { return corrupted_; }
+        std::string_view key() const { return data_iter_->key(); }
+        std::string_view value() const { return value_; }
+        bool is_deleted() const { return is_deleted_; }
+        uint64_t timestamp() const { return timestamp_; }
+        uint64_t sequence() const { return sequence_; }
+        
+        void SeekToFirst();
+        // Positions at the first entry with key >= target
+        void Seek(std::string_view target);
+        void Next();
+        
+    private:
+        const SSTable& table_;
+        std::optional<Block::Iterator> index_iter_;
+        std::optional<Block::Iterator> data_iter_;
+        // Holds the current block when it had to be decompressed
+        std::string scratch_;
+        bool valid_;
+        bool corrupted_;
+        std::string_view value_;
+        bool is_deleted_;
+        uint64_t timestamp_;
+        uint64_t sequence_;
+        
+        // Reads the block the index iterator points at
+        bool LoadBlock();
+        // Moves past exhausted blocks, then decodes the current entry
+        void FindEntry();
+    };
+    
+    std::unique_ptr<Iterator> NewIterator() const {
+        return std::make_unique<Iterator>(*this);
+    }
+    // The index keys separating its data blocks, in order. They split the
+    // table into ranges of about one block each without reading any.
+    std::vector<std::string> GetBlockSeparators() const;
     
-    // Write operations (create new SSTable)
+    // Write a whole table at once; see SSTableBuilder for streaming writes
     static bool Create(const std::string& filename,
                       const std::vector<SSTableEntry>& entries,
                       bool use_compression = true,
                       bool use_bloom_filter = true);
+    static bool Create(const std::string& filename,
+                      const std::vector<SSTableEntry>& entries,
+                      const SSTableOptions& options);
     
     // Metadata
-    std::string GetFirstKey() const { return first_key_; }
-    std::string GetLastKey() const { return last_key_; }
+    const std::string& GetFilename() const { return filename_; }
+    std::string GetFirstKey() const { return properties_.smallest_key; }
+    std::string GetLastKey() const { return properties_.largest_key; }
     size_t GetSize() const { return file_size_; }
-    size_t GetNumEntries() const { return num_entries_; }
+    size_t GetNumEntries() const { return properties_.num_entries; }
+    // Uncompressed and on-disk bytes of the data blocks
+    uint64_t GetRawDataSize() const { return properties_.raw_data_size; }
+    uint64_t GetDataSize() const { return properties_.data_size; }
+    CompressionType GetCompression() const { return properties_.compression; }
+    int GetCompressionLevel() const { return properties_.compression_level; }
+    size_t GetDictionarySize() const { return dictionary_.size(); }
     uint64_t GetCreationTime() const { return creation_time_; }
+    const TableProperties& GetProperties() const { return properties_; }
+    uint32_t GetFormatVersion() const { return footer_.format_version; }
+    // False if the file is missing, truncated or not an SSTable
+    bool IsOpen() const { return index_block_ != nullptr; }
     
-    // Check if key might exist (using bloom filter)
+    // Check if key might exist, using the key range and the filter. The
+    // filter block is read on the first call.
     bool MayContain(const std::string& key) const;
+    // False only if no key in the table has `prefix` under `extractor`.
+    // Tables built with a different extractor always answer true.
+    bool MayContainPrefix(const PrefixExtractor& extractor,
+                          std::string_view prefix) const;
+    FilterType GetFilterType() const;
+    // Heap bytes held by the filter; 0 until it has been loaded
+    size_t GetFilterMemoryUsage() const;
     
 private:
     std::string filename_;
-    std::ifstream file_;
-    std::vector<SSTableIndex> index_;
-    std::unique_ptr<BloomFilter> bloom_filter_;
+    int fd_;
+    const char* data_;
+    Footer footer_;
+    TableProperties properties_;
+    std::unique_ptr<Block> index_block_;
+    mutable std::once_flag filter_once_;
+    mutable std::unique_ptr<KeyFilter> filter_;
+    mutable std::atomic<bool> filter_loaded_;
+    BlockHandle prefix_filter_handle_;
+    mutable std::once_flag prefix_filter_once_;
+    mutable std::unique_ptr<KeyFilter> prefix_filter_;
+    mutable std::atomic<bool> prefix_filter_loaded_;
     
-    std::string first_key_;
-    std::string last_key_;
     size_t file_size_;
-    size_t num_entries_;
     uint64_t creation_time_;
-    bool compression_enabled_;
+    // Compression dictionary for data blocks; points into the mapping
+    std::string_view dictionary_;
     
-    bool LoadIndex();
-    bool LoadBloomFilter();
-    bool BinarySearch(const std::string& key, SSTableEntry& entry);
-    
-    // Serialization helpers
-    static bool WriteHeader(std::ofstream& out, size_t num_entries,
-                           bool compression, bool bloom_filter);
-    static bool WriteIndex(std::ofstream& out, 
-                          const std::vector<SSTableIndex>& index);
-    static bool WriteData(std::ofstream& out,
-                         const std::vector<SSTableEntry>& entries,
-                         bool compression);
+    bool LoadTable();
+    void LoadFilter() const;
+    void LoadPrefixFilter() const;
+    // Points `contents` into the mapping for raw blocks, or at `scratch`
+    // after decompressing. Data blocks pass the table's dictionary.
+    bool ReadBlock(const BlockHandle& handle, std::string& scratch,
+                   std::string_view& contents,
+                   std::string_view dictionary = {}) const;
+    bool BinarySearch(const std::string& key, std::string& value,
+                      bool& is_deleted) const;
 };
 
+using SSTableList = std::vector<std::shared_ptr<SSTable>>;
+
 } // namespace kvstore
 
 #endif // SSTABLE_H
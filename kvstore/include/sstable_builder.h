@@ -0,0 +1,99 @@
+#ifndef SSTABLE_BUILDER_H
+#define SSTABLE_BUILDER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "block.h"
+#include "compression.h"
+#include "format.h"
+#include "sstable.h"
+#include "table_properties.h"
+
+namespace kvstore {
+
+// Writes an SSTable incrementally. Entries are added one at a time in key
+// order and emitted block by block through a large write buffer, so memory
+// stays around one block plus the index however big the table gets.
+//
+// When a compression dictionary is requested, entries are held back until
+// enough values have been seen to train it (about 64x the dictionary size),
+// then written out as usual.
+class SSTableBuilder {
+public:
+    SSTableBuilder(const std::string& filename, const SSTableOptions& options);
+    // Abandons the table unless Finish() was called
+    ~SSTableBuilder();
+
+    SSTableBuilder(const SSTableBuilder&) = delete;
+    SSTableBuilder& operator=(const SSTableBuilder&) = delete;
+
+    // Keys must be added in strictly increasing order
+    void Add(std::string_view key, std::string_view value,
+             bool is_deleted, uint64_t timestamp, uint64_t sequence = 0);
+    void Add(const SSTableEntry& entry);
+
+    // Writes the meta blocks and footer and syncs the file
+    bool Finish();
+    // Stops building and removes the partial file
+    void Abandon();
+
+    // False once any write has failed
+    bool IsOk() const { return ok_; }
+    uint64_t NumEntries() const { return props_.num_entries; }
+    // Approximate size of the finished file so far, counting entries still
+    // held back or in the open block
+    uint64_t EstimatedFileSize() const;
+    void SetFileOrder(uint64_t order) { props_.file_order = order; }
+
+private:
+    std::string filename_;
+    SSTableOptions options_;
+    int fd_;
+    bool ok_;
+    bool closed_;
+
+    // Output not yet handed to the kernel, and the file offset it ends at
+    std::string buffer_;
+    uint64_t offset_;
+
+    BlockBuilder data_block_;
+    BlockBuilder index_block_;
+    TableProperties props_;
+    std::string last_key_;
+    // Index entry for the last flushed block, added once the next key is
+    // known so it can use a short separator
+    bool pending_index_entry_;
+    BlockHandle pending_handle_;
+    std::vector<uint64_t> key_hashes_;
+    // Keys arrive sorted, so each distinct prefix is hashed once
+    std::vector<uint64_t> prefix_hashes_;
+    std::string last_prefix_;
+
+    // Entries held back while collecting dictionary samples
+    bool buffering_;
+    std::vector<SSTableEntry> buffered_;
+    uint64_t buffered_bytes_;
+    std::unique_ptr<lz4::Dictionary> dictionary_;
+
+    std::string encoded_;
+    std::string compressed_;
+
+    static constexpr size_t kWriteBufferSize = 1 << 20;
+
+    void AddToBlock(std::string_view key, std::string_view value,
+                    bool is_deleted, uint64_t timestamp, uint64_t sequence);
+    void FlushDataBlock();
+    void LeaveBufferedMode();
+    void WriteBlock(std::string_view raw, CompressionType compression,
+                    const lz4::Dictionary* dictionary, BlockHandle& handle);
+    void WriteRawBlock(std::string_view raw, BlockHandle& handle);
+    void Append(std::string_view data);
+    void FlushBuffer();
+    void WriteFully(std::string_view data);
+    void Close();
+};
+
+} // namespace kvstore
+
+#endif // SSTABLE_BUILDER_H
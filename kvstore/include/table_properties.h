@@ -0,0 +1,49 @@
+#ifndef TABLE_PROPERTIES_H
+#define TABLE_PROPERTIES_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include "compression.h"
+
+namespace kvstore {
+
+// Per-table metadata persisted in the properties block, so opening a table
+// never has to look at its data blocks
+struct TableProperties {
+    uint64_t num_entries = 0;
+    uint64_t num_deletions = 0;
+    // Uncompressed and on-disk bytes of the data blocks
+    uint64_t raw_data_size = 0;
+    uint64_t data_size = 0;
+    uint64_t num_data_blocks = 0;
+    CompressionType compression = CompressionType::kNone;
+    int compression_level = 0;
+    std::string smallest_key;
+    std::string largest_key;
+    // Range of entry timestamps (ms since epoch); meaningless when empty
+    uint64_t min_timestamp = 0;
+    uint64_t max_timestamp = 0;
+    // Position in newest-wins order. Flushed tables use their file id and
+    // compaction outputs inherit the newest input's, so a split output
+    // still sorts where its inputs were.
+    uint64_t file_order = 0;
+    // Newest write in the table, so a reopened store continues after it
+    uint64_t largest_sequence = 0;
+    // Name of the extractor the prefix filter was built with, if any
+    std::string prefix_extractor;
+
+    // Whether the table can hold anything in the inclusive range, judged
+    // from the properties alone
+    bool OverlapsKeyRange(std::string_view start, std::string_view end) const;
+    bool OverlapsTimeRange(uint64_t min_ts, uint64_t max_ts) const;
+
+    // Encoded as a block of name -> value pairs; readers skip names they
+    // do not know, so properties can be added without a format bump
+    std::string Encode() const;
+    bool Decode(std::string_view contents);
+};
+
+} // namespace kvstore
+
+#endif // TABLE_PROPERTIES_H
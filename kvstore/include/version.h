@@ -0,0 +1,78 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <cstdint>
+#include "sstable.h"
+
+namespace kvstore {
+
+// Level 0 plus six sorted levels
+constexpr int kNumLevels = 7;
+
+// Tables are named <number>.sst; false for any other file name
+bool ParseTableNumber(const std::string& path, uint64_t& number);
+
+// A change to the set of live tables. Each edit is one record in the
+// MANIFEST, so after a crash it is either fully applied or not at all.
+struct VersionEdit {
+    // One past the highest table number handed out; 0 leaves it unchanged
+    uint64_t next_file_number = 0;
+    // (level, table number)
+    std::vector<std::pair<int, uint64_t>> deleted_files;
+    std::vector<std::pair<int, uint64_t>> new_files;
+    // The opened tables of new_files, in the same order; not persisted
+    SSTableList new_tables;
+
+    void AddFile(int level, uint64_t number, std::shared_ptr<SSTable> table);
+    void DeleteFile(int level, uint64_t number);
+
+    std::string Encode() const;
+    bool Decode(std::string_view encoded);
+};
+
+// An immutable arrangement of tables in levels. Level 0 holds flushed
+// memtables, oldest first, whose key ranges may overlap. Every deeper level
+// is one sorted run: its tables have disjoint key ranges, are ordered by
+// key, and hold data older than the levels above it. Readers share a
+// version; changes produce a new one.
+class Version {
+public:
+    Version();
+    // Sorts each level into the order described above
+    explicit Version(std::vector<SSTableList> levels);
+
+    // A new version with the edit's tables removed and added
+    std::shared_ptr<const Version> Apply(const VersionEdit& edit) const;
+
+    const SSTableList& Level(int level) const { return levels_[level]; }
+    // Every table, oldest data first: the deepest level first and the
+    // newest level 0 table last
+    const SSTableList& Tables() const { return tables_; }
+    size_t NumTables() const { return tables_.size(); }
+    uint64_t LevelBytes(int level) const;
+
+    // The table of `level` (1 or deeper) whose key range holds `key`, or
+    // null
+    const SSTable* FindTable(int level, std::string_view key) const;
+    // Tables of `level` whose key ranges overlap [start, end]
+    SSTableList OverlappingTables(int level, std::string_view start,
+                                  std::string_view end) const;
+    // Whether a level deeper than `level` has anything in [start, end]
+    bool OverlapInLevelsBelow(int level, std::string_view start,
+                              std::string_view end) const;
+
+private:
+    std::vector<SSTableList> levels_;
+    SSTableList tables_;
+
+    void SortLevels();
+};
+
+} // namespace kvstore
+
+#endif // VERSION_H
@@ -2,9 +2,11 @@
 #define WAL_H
 
 #include <string>
-#include <fstream>
+#include <string_view>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
 
 namespace kvstore {
 
@@ -18,35 +20,140 @@ struct WALRecord {
     std::string key;
     std::string value;
     uint64_t timestamp;
-    uint32_t checksum;
+    // 0 for records written before sequence numbers existed
+    uint64_t sequence;
 };
 
+// A log file is a sequence of kBlockSize blocks. Each logical record is cut
+// into fragments that never cross a block boundary, each behind a header:
+//
+//   masked crc32c (fixed32) | length (fixed16) | fragment type (1 byte)
+//   [| log number (fixed32), recyclable types only]
+//
+// The CRC covers everything after the length. A block tail too short for a
+// header is zero-filled. Each logical record is one encoded WriteBatch.
+//
+// Recyclable fragments carry the low 32 bits of their log's number, so when
+// a retired file is reused for a new log, the old log's records left past
+// the new tail are recognized and not replayed.
+enum class WALFragmentType : uint8_t {
+    kZero = 0,      // never written; a zero header skips to the next block
+    kFull = 1,
+    kFirst = 2,
+    kMiddle = 3,
+    kLast = 4,
+    kRecyclableFull = 5,
+    kRecyclableFirst = 6,
+    kRecyclableMiddle = 7,
+    kRecyclableLast = 8,
+};
+
+struct WALOptions {
+    // Non-zero selects recyclable fragments tagged with this number
+    uint64_t log_number = 0;
+    // Reserved up front with fallocate so appends do not allocate blocks
+    size_t preallocate_size = 0;
+    // Overwrite the file from the start instead of appending to it
+    bool reuse = false;
+};
+
+// fsync on a directory, making file creations and renames in it durable
+bool SyncDirectory(const std::string& dirname);
+
+// Append-only log written through a raw file descriptor. Writes reach the
+// OS (and so survive a process crash) when they return; Sync() forces them
+// to disk. Several records can be encoded into one buffer and appended
+// with a single write, which is how the store commits a group of writers.
 class WAL {
 public:
-    explicit WAL(const std::string& filename);
+    static constexpr size_t kBlockSize = 32 * 1024;
+    static constexpr size_t kHeaderSize = 4 + 2 + 1;
+    static constexpr size_t kRecyclableHeaderSize = kHeaderSize + 4;
+    
+    explicit WAL(const std::string& filename,
+                 const WALOptions& options = WALOptions());
     ~WAL();
     
-    bool Append(WALRecordType type, const std::string& key, 
-                const std::string& value = "");
+    WAL(const WAL&) = delete;
+    WAL& operator=(const WAL&) = delete;
+    
+    bool Append(WALRecordType type, const std::string& key,
+                const std::string& value, uint64_t sequence);
+    // Appends one logical record, normally WriteBatch::Data(). After a
+    // failed write or sync the log's tail is unknown, so every later
+    // append fails too.
+    bool AddRecord(std::string_view encoded);
+    // fdatasync; safe to call while another thread appends. A failure
+    // fails the log, since retrying could report pages the kernel dropped
+    // as durable.
     bool Sync();
     
-    // Recovery
+    // Appends a logged WriteBatch's operations to `records`; false, adding
+    // none, if it is malformed
+    static bool DecodeRecords(std::string_view encoded,
+                              std::vector<WALRecord>& records);
+    
+    // Recovery. Stops at the first corrupt or torn fragment.
     std::vector<WALRecord> ReadAll();
+    // Records of a wal.log written before logs were block-framed
+    static std::vector<WALRecord> ReadLegacyFile(const std::string& filename);
     void Clear();
     
-    size_t Size() const { return current_size_; }
+    bool IsOpen() const { return fd_ >= 0; }
+    size_t Size() const { return current_size_.load(std::memory_order_relaxed); }
     
 private:
     std::string filename_;
-    std::ofstream file_;
-    size_t current_size_;
+    WALOptions options_;
+    int fd_;
+    std::atomic<size_t> current_size_;
+    // Guards the fields below
     std::mutex mutex_;
+    uint64_t offset_;
+    size_t block_offset_;
+    std::string buffer_;
+    // Set by a failed write or sync; Sync() reads it without the lock
+    std::atomic<bool> failed_;
     
-    uint32_t ComputeChecksum(const WALRecord& record) const;
-    bool VerifyChecksum(const WALRecord& record) const;
+    bool WriteFully(std::string_view data);
+};
+
+// Reads the logical records of a log file in order, one block at a time,
+// so memory stays bounded by a block plus the largest record whatever the
+// file holds.
+class WALReader {
+public:
+    // Recyclable fragments from any log other than `log_number` end the
+    // log; with 0 they are accepted whatever their number
+    explicit WALReader(const std::string& filename, uint64_t log_number = 0);
+    ~WALReader();
+    
+    WALReader(const WALReader&) = delete;
+    WALReader& operator=(const WALReader&) = delete;
+    
+    // Sets `record` to the next logical record, which may point into
+    // `scratch`. Returns false at the end of the log: the end of the file,
+    // a record torn by a crash, a previous log's leftovers in a recycled
+    // file, or the first corrupt fragment.
+    bool ReadRecord(std::string_view& record, std::string& scratch);
+    
+    bool IsOpen() const { return fd_ >= 0; }
+    // Whether reading stopped at a corrupt fragment rather than the end
+    bool Corrupted() const { return corrupted_; }
+    
+private:
+    int fd_;
+    uint64_t log_number_;
+    std::string block_;
+    std::string_view remaining_;   // unread part of block_
+    bool eof_;
+    bool corrupted_;
+    // Once the log is known to be recyclable, a legacy fragment can only
+    // be left over from the file's previous use
+    bool recyclable_;
     
-    bool WriteRecord(const WALRecord& record);
-    bool ReadRecord(std::ifstream& in, WALRecord& record);
+    bool ReadBlock();
+    bool ReadFragment(WALFragmentType& type, std::string_view& fragment);
 };
 
 } // namespace kvstore
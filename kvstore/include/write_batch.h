@@ -0,0 +1,70 @@
+#ifndef WRITE_BATCH_H
+#define WRITE_BATCH_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace kvstore {
+
+// Puts and deletes applied as one unit: they reach the WAL as a single
+// record under one checksum, get consecutive sequence numbers, and become
+// visible to readers together. Later operations on a key win over earlier
+// ones in the same batch.
+//
+// Encoded as it is logged:
+//
+//   first sequence (fixed64) | timestamp (fixed64) | count (fixed32) |
+//   operations, each a type byte (WALRecordType), the length-prefixed key
+//   and, for puts, the length-prefixed value
+class WriteBatch {
+public:
+    WriteBatch();
+    
+    void Put(std::string_view key, std::string_view value);
+    void Delete(std::string_view key);
+    // Adds `other`'s operations after this batch's own
+    void Append(const WriteBatch& other);
+    void Clear();
+    
+    uint32_t Count() const;
+    bool IsEmpty() const { return Count() == 0; }
+    // Bytes the batch adds to the WAL
+    size_t ApproximateSize() const { return rep_.size(); }
+    
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        // `timestamp` is the batch's Timestamp(), shared by all of its
+        // operations
+        virtual void Put(std::string_view key, std::string_view value,
+                         uint64_t sequence, uint64_t timestamp) = 0;
+        virtual void Delete(std::string_view key, uint64_t sequence,
+                            uint64_t timestamp) = 0;
+    };
+    // Replays the operations in order, numbered up from Sequence(). False
+    // if the encoding is malformed; operations before the damage have been
+    // replayed by then.
+    bool Iterate(Handler& handler) const;
+    
+    // Set by the store when the batch is committed
+    uint64_t Sequence() const;
+    void SetSequence(uint64_t sequence);
+    uint64_t Timestamp() const;
+    void SetTimestamp(uint64_t timestamp);
+    
+    std::string_view Data() const { return rep_; }
+    // Adopts an encoding read back from the WAL; false if it has no header
+    bool SetData(std::string_view data);
+    
+private:
+    static constexpr size_t kHeaderSize = 8 + 8 + 4;
+    
+    std::string rep_;
+    
+    void SetCount(uint32_t count);
+};
+
+} // namespace kvstore
+
+#endif // WRITE_BATCH_H
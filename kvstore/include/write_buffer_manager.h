@@ -0,0 +1,49 @@
+#ifndef WRITE_BUFFER_MANAGER_H
+#define WRITE_BUFFER_MANAGER_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace kvstore {
+
+// Tracks the memory held by memtables across every store that shares it,
+// so several stores in one process can live within a single budget.
+// Memtable arenas report each block they obtain; once usage nears the
+// budget, ShouldFlush() tells writers to flush their memtable.
+class WriteBufferManager {
+public:
+    // A zero buffer_size only tracks usage and never asks for flushes
+    explicit WriteBufferManager(size_t buffer_size);
+
+    WriteBufferManager(const WriteBufferManager&) = delete;
+    WriteBufferManager& operator=(const WriteBufferManager&) = delete;
+
+    size_t BufferSize() const { return buffer_size_; }
+    // All memtables, including ones waiting to be flushed
+    size_t MemoryUsage() const {
+        return memory_used_.load(std::memory_order_relaxed);
+    }
+    // Memtables still accepting writes
+    size_t MutableMemtableMemoryUsage() const {
+        return memory_active_.load(std::memory_order_relaxed);
+    }
+
+    bool ShouldFlush() const;
+
+    // A memtable obtained `bytes` more memory
+    void ReserveMem(size_t bytes);
+    // A memtable stopped taking writes; its memory is released later
+    void ScheduleFreeMem(size_t bytes);
+    // A memtable was destroyed
+    void FreeMem(size_t bytes);
+
+private:
+    const size_t buffer_size_;
+    const size_t mutable_limit_;
+    std::atomic<size_t> memory_used_;
+    std::atomic<size_t> memory_active_;
+};
+
+} // namespace kvstore
+
+#endif // WRITE_BUFFER_MANAGER_H
@@ -0,0 +1,55 @@
+#ifndef WRITE_CONTROLLER_H
+#define WRITE_CONTROLLER_H
+
+#include <cstdint>
+
+namespace kvstore {
+
+enum class WriteStallCondition {
+    kNormal,
+    kDelayed,
+    kStopped,
+};
+
+// Paces writes when flushes or compactions fall behind. The store reports
+// how close its LSM shape is to the stop thresholds; while delayed, writes
+// are spaced out so that together they proceed at a rate that falls from
+// the configured delayed rate towards zero as the shape gets worse.
+//
+// Not thread-safe: the store calls it under its own mutex.
+class WriteController {
+public:
+    explicit WriteController(uint64_t delayed_write_rate);
+
+    // `severity` in [0, 1] says how far the worst signal has gone from
+    // its slowdown threshold towards its stop threshold
+    void SetCondition(WriteStallCondition condition, double severity = 0);
+    WriteStallCondition Condition() const { return condition_; }
+    // Bytes per second while delayed
+    uint64_t DelayedWriteRate() const { return current_rate_; }
+
+    // Microseconds a write of `bytes` arriving at `now_micros` should wait.
+    // Each call reserves the write's slot, so concurrent writers queue up
+    // behind one another instead of all waiting the same short time.
+    uint64_t GetDelay(uint64_t now_micros, uint64_t bytes);
+
+    void RecordDelay(uint64_t micros) { delayed_micros_ += micros; }
+    void RecordStop(uint64_t micros) { stopped_micros_ += micros; }
+    uint64_t DelayedMicros() const { return delayed_micros_; }
+    uint64_t StoppedMicros() const { return stopped_micros_; }
+
+private:
+    // The rate never drops below this, so delayed writes still finish
+    static constexpr uint64_t kMinWriteRate = 16 * 1024;
+
+    uint64_t max_rate_;
+    uint64_t current_rate_;
+    WriteStallCondition condition_;
+    uint64_t next_write_micros_;
+    uint64_t delayed_micros_;
+    uint64_t stopped_micros_;
+};
+
+} // namespace kvstore
+
+#endif // WRITE_CONTROLLER_H
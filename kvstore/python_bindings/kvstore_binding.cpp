@@ -1,6 +1,7 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include "lsm_engine.h"
+#include "kvstore.h"
 
 namespace py = pybind11;
 
@@ -45,4 +46,74 @@ PYBIND11_MODULE(kvstore, m) {
         
         .def("close", &kvstore::LSMEngine::close,
              "Close the database and flush all data");
+
+    // WriteBatch class
+    py::class_<kvstore::WriteBatch>(m, "WriteBatch")
+        .def(py::init<>())
+        
+        .def("put", [](kvstore::WriteBatch& self, const std::string& key,
+                       const std::string& value) {
+            self.Put(key, value);
+        }, py::arg("key"), py::arg("value"),
+           "Add a put to the batch")
+        
+        .def("delete", [](kvstore::WriteBatch& self, const std::string& key) {
+            self.Delete(key);
+        }, py::arg("key"),
+           "Add a delete to the batch")
+        
+        .def("clear", &kvstore::WriteBatch::Clear,
+             "Remove every operation from the batch")
+        
+        .def("__len__", &kvstore::WriteBatch::Count);
+
+    // KVStore class
+    py::class_<kvstore::KVStore>(m, "KVStore")
+        .def(py::init([](const std::string& data_dir, size_t memtable_size_mb) {
+            kvstore::Config config;
+            config.data_dir = data_dir;
+            config.memtable_size_mb = memtable_size_mb;
+            py::gil_scoped_release release;
+            return std::make_unique<kvstore::KVStore>(config);
+        }), py::arg("data_dir"), py::arg("memtable_size_mb") = 64,
+           "Create or open a store in the given directory, replaying its WAL")
+        
+        .def("put", [](kvstore::KVStore& self, const std::string& key,
+                       const std::string& value) {
+            return self.Put(key, value);
+        }, py::arg("key"), py::arg("value"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Insert or update a key-value pair")
+        
+        .def("get", [](kvstore::KVStore& self, const std::string& key) -> py::object {
+            std::string value;
+            bool found;
+            {
+                py::gil_scoped_release release;
+                found = self.Get(key, value);
+            }
+            if (found) {
+                return py::cast(value);
+            }
+            return py::none();
+        }, py::arg("key"),
+           "Get value by key, returns None if not found")
+        
+        .def("delete", [](kvstore::KVStore& self, const std::string& key) {
+            return self.Delete(key);
+        }, py::arg("key"),
+           py::call_guard<py::gil_scoped_release>(),
+           "Delete a key")
+        
+        .def("write", [](kvstore::KVStore& self, const kvstore::WriteBatch& batch,
+                         bool sync) {
+            return sync ? self.Write(batch, kvstore::Durability::kSync)
+                        : self.Write(batch);
+        }, py::arg("batch"), py::arg("sync") = false,
+           py::call_guard<py::gil_scoped_release>(),
+           "Apply every operation in the batch atomically")
+        
+        .def("flush", &kvstore::KVStore::Flush,
+             py::call_guard<py::gil_scoped_release>(),
+             "Flush the memtable to disk");
 }
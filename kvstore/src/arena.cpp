@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <algorithm>
+
+namespace kvstore {
+
+Arena::Arena(WriteBufferManager* write_buffer_manager)
+    : write_buffer_manager_(write_buffer_manager),
+      current_(nullptr),
+      memory_usage_(0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_.store(NewBlock(kBlockSize), std::memory_order_release);
+}
+
+Arena::~Arena() {
+    if (write_buffer_manager_) {
+        write_buffer_manager_->FreeMem(MemoryUsage());
+    }
+}
+
+char* Arena::Allocate(size_t bytes) {
+    bytes = (bytes + kAlignment - 1) & ~(kAlignment - 1);
+    // Large objects get their own block, before they can claim the rest
+    // of the current one
+    if (bytes > kBlockSize / 4) {
+        return AllocateLarge(bytes);
+    }
+    Block* block = current_.load(std::memory_order_acquire);
+    size_t offset = block->used.fetch_add(bytes, std::memory_order_relaxed);
+    if (offset + bytes <= block->size) {
+        return block->data + offset;
+    }
+    return AllocateFallback(bytes, block);
+}
+
+char* Arena::AllocateLarge(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Block* block = NewBlock(bytes);
+    block->used.store(bytes, std::memory_order_relaxed);
+    return block->data;
+}
+
+char* Arena::AllocateFallback(size_t bytes, Block* full) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Another thread may already have replaced the full block
+    Block* block = current_.load(std::memory_order_acquire);
+    if (block == full) {
+        block = NewBlock(kBlockSize);
+        current_.store(block, std::memory_order_release);
+    }
+    size_t offset = block->used.fetch_add(bytes, std::memory_order_relaxed);
+    if (offset + bytes <= block->size) {
+        return block->data + offset;
+    }
+    // Raced with enough other threads to fill the new block as well
+    block = NewBlock(kBlockSize);
+    current_.store(block, std::memory_order_release);
+    block->used.store(bytes, std::memory_order_relaxed);
+    return block->data;
+}
+
+size_t Arena::AllocatedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t allocated = 0;
+    for (const auto& block : blocks_) {
+        // Failed fast-path adds push `used` past the end of a full block
+        allocated += std::min(block->used.load(std::memory_order_relaxed),
+                              block->size);
+    }
+    return allocated;
+}
+
+Arena::Block* Arena::NewBlock(size_t size) {
+    allocations_.emplace_back(new char[size]);
+    auto block = std::make_unique<Block>();
+    block->used.store(0, std::memory_order_relaxed);
+    block->size = size;
+    block->data = allocations_.back().get();
+    blocks_.push_back(std::move(block));
+    memory_usage_.fetch_add(size + sizeof(Block), std::memory_order_relaxed);
+    if (write_buffer_manager_) {
+        write_buffer_manager_->ReserveMem(size + sizeof(Block));
+    }
+    return blocks_.back().get();
+}
+
+} // namespace kvstore
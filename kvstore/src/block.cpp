@@ -0,0 +1,180 @@
+#include "block.h"
+#include "format.h"
+#include <algorithm>
+
+namespace kvstore {
+
+BlockBuilder::BlockBuilder(int restart_interval)
+    : restart_interval_(std::max(1, restart_interval)), counter_(0),
+      finished_(false) {
+    restarts_.push_back(0);
+}
+
+void BlockBuilder::Reset() {
+    buffer_.clear();
+    restarts_.clear();
+    restarts_.push_back(0);
+    counter_ = 0;
+    finished_ = false;
+    last_key_.clear();
+}
+
+size_t BlockBuilder::CurrentSizeEstimate() const {
+    return buffer_.size() + restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+}
+
+void BlockBuilder::Add(std::string_view key, std::string_view value) {
+    size_t shared = 0;
+    if (counter_ < restart_interval_) {
+        size_t min_len = std::min(last_key_.size(), key.size());
+        while (shared < min_len && last_key_[shared] == key[shared]) {
+            ++shared;
+        }
+    } else {
+        restarts_.push_back(static_cast<uint32_t>(buffer_.size()));
+        counter_ = 0;
+    }
+    size_t non_shared = key.size() - shared;
+
+    PutVarint32(buffer_, static_cast<uint32_t>(shared));
+    PutVarint32(buffer_, static_cast<uint32_t>(non_shared));
+    PutVarint32(buffer_, static_cast<uint32_t>(value.size()));
+    buffer_.append(key.data() + shared, non_shared);
+    buffer_.append(value.data(), value.size());
+
+    last_key_.resize(shared);
+    last_key_.append(key.data() + shared, non_shared);
+    ++counter_;
+}
+
+std::string_view BlockBuilder::Finish() {
+    if (!finished_) {
+        for (uint32_t restart : restarts_) {
+            PutFixed32(buffer_, restart);
+        }
+        PutFixed32(buffer_, static_cast<uint32_t>(restarts_.size()));
+        finished_ = true;
+    }
+    return buffer_;
+}
+
+Block::Block(std::string_view contents)
+    : data_(contents), restarts_offset_(0), num_restarts_(0) {
+    ParseRestarts();
+}
+
+Block::Block(std::string&& contents)
+    : owned_(std::move(contents)), restarts_offset_(0), num_restarts_(0) {
+    data_ = owned_;
+    ParseRestarts();
+}
+
+void Block::ParseRestarts() {
+    if (data_.size() < sizeof(uint32_t)) {
+        return;
+    }
+    uint32_t num_restarts = DecodeFixed32(data_.data() + data_.size() - sizeof(uint32_t));
+    size_t max_restarts = (data_.size() - sizeof(uint32_t)) / sizeof(uint32_t);
+    if (num_restarts == 0 || num_restarts > max_restarts) {
+        return;
+    }
+    num_restarts_ = num_restarts;
+    restarts_offset_ = static_cast<uint32_t>(
+        data_.size() - (1 + num_restarts) * sizeof(uint32_t));
+}
+
+Block::Iterator::Iterator(const Block& block)
+    : data_(block.data_), restarts_offset_(block.restarts_offset_),
+      num_restarts_(block.num_restarts_), current_(block.restarts_offset_),
+      next_(block.restarts_offset_), corrupted_(block.num_restarts_ == 0) {}
+
+uint32_t Block::Iterator::RestartPoint(uint32_t index) const {
+    return DecodeFixed32(data_.data() + restarts_offset_ + index * sizeof(uint32_t));
+}
+
+void Block::Iterator::SeekToRestartPoint(uint32_t index) {
+    key_.clear();
+    next_ = RestartPoint(index);
+    current_ = next_;
+}
+
+void Block::Iterator::MarkCorrupted() {
+    corrupted_ = true;
+    current_ = restarts_offset_;
+    next_ = restarts_offset_;
+    key_.clear();
+    value_ = {};
+}
+
+bool Block::Iterator::ParseNextEntry() {
+    current_ = next_;
+    if (current_ >= restarts_offset_) {
+        current_ = restarts_offset_;
+        return false;
+    }
+
+    std::string_view input = data_.substr(current_, restarts_offset_ - current_);
+    uint32_t shared, non_shared, value_len;
+    if (!GetVarint32(input, shared) || !GetVarint32(input, non_shared) ||
+        !GetVarint32(input, value_len) || shared > key_.size() ||
+        input.size() < static_cast<uint64_t>(non_shared) + value_len) {
+        MarkCorrupted();
+        return false;
+    }
+
+    key_.resize(shared);
+    key_.append(input.data(), non_shared);
+    value_ = input.substr(non_shared, value_len);
+    next_ = static_cast<uint32_t>(value_.data() + value_len - data_.data());
+    return true;
+}
+
+void Block::Iterator::SeekToFirst() {
+    if (corrupted_) return;
+    SeekToRestartPoint(0);
+    ParseNextEntry();
+}
+
+void Block::Iterator::Next() {
+    if (!Valid()) return;
+    ParseNextEntry();
+}
+
+void Block::Iterator::Seek(std::string_view target) {
+    if (corrupted_) return;
+
+    // Binary search for the last restart point whose key is < target
+    uint32_t left = 0;
+    uint32_t right = num_restarts_ - 1;
+    while (left < right) {
+        uint32_t mid = left + (right - left + 1) / 2;
+        uint32_t offset = RestartPoint(mid);
+        if (offset >= restarts_offset_) {
+            MarkCorrupted();
+            return;
+        }
+        std::string_view input = data_.substr(offset, restarts_offset_ - offset);
+        uint32_t shared, non_shared, value_len;
+        if (!GetVarint32(input, shared) || !GetVarint32(input, non_shared) ||
+            !GetVarint32(input, value_len) || shared != 0 ||
+            input.size() < non_shared) {
+            MarkCorrupted();
+            return;
+        }
+        if (input.substr(0, non_shared) < target) {
+            left = mid;
+        } else {
+            right = mid - 1;
+        }
+    }
+
+    // Linear scan within the restart interval
+    SeekToRestartPoint(left);
+    while (ParseNextEntry()) {
+        if (std::string_view(key_) >= target) {
+            return;
+        }
+    }
+}
+
+} // namespace kvstore
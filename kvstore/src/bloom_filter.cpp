@@ -1,71 +1,104 @@
 #include "bloom_filter.h"
+#include "hash.h"
+#include "format.h"
 #include <cmath>
-#include <functional>
+#include <cstring>
+#include <algorithm>
 
 namespace kvstore {
 
+namespace {
+
+// Odd multipliers giving each word of a line its own bit position
+constexpr uint32_t kSalts[8] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+};
+
+} // namespace
+
 BloomFilter::BloomFilter(size_t expected_elements, double false_positive_rate) {
-    size_t m = -1 * expected_elements * std::log(false_positive_rate) / 
-               (std::log(2) * std::log(2));
-    num_hashes_ = std::ceil((m / expected_elements) * std::log(2));
-    bits_.resize(m, false);
+    double n = static_cast<double>(std::max<size_t>(expected_elements, 1));
+    double bits = std::ceil(
+        -n * std::log(false_positive_rate) / (std::log(2) * std::log(2)));
+    size_t num_lines = static_cast<size_t>(
+        std::ceil(bits / static_cast<double>(kBitsPerLine)));
+    lines_.resize(std::max<size_t>(num_lines, 1), CacheLine{});
+}
+
+void BloomFilter::Add(std::string_view key) {
+    AddHash(Hash64(key));
 }
 
-void BloomFilter::Add(const std::string& key) {
-    auto hashes = Hash(key);
-    for (auto h : hashes) {
-        bits_[h % bits_.size()] = true;
+// The high half of the hash picks the line, the low half the bit in each word
+size_t BloomFilter::LineIndex(uint64_t hash) const {
+    return ((hash >> 32) * lines_.size()) >> 32;
+}
+
+void BloomFilter::ProbeMasks(uint64_t hash, uint64_t* masks) {
+    uint32_t low = static_cast<uint32_t>(hash);
+    for (size_t i = 0; i < kWordsPerLine; ++i) {
+        masks[i] = uint64_t{1} << ((low * kSalts[i]) >> 26);
     }
 }
 
-bool BloomFilter::MayContain(const std::string& key) const {
-    auto hashes = Hash(key);
-    for (auto h : hashes) {
-        if (!bits_[h % bits_.size()]) {
-            return false;
-        }
+void BloomFilter::AddHash(uint64_t hash) {
+    uint64_t masks[kWordsPerLine];
+    ProbeMasks(hash, masks);
+    CacheLine& line = lines_[LineIndex(hash)];
+    for (size_t i = 0; i < kWordsPerLine; ++i) {
+        line.words[i] |= masks[i];
     }
-    return true;
 }
 
+bool BloomFilter::MayContainHash(uint64_t hash) const {
+    uint64_t masks[kWordsPerLine];
+    ProbeMasks(hash, masks);
+    const CacheLine& line = lines_[LineIndex(hash)];
+    uint64_t missing = 0;
+    for (size_t i = 0; i < kWordsPerLine; ++i) {
+        missing |= masks[i] & ~line.words[i];
+    }
+    return missing == 0;
+}
+
+// Layout: the cache lines as little-endian 64-bit words
 std::vector<uint8_t> BloomFilter::Serialize() const {
-    std::vector<uint8_t> data;
-    size_t size = bits_.size();
-    data.resize(sizeof(size) + sizeof(num_hashes_) + (size + 7) / 8);
-    
-    size_t offset = 0;
-    std::memcpy(&data[offset], &size, sizeof(size));
-    offset += sizeof(size);
-    std::memcpy(&data[offset], &num_hashes_, sizeof(num_hashes_));
-    offset += sizeof(num_hashes_);
-    
-    for (size_t i = 0; i < bits_.size(); ++i) {
-        if (bits_[i]) {
-            data[offset + i / 8] |= (1 << (i % 8));
+    std::string data;
+    data.reserve(lines_.size() * sizeof(CacheLine));
+    for (const auto& line : lines_) {
+        for (uint64_t word : line.words) {
+            PutFixed64(data, word);
         }
     }
-    
-    return data;
+    return std::vector<uint8_t>(data.begin(), data.end());
 }
 
 BloomFilter BloomFilter::Deserialize(const std::vector<uint8_t>& data) {
-    BloomFilter bf(1); // Placeholder
-    // Deserialization logic
+    BloomFilter bf(1);
+    if (!Deserialize(std::string_view(reinterpret_cast<const char*>(data.data()),
+                                      data.size()),
+                     bf)) {
+        bf.lines_.assign(1, CacheLine{});
+        for (uint64_t& word : bf.lines_[0].words) {
+            word = ~uint64_t{0};
+        }
+    }
     return bf;
 }
 
-std::vector<uint64_t> BloomFilter::Hash(const std::string& key) const {
-    std::vector<uint64_t> hashes;
-    std::hash<std::string> hasher;
-    
-    uint64_t h1 = hasher(key);
-    uint64_t h2 = hasher(key + "salt");
-    
-    for (size_t i = 0; i < num_hashes_; ++i) {
-        hashes.push_back(h1 + i * h2);
+bool BloomFilter::Deserialize(std::string_view data, BloomFilter& filter) {
+    if (data.empty() || data.size() % sizeof(CacheLine) != 0) {
+        return false;
+    }
+    filter.lines_.resize(data.size() / sizeof(CacheLine));
+    for (auto& line : filter.lines_) {
+        for (uint64_t& word : line.words) {
+            word = DecodeFixed64(data.data());
+            data.remove_prefix(sizeof(uint64_t));
+        }
     }
-    
-    return hashes;
+    return true;
 }
 
 } // namespace kvstore
@@ -1,65 +1,402 @@
 #include "compaction.h"
+#include "sstable_builder.h"
 #include <queue>
-#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
 
 namespace kvstore {
 
+namespace {
+
+// Splits level 0 into runs of adjacent tables whose newest entries fall in
+// the same time window, as [begin, end) index pairs. Later memtables hold
+// later writes, so a window's tables are normally one run; merging only
+// adjacent tables keeps the newest-wins order intact either way.
+std::vector<std::pair<size_t, size_t>> WindowRuns(const SSTableList& tables,
+                                                  uint64_t window_ms) {
+    std::vector<std::pair<size_t, size_t>> runs;
+    auto window = [&](size_t i) {
+        return tables[i]->GetProperties().max_timestamp / window_ms;
+    };
+    for (size_t begin = 0, end = 0; begin < tables.size(); begin = end) {
+        for (end = begin + 1; end < tables.size() && window(end) == window(begin); ++end) {
+        }
+        runs.emplace_back(begin, end);
+    }
+    return runs;
+}
+
+// Widens [smallest, largest] to cover the tables; `empty` stays true until
+// a table with entries is seen
+void ExtendKeyRange(const SSTableList& tables, std::string& smallest,
+                    std::string& largest, bool& empty) {
+    for (const auto& table : tables) {
+        const TableProperties& props = table->GetProperties();
+        if (props.num_entries == 0) {
+            continue;
+        }
+        if (empty || props.smallest_key < smallest) {
+            smallest = props.smallest_key;
+        }
+        if (empty || props.largest_key > largest) {
+            largest = props.largest_key;
+        }
+        empty = false;
+    }
+}
+
+} // namespace
+
 bool Compaction::CompactSSTables(
     const std::vector<std::string>& input_files,
-    const std::string& output_file,
-    bool compression) {
-    
-    // Priority queue for merging
-    std::priority_queue<MergeEntry, std::vector<MergeEntry>, 
-                       std::greater<MergeEntry>> pq;
+    const std::function<std::string()>& next_output_file,
+    const SSTableOptions& options,
+    std::vector<std::string>& output_files,
+    bool drop_tombstones,
+    size_t max_subcompactions) {
     
     // Open all input SSTables
     std::vector<std::unique_ptr<SSTable>> tables;
+    uint64_t file_order = 0;
+    uint64_t input_bytes = 0;
     for (const auto& file : input_files) {
         tables.push_back(std::make_unique<SSTable>(file));
+        if (!tables.back()->IsOpen()) {
+            return false;
+        }
+        file_order = std::max(file_order,
+                              tables.back()->GetProperties().file_order);
+        input_bytes += tables.back()->GetSize();
     }
     
-    // Merge all entries
-    std::map<std::string, SSTableEntry> merged;
-    
-    for (size_t i = 0; i < tables.size(); ++i) {
-        auto entries = tables[i]->Scan("", "~", SIZE_MAX);
-        for (const auto& entry : entries) {
-            auto it = merged.find(entry.key);
-            if (it == merged.end() || entry.timestamp > it->second.timestamp) {
-                merged[entry.key] = entry;
+    // Split the key space at data block boundaries into ranges of about
+    // equal size, one per subcompaction, each worth at least an output
+    // table. Every key lands in exactly one range, so the ranges are
+    // merged independently into disjoint outputs.
+    size_t ranges = std::min<uint64_t>(
+        std::max<size_t>(max_subcompactions, 1),
+        std::max<uint64_t>(input_bytes / std::max<uint64_t>(options.target_file_size, 1), 1));
+    std::vector<std::string> boundaries;
+    if (ranges > 1) {
+        std::vector<std::string> separators;
+        for (const auto& table : tables) {
+            auto keys = table->GetBlockSeparators();
+            separators.insert(separators.end(), keys.begin(), keys.end());
+        }
+        std::sort(separators.begin(), separators.end());
+        for (size_t i = 1; i < ranges && !separators.empty(); ++i) {
+            const std::string& key = separators[i * separators.size() / ranges];
+            if (boundaries.empty() || key > boundaries.back()) {
+                boundaries.push_back(key);
             }
         }
     }
     
-    // Write merged entries
-    std::vector<SSTableEntry> output_entries;
-    for (const auto& [key, entry] : merged) {
-        if (!entry.is_deleted) {
-            output_entries.push_back(entry);
-        }
+    std::vector<std::vector<std::string>> outputs(boundaries.size() + 1);
+    std::vector<char> succeeded(outputs.size(), false);
+    auto run = [&](size_t i) {
+        succeeded[i] = CompactRange(
+            tables, i == 0 ? nullptr : &boundaries[i - 1],
+            i < boundaries.size() ? &boundaries[i] : nullptr,
+            next_output_file, options, file_order, drop_tombstones, outputs[i]);
+    };
+    // The calling thread takes the first range
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < outputs.size(); ++i) {
+        threads.emplace_back(run, i);
+    }
+    run(0);
+    for (auto& thread : threads) {
+        thread.join();
     }
     
-    return SSTable::Create(output_file, output_entries, compression, true);
+    bool ok = std::all_of(succeeded.begin(), succeeded.end(),
+                          [](char s) { return s; });
+    for (const auto& range_outputs : outputs) {
+        for (const auto& file : range_outputs) {
+            if (ok) {
+                output_files.push_back(file);
+            } else {
+                std::remove(file.c_str());
+            }
+        }
+    }
+    return ok;
 }
 
-std::vector<std::string> Compaction::SelectFilesForCompaction(
-    const std::vector<std::unique_ptr<SSTable>>& sstables,
-    size_t threshold) {
+bool Compaction::CompactRange(
+    const std::vector<std::unique_ptr<SSTable>>& tables,
+    const std::string* begin,
+    const std::string* end,
+    const std::function<std::string()>& next_output_file,
+    const SSTableOptions& options,
+    uint64_t file_order,
+    bool drop_tombstones,
+    std::vector<std::string>& output_files) {
     
-    std::vector<std::string> files;
+    // Priority queue for merging, smallest key (and for equal keys the
+    // newest write) on top
+    std::priority_queue<MergeEntry, std::vector<MergeEntry>, 
+                       std::greater<MergeEntry>> pq;
+    auto in_range = [end](const SSTable::Iterator& iter) {
+        return iter.Valid() && (!end || iter.key() < *end);
+    };
     
-    if (sstables.size() < threshold) {
-        return files;
+    std::vector<std::unique_ptr<SSTable::Iterator>> iters;
+    for (size_t i = 0; i < tables.size(); ++i) {
+        iters.push_back(tables[i]->NewIterator());
+        if (begin) {
+            iters[i]->Seek(*begin);
+        } else {
+            iters[i]->SeekToFirst();
+        }
+        if (iters[i]->Corrupted()) {
+            return false;
+        }
+        if (in_range(*iters[i])) {
+            pq.push({iters[i].get(), i});
+        }
+    }
+    
+    // Write merged entries, starting a new table at the target size
+    std::unique_ptr<SSTableBuilder> builder;
+    std::string output_file;
+    auto finish_output = [&]() {
+        bool ok = builder->Finish();
+        builder.reset();
+        if (ok) {
+            output_files.push_back(output_file);
+        }
+        return ok;
+    };
+    
+    // Only the first (newest) version of each key is kept
+    bool ok = true;
+    std::string last_key;
+    bool has_last_key = false;
+    while (ok && !pq.empty()) {
+        MergeEntry top = pq.top();
+        pq.pop();
+        SSTable::Iterator* iter = top.iter;
+        
+        if (!has_last_key || iter->key() != last_key) {
+            last_key.assign(iter->key());
+            has_last_key = true;
+            if (!(iter->is_deleted() && drop_tombstones)) {
+                if (!builder) {
+                    output_file = next_output_file();
+                    builder = std::make_unique<SSTableBuilder>(output_file,
+                                                               options);
+                    builder->SetFileOrder(file_order);
+                }
+                builder->Add(iter->key(), iter->value(), iter->is_deleted(),
+                             iter->timestamp(), iter->sequence());
+                if (builder->EstimatedFileSize() >= options.target_file_size) {
+                    ok = finish_output();
+                }
+            }
+        }
+        
+        iter->Next();
+        if (in_range(*iter)) {
+            pq.push(top);
+        } else if (iter->Corrupted()) {
+            ok = false;
+        }
+    }
+    if (ok && builder) {
+        ok = finish_output();
+    }
+    // An unfinished builder removes its partial file; the caller removes
+    // finished ones if any range failed
+    builder.reset();
+    return ok;
+}
+
+uint64_t Compaction::Strategy::MaxBytesForLevel(int level) const {
+    uint64_t bytes = base_level_bytes;
+    for (int i = 1; i < level; ++i) {
+        bytes *= multiplier;
+    }
+    return bytes;
+}
+
+bool Compaction::PickCompaction(const Version& version, const Strategy& strategy,
+                                const std::set<const SSTable*>& compacting,
+                                Pick& pick) {
+    if (strategy.time_window_ms > 0) {
+        return PickTimeWindowCompaction(version, strategy, compacting, pick);
     }
+    auto busy = [&compacting](const SSTableList& tables) {
+        return std::any_of(tables.begin(), tables.end(), [&](const auto& table) {
+            return compacting.count(table.get()) > 0;
+        });
+    };
     
-    // Select oldest files for compaction
-    size_t count = std::min(threshold, sstables.size());
-    for (size_t i = 0; i < count; ++i) {
-        // files.push_back(sstables[i]->GetFilename());
+    // Worst level first; the last level has nowhere to go
+    std::vector<std::pair<double, int>> scores;
+    for (int level = 0; level + 1 < kNumLevels; ++level) {
+        double score;
+        if (level == 0) {
+            score = strategy.level0_file_trigger == 0 ? 0
+                : static_cast<double>(version.Level(0).size()) /
+                  strategy.level0_file_trigger;
+        } else {
+            score = static_cast<double>(version.LevelBytes(level)) /
+                    std::max<uint64_t>(strategy.MaxBytesForLevel(level), 1);
+        }
+        if (score >= 1) {
+            scores.emplace_back(score, level);
+        }
     }
+    std::sort(scores.rbegin(), scores.rend());
     
-    return files;
+    // A level whose candidates all touch tables already being compacted is
+    // passed over for the next worst
+    for (const auto& [score, level] : scores) {
+        Pick candidate;
+        candidate.level = level;
+        candidate.output_level = level + 1;
+        auto fill = [&](const SSTableList& inputs) {
+            candidate.inputs = inputs;
+            candidate.overlaps.clear();
+            candidate.smallest.clear();
+            candidate.largest.clear();
+            bool empty = true;
+            ExtendKeyRange(inputs, candidate.smallest, candidate.largest, empty);
+            if (!empty) {
+                candidate.overlaps = version.OverlappingTables(
+                    level + 1, candidate.smallest, candidate.largest);
+                ExtendKeyRange(candidate.overlaps, candidate.smallest,
+                               candidate.largest, empty);
+            }
+            return !busy(candidate.inputs) && !busy(candidate.overlaps);
+        };
+        
+        if (level == 0) {
+            // Level 0 tables may overlap each other, so they go down together;
+            // leaving an older one behind would put it above newer data
+            if (!fill(version.Level(0))) {
+                continue;
+            }
+            pick = std::move(candidate);
+            return true;
+        }
+        
+        // The table that drags the fewest next-level bytes along per byte
+        // it moves down
+        double best_ratio = 0;
+        SSTableList best;
+        for (const auto& table : version.Level(level)) {
+            if (!fill({table})) {
+                continue;
+            }
+            uint64_t overlap_bytes = 0;
+            for (const auto& next : candidate.overlaps) {
+                overlap_bytes += next->GetSize();
+            }
+            double ratio = static_cast<double>(overlap_bytes) /
+                           std::max<uint64_t>(table->GetSize(), 1);
+            if (best.empty() || ratio < best_ratio) {
+                best_ratio = ratio;
+                best = {table};
+            }
+        }
+        if (!best.empty()) {
+            fill(best);
+            pick = std::move(candidate);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Compaction::PickTimeWindowCompaction(const Version& version,
+                                          const Strategy& strategy,
+                                          const std::set<const SSTable*>& compacting,
+                                          Pick& pick) {
+    const SSTableList& level0 = version.Level(0);
+    auto runs = WindowRuns(level0, strategy.time_window_ms);
+    // Newest first: the open window is where flushes pile up. A closed
+    // window is merged once more and then left alone.
+    for (auto it = runs.rbegin(); it != runs.rend(); ++it) {
+        size_t count = it->second - it->first;
+        bool newest = it == runs.rbegin();
+        if (count < 2 || (newest && count < strategy.level0_file_trigger)) {
+            continue;
+        }
+        if (std::any_of(level0.begin() + it->first, level0.begin() + it->second,
+                        [&](const auto& table) { return compacting.count(table.get()) > 0; })) {
+            continue;
+        }
+        pick = Pick();
+        pick.level = 0;
+        pick.output_level = 0;
+        pick.split_outputs = false;
+        pick.inputs.assign(level0.begin() + it->first, level0.begin() + it->second);
+        bool empty = true;
+        ExtendKeyRange(pick.inputs, pick.smallest, pick.largest, empty);
+        return true;
+    }
+    return false;
+}
+
+uint64_t Compaction::EstimatePendingBytes(const Version& version,
+                                          const Strategy& strategy) {
+    uint64_t pending = 0;
+    if (strategy.time_window_ms > 0) {
+        const SSTableList& level0 = version.Level(0);
+        auto runs = WindowRuns(level0, strategy.time_window_ms);
+        for (size_t r = 0; r < runs.size(); ++r) {
+            size_t count = runs[r].second - runs[r].first;
+            if (count >= 2 && (r + 1 < runs.size() ||
+                               count >= strategy.level0_file_trigger)) {
+                for (size_t i = runs[r].first; i < runs[r].second; ++i) {
+                    pending += level0[i]->GetSize();
+                }
+            }
+        }
+        return pending;
+    }
+
+    if (strategy.level0_file_trigger > 0 &&
+        version.Level(0).size() >= strategy.level0_file_trigger) {
+        pending += version.LevelBytes(0);
+    }
+    for (int level = 1; level + 1 < kNumLevels; ++level) {
+        uint64_t bytes = version.LevelBytes(level);
+        uint64_t target = strategy.MaxBytesForLevel(level);
+        if (bytes > target) {
+            pending += bytes - target;
+        }
+    }
+    return pending;
+}
+
+size_t Compaction::Level0Backlog(const Version& version, const Strategy& strategy) {
+    if (strategy.time_window_ms == 0) {
+        return version.Level(0).size();
+    }
+    size_t longest = 0;
+    for (const auto& [begin, end] : WindowRuns(version.Level(0), strategy.time_window_ms)) {
+        longest = std::max(longest, end - begin);
+    }
+    return longest;
+}
+
+std::vector<std::pair<int, std::shared_ptr<SSTable>>> Compaction::ExpiredTables(
+    const Version& version, uint64_t cutoff) {
+    std::vector<std::pair<int, std::shared_ptr<SSTable>>> expired;
+    for (int level = 0; level < kNumLevels; ++level) {
+        for (const auto& table : version.Level(level)) {
+            const TableProperties& props = table->GetProperties();
+            if (props.num_entries > 0 && props.max_timestamp < cutoff) {
+                expired.emplace_back(level, table);
+            }
+        }
+    }
+    return expired;
 }
 
 } // namespace kvstore
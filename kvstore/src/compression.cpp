@@ -0,0 +1,389 @@
+#include "compression.h"
+#include "format.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace kvstore {
+
+const char* CompressionTypeName(CompressionType type) {
+    switch (type) {
+        case CompressionType::kNone: return "none";
+        case CompressionType::kLZ4: return "lz4";
+    }
+    return "unknown";
+}
+
+namespace lz4 {
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;    // the block always ends in literals
+constexpr size_t kMatchFindLimit = 12; // no match may start in the tail
+constexpr size_t kMaxDistance = 65535;
+constexpr int kMinHashLog = 8;
+constexpr int kMaxHashLog = 16;
+
+uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void PutLength(std::string& output, size_t length) {
+    while (length >= 255) {
+        output.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    output.push_back(static_cast<char>(length));
+}
+
+void EmitSequence(std::string& output, const uint8_t* literals,
+                  size_t literal_len, size_t offset, size_t match_len) {
+    size_t match_code = match_len - kMinMatch;
+    uint8_t token = static_cast<uint8_t>(
+        (std::min<size_t>(literal_len, 15) << 4) |
+        std::min<size_t>(match_code, 15));
+    output.push_back(static_cast<char>(token));
+    if (literal_len >= 15) {
+        PutLength(output, literal_len - 15);
+    }
+    output.append(reinterpret_cast<const char*>(literals), literal_len);
+    output.push_back(static_cast<char>(offset & 0xff));
+    output.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15) {
+        PutLength(output, match_code - 15);
+    }
+}
+
+void EmitLastLiterals(std::string& output, const uint8_t* literals,
+                      size_t literal_len) {
+    uint8_t token = static_cast<uint8_t>(std::min<size_t>(literal_len, 15) << 4);
+    output.push_back(static_cast<char>(token));
+    if (literal_len >= 15) {
+        PutLength(output, literal_len - 15);
+    }
+    output.append(reinterpret_cast<const char*>(literals), literal_len);
+}
+
+bool GetLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= end) return false;
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+} // namespace
+
+void MatchTable::Init(size_t base_pos, size_t num_positions, bool chain_enabled) {
+    // Size the table to the input so small blocks don't pay for 64K buckets
+    hash_log = kMinHashLog;
+    while (hash_log < kMaxHashLog && (size_t(1) << hash_log) < num_positions) {
+        ++hash_log;
+    }
+    head.assign(size_t(1) << hash_log, -1);
+    base = base_pos;
+    use_chain = chain_enabled;
+    if (use_chain) {
+        chain.assign(num_positions, 0);
+    }
+}
+
+void MatchTable::Insert(const uint8_t* buf, size_t pos) {
+    uint32_t h = (Read32(buf + pos) * 2654435761u) >> (32 - hash_log);
+    if (use_chain) {
+        int32_t prev = head[h];
+        size_t delta = prev >= 0 ? pos - prev : 0;
+        chain[pos - base] = static_cast<uint16_t>(delta <= kMaxDistance ? delta : 0);
+    }
+    head[h] = static_cast<int32_t>(pos);
+}
+
+void MatchTable::Search(const uint8_t* buf, size_t ip, size_t match_limit,
+                        int attempts, size_t& best_len, size_t& best_pos) const {
+    const uint32_t sequence = Read32(buf + ip);
+    int32_t candidate = head[(sequence * 2654435761u) >> (32 - hash_log)];
+
+    for (; candidate >= 0 && attempts > 0; --attempts) {
+        const size_t cand = static_cast<size_t>(candidate);
+        if (ip - cand > kMaxDistance) break;
+        if (Read32(buf + cand) == sequence) {
+            size_t len = kMinMatch;
+            while (ip + len < match_limit && buf[cand + len] == buf[ip + len]) {
+                ++len;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_pos = cand;
+            }
+        }
+        if (!use_chain) break;
+        uint16_t delta = chain[cand - base];
+        if (delta == 0) break;
+        candidate = static_cast<int32_t>(cand - delta);
+    }
+}
+
+Dictionary::Dictionary(std::string data, int level) : data_(std::move(data)) {
+    if (data_.size() > kMaxDictionarySize) {
+        data_.erase(0, data_.size() - kMaxDictionarySize);
+    }
+    level = std::clamp(level, kMinLevel, kMaxLevel);
+    table_.Init(0, data_.size(), level > 1);
+    const auto* buf = reinterpret_cast<const uint8_t*>(data_.data());
+    for (size_t pos = 0; pos + kMinMatch <= data_.size(); ++pos) {
+        table_.Insert(buf, pos);
+    }
+}
+
+void Compress(std::string_view input, int level, std::string& output,
+              const Dictionary* dictionary) {
+    level = std::clamp(level, kMinLevel, kMaxLevel);
+    const size_t n = input.size();
+
+    if (n < kMatchFindLimit + 1) {
+        EmitLastLiterals(output, reinterpret_cast<const uint8_t*>(input.data()), n);
+        return;
+    }
+
+    // With a dictionary, compress over dictionary + input laid out
+    // contiguously so matches can run from the dictionary into the input
+    std::string joined;
+    size_t start = 0;
+    if (dictionary && !dictionary->data().empty()) {
+        joined.reserve(dictionary->data().size() + n);
+        joined.append(dictionary->data());
+        joined.append(input);
+        start = dictionary->data().size();
+    }
+    const auto* buf = reinterpret_cast<const uint8_t*>(
+        joined.empty() ? input.data() : joined.data());
+    const size_t end = start + n;
+
+    const bool use_chain = level > 1;
+    const int max_attempts = use_chain ? (1 << level) : 1;
+    MatchTable table;
+    table.Init(start, n, use_chain);
+
+    const size_t match_limit = end - kLastLiterals;
+    size_t anchor = start;
+    size_t ip = start;
+
+    while (ip + kMatchFindLimit <= end) {
+        size_t best_len = 0;
+        size_t best_pos = 0;
+        table.Search(buf, ip, match_limit, max_attempts, best_len, best_pos);
+        if (start > 0) {
+            dictionary->table().Search(buf, ip, match_limit, max_attempts,
+                                       best_len, best_pos);
+        }
+
+        table.Insert(buf, ip);
+
+        if (best_len == 0) {
+            // Skip faster through incompressible data at the fast level
+            ip += use_chain ? 1 : 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        EmitSequence(output, buf + anchor, ip - anchor, ip - best_pos, best_len);
+
+        size_t match_end = ip + best_len;
+        if (use_chain) {
+            for (size_t pos = ip + 1; pos < match_end; ++pos) {
+                table.Insert(buf, pos);
+            }
+        } else if (match_end - 2 > ip) {
+            table.Insert(buf, match_end - 2);
+        }
+        ip = match_end;
+        anchor = ip;
+    }
+
+    EmitLastLiterals(output, buf + anchor, end - anchor);
+}
+
+bool Decompress(std::string_view input, size_t raw_size, std::string& output,
+                std::string_view dictionary) {
+    output.resize(raw_size);
+    auto* op = reinterpret_cast<uint8_t*>(&output[0]);
+    const auto* ip = reinterpret_cast<const uint8_t*>(input.data());
+    const auto* end = ip + input.size();
+    size_t written = 0;
+
+    while (ip < end) {
+        const uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !GetLength(ip, end, literal_len)) {
+            return false;
+        }
+        if (literal_len > static_cast<size_t>(end - ip) ||
+            literal_len > raw_size - written) {
+            return false;
+        }
+        std::memcpy(op + written, ip, literal_len);
+        ip += literal_len;
+        written += literal_len;
+
+        if (ip == end) {
+            break; // last sequence carries literals only
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > written + dictionary.size()) {
+            return false;
+        }
+
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !GetLength(ip, end, match_len)) {
+            return false;
+        }
+        match_len += kMinMatch;
+        if (match_len > raw_size - written) {
+            return false;
+        }
+
+        if (offset > written) {
+            // The match starts in the dictionary and may continue into the
+            // start of the output
+            size_t back = offset - written;
+            size_t from_dict = std::min(back, match_len);
+            std::memcpy(op + written, dictionary.data() + dictionary.size() - back,
+                        from_dict);
+            for (size_t i = 0; i < match_len - from_dict; ++i) {
+                op[written + from_dict + i] = op[i];
+            }
+            written += match_len;
+            continue;
+        }
+
+        // Matches may overlap their own output (offset < length)
+        const uint8_t* match = op + written - offset;
+        if (offset >= match_len) {
+            std::memcpy(op + written, match, match_len);
+        } else {
+            for (size_t i = 0; i < match_len; ++i) {
+                op[written + i] = match[i];
+            }
+        }
+        written += match_len;
+    }
+
+    return written == raw_size;
+}
+
+} // namespace lz4
+
+std::string TrainDictionary(const std::vector<std::string_view>& samples,
+                            size_t max_size) {
+    constexpr size_t kDmer = 8;
+    constexpr size_t kSegment = 64;
+    max_size = std::min(max_size, lz4::kMaxDictionarySize);
+
+    std::string data;
+    for (const auto& sample : samples) {
+        data.append(sample.data(), sample.size());
+    }
+    if (max_size < kSegment || data.size() < 2 * kSegment) {
+        return std::string();
+    }
+
+    // How often each 8-byte substring occurs across the samples
+    auto dmer_at = [&data](size_t pos) {
+        uint64_t v;
+        std::memcpy(&v, data.data() + pos, sizeof(v));
+        return v;
+    };
+    std::unordered_map<uint64_t, uint32_t> freq;
+    freq.reserve(data.size() / 4);
+    for (size_t pos = 0; pos + kDmer <= data.size(); ++pos) {
+        ++freq[dmer_at(pos)];
+    }
+
+    // Split the samples into one epoch per output segment and take the best
+    // scoring segment of each epoch. A segment scores the summed frequency of
+    // its substrings; substrings already covered by the dictionary score 0.
+    const size_t num_segments = max_size / kSegment;
+    const size_t epoch_size = std::max(kSegment, data.size() / num_segments);
+    const size_t dmers_per_segment = kSegment - kDmer + 1;
+    std::string dictionary;
+
+    for (size_t epoch = 0; epoch + kSegment <= data.size() &&
+                           dictionary.size() + kSegment <= max_size;
+         epoch += epoch_size) {
+        size_t epoch_end = std::min(epoch + epoch_size, data.size());
+        if (epoch_end - epoch < kSegment) break;
+
+        uint64_t score = 0;
+        for (size_t i = 0; i < dmers_per_segment; ++i) {
+            score += freq[dmer_at(epoch + i)];
+        }
+        uint64_t best_score = score;
+        size_t best_pos = epoch;
+        for (size_t pos = epoch + 1; pos + kSegment <= epoch_end; ++pos) {
+            score -= freq[dmer_at(pos - 1)];
+            score += freq[dmer_at(pos + dmers_per_segment - 1)];
+            if (score > best_score) {
+                best_score = score;
+                best_pos = pos;
+            }
+        }
+
+        // Singletons don't repeat anywhere, so they are not worth storing
+        if (best_score <= dmers_per_segment) continue;
+        dictionary.append(data, best_pos, kSegment);
+        for (size_t i = 0; i < dmers_per_segment; ++i) {
+            freq[dmer_at(best_pos + i)] = 0;
+        }
+    }
+
+    return dictionary;
+}
+
+void CompressBlock(CompressionType type, int level, std::string_view raw,
+                   std::string& output, const lz4::Dictionary* dictionary) {
+    output.clear();
+    switch (type) {
+        case CompressionType::kLZ4:
+            PutVarint32(output, static_cast<uint32_t>(raw.size()));
+            lz4::Compress(raw, level, output, dictionary);
+            break;
+        case CompressionType::kNone:
+            output.assign(raw.data(), raw.size());
+            break;
+    }
+}
+
+bool DecompressBlock(CompressionType type, std::string_view compressed,
+                     std::string& output, std::string_view dictionary) {
+    switch (type) {
+        case CompressionType::kNone:
+            output.assign(compressed.data(), compressed.size());
+            return true;
+        case CompressionType::kLZ4: {
+            uint32_t raw_size;
+            if (!GetVarint32(compressed, raw_size)) {
+                return false;
+            }
+            // LZ4 cannot expand data by more than 255x, so anything larger
+            // is a corrupt length rather than a reason to allocate
+            if (raw_size / 255 > compressed.size()) {
+                return false;
+            }
+            return lz4::Decompress(compressed, raw_size, output, dictionary);
+        }
+    }
+    return false;
+}
+
+} // namespace kvstore
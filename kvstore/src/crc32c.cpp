@@ -0,0 +1,103 @@
+#include "crc32c.h"
+#include "format.h"
+#include <array>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KVSTORE_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+namespace kvstore {
+namespace crc32c {
+
+namespace {
+
+constexpr uint32_t kPolynomial = 0x82f63b78u;   // reflected 0x1edc6f41
+
+// Slicing-by-8 tables: tables[k][b] is the CRC of byte b followed by k zeros
+constexpr std::array<std::array<uint32_t, 256>, 8> MakeTables() {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+        }
+        tables[0][b] = crc;
+    }
+    for (size_t k = 1; k < 8; ++k) {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t prev = tables[k - 1][b];
+            tables[k][b] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+    return tables;
+}
+
+constexpr auto kTables = MakeTables();
+
+uint32_t ExtendPortable(uint32_t crc, const char* data, size_t n) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint32_t l = ~crc;
+    while (n >= 8) {
+        // Little-endian loads, so the tables line up on any host
+        uint32_t lo = DecodeFixed32(reinterpret_cast<const char*>(p)) ^ l;
+        uint32_t hi = DecodeFixed32(reinterpret_cast<const char*>(p + 4));
+        l = kTables[7][lo & 0xff] ^ kTables[6][(lo >> 8) & 0xff] ^
+            kTables[5][(lo >> 16) & 0xff] ^ kTables[4][lo >> 24] ^
+            kTables[3][hi & 0xff] ^ kTables[2][(hi >> 8) & 0xff] ^
+            kTables[1][(hi >> 16) & 0xff] ^ kTables[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0) {
+        l = (l >> 8) ^ kTables[0][(l ^ *p++) & 0xff];
+    }
+    return ~l;
+}
+
+#ifdef KVSTORE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+uint32_t ExtendSSE42(uint32_t crc, const char* data, size_t n) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t l = ~crc;
+    while (n >= 8) {
+        l = _mm_crc32_u64(l, DecodeFixed64(reinterpret_cast<const char*>(p)));
+        p += 8;
+        n -= 8;
+    }
+    uint32_t l32 = static_cast<uint32_t>(l);
+    while (n-- > 0) {
+        l32 = _mm_crc32_u8(l32, *p++);
+    }
+    return ~l32;
+}
+#endif
+
+using ExtendFunction = uint32_t (*)(uint32_t, const char*, size_t);
+
+ExtendFunction ChooseExtend() {
+#ifdef KVSTORE_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ExtendSSE42;
+    }
+#endif
+    return ExtendPortable;
+}
+
+ExtendFunction GetExtend() {
+    static const ExtendFunction extend = ChooseExtend();
+    return extend;
+}
+
+} // namespace
+
+uint32_t Extend(uint32_t crc, const char* data, size_t n) {
+    return GetExtend()(crc, data, n);
+}
+
+bool IsHardwareAccelerated() {
+    return GetExtend() != ExtendPortable;
+}
+
+} // namespace crc32c
+} // namespace kvstore
@@ -0,0 +1,73 @@
+#include "filter.h"
+#include "bloom_filter.h"
+#include "xor_filter.h"
+#include "hash.h"
+
+namespace kvstore {
+
+const char* FilterTypeName(FilterType type) {
+    switch (type) {
+        case FilterType::kNone: return "none";
+        case FilterType::kBloom: return "bloom";
+        case FilterType::kXor: return "xor";
+    }
+    return "unknown";
+}
+
+bool KeyFilter::MayContain(std::string_view key) const {
+    return MayContainHash(Hash64(key));
+}
+
+// Block layout: filter payload, then one byte of FilterType
+std::string BuildFilterBlock(FilterType type, std::vector<uint64_t> hashes) {
+    std::string block;
+    if (type == FilterType::kXor) {
+        XorFilter filter;
+        if (XorFilter::Build(hashes, filter)) {
+            block = filter.Serialize();
+            block.push_back(static_cast<char>(FilterType::kXor));
+            return block;
+        }
+        // Could not find a layout; a Bloom filter always works
+        type = FilterType::kBloom;
+    }
+    if (type == FilterType::kBloom) {
+        BloomFilter filter(hashes.size());
+        for (uint64_t hash : hashes) {
+            filter.AddHash(hash);
+        }
+        auto data = filter.Serialize();
+        block.assign(data.begin(), data.end());
+        block.push_back(static_cast<char>(FilterType::kBloom));
+    }
+    return block;
+}
+
+std::unique_ptr<KeyFilter> ParseFilterBlock(std::string_view block) {
+    if (block.empty()) {
+        return nullptr;
+    }
+    auto type = static_cast<FilterType>(block.back());
+    block.remove_suffix(1);
+    switch (type) {
+        case FilterType::kBloom: {
+            auto filter = std::make_unique<BloomFilter>(1);
+            if (BloomFilter::Deserialize(block, *filter)) {
+                return filter;
+            }
+            break;
+        }
+        case FilterType::kXor: {
+            auto filter = std::make_unique<XorFilter>();
+            if (XorFilter::Deserialize(block, *filter)) {
+                return filter;
+            }
+            break;
+        }
+        case FilterType::kNone:
+            break;
+    }
+    return nullptr;
+}
+
+} // namespace kvstore
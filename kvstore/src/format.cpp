@@ -0,0 +1,135 @@
+#include "format.h"
+
+namespace kvstore {
+
+void PutFixed32(std::string& dst, uint32_t value) {
+    char buf[4];
+    for (int i = 0; i < 4; ++i) {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst.append(buf, sizeof(buf));
+}
+
+void PutFixed64(std::string& dst, uint64_t value) {
+    char buf[8];
+    for (int i = 0; i < 8; ++i) {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst.append(buf, sizeof(buf));
+}
+
+void EncodeFixed32(char* dst, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        dst[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+void EncodeFixed64(char* dst, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        dst[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+uint32_t DecodeFixed32(const char* ptr) {
+    const auto* p = reinterpret_cast<const uint8_t*>(ptr);
+    return static_cast<uint32_t>(p[0]) |
+           (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t DecodeFixed64(const char* ptr) {
+    uint64_t lo = DecodeFixed32(ptr);
+    uint64_t hi = DecodeFixed32(ptr + 4);
+    return (hi << 32) | lo;
+}
+
+void PutVarint32(std::string& dst, uint32_t value) {
+    PutVarint64(dst, value);
+}
+
+void PutVarint64(std::string& dst, uint64_t value) {
+    while (value >= 0x80) {
+        dst.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    dst.push_back(static_cast<char>(value));
+}
+
+void PutLengthPrefixed(std::string& dst, std::string_view value) {
+    PutVarint32(dst, static_cast<uint32_t>(value.size()));
+    dst.append(value.data(), value.size());
+}
+
+bool GetVarint64(std::string_view& input, uint64_t& value) {
+    uint64_t result = 0;
+    for (size_t i = 0, shift = 0; i < input.size() && shift <= 63; ++i, shift += 7) {
+        uint64_t byte = static_cast<uint8_t>(input[i]);
+        result |= (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            value = result;
+            input.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GetVarint32(std::string_view& input, uint32_t& value) {
+    std::string_view saved = input;
+    uint64_t v;
+    if (!GetVarint64(input, v) || v > UINT32_MAX) {
+        input = saved;
+        return false;
+    }
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+bool GetLengthPrefixed(std::string_view& input, std::string_view& value) {
+    uint32_t len;
+    if (!GetVarint32(input, len) || input.size() < len) {
+        return false;
+    }
+    value = input.substr(0, len);
+    input.remove_prefix(len);
+    return true;
+}
+
+void BlockHandle::EncodeTo(std::string& dst) const {
+    PutVarint64(dst, offset);
+    PutVarint64(dst, size);
+}
+
+bool BlockHandle::DecodeFrom(std::string_view& input) {
+    return GetVarint64(input, offset) && GetVarint64(input, size);
+}
+
+void Footer::EncodeTo(std::string& dst) const {
+    for (const BlockHandle* handle : {&metaindex_handle, &index_handle,
+                                      &filter_handle, &properties_handle}) {
+        PutFixed64(dst, handle->offset);
+        PutFixed64(dst, handle->size);
+    }
+    PutFixed32(dst, format_version);
+    PutFixed64(dst, kTableMagicNumber);
+}
+
+bool Footer::DecodeFrom(const char* ptr) {
+    if (DecodeFixed64(ptr + kEncodedLength - 8) != kTableMagicNumber) {
+        return false;
+    }
+    format_version = DecodeFixed32(ptr + kEncodedLength - 12);
+    if (format_version == 0 || format_version > kFormatVersion) {
+        return false;
+    }
+    for (BlockHandle* handle : {&metaindex_handle, &index_handle,
+                                &filter_handle, &properties_handle}) {
+        handle->offset = DecodeFixed64(ptr);
+        handle->size = DecodeFixed64(ptr + 8);
+        ptr += 16;
+    }
+    return true;
+}
+
+} // namespace kvstore
@@ -0,0 +1,41 @@
+#include "hash.h"
+#include "format.h"
+
+namespace kvstore {
+
+uint64_t Hash64(std::string_view data, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+
+    const char* ptr = data.data();
+    size_t len = data.size();
+    uint64_t h = seed ^ (len * m);
+
+    while (len >= 8) {
+        // Little-endian regardless of host, since filters are persisted
+        uint64_t k = DecodeFixed64(ptr);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        ptr += 8;
+        len -= 8;
+    }
+
+    if (len > 0) {
+        uint64_t tail = 0;
+        for (size_t i = 0; i < len; ++i) {
+            tail |= static_cast<uint64_t>(static_cast<uint8_t>(ptr[i])) << (8 * i);
+        }
+        h ^= tail;
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+} // namespace kvstore
@@ -1,27 +1,185 @@
 #include "kvstore.h"
 #include "compaction.h"
+#include "sstable_builder.h"
 #include <filesystem>
 #include <algorithm>
+#include <map>
+#include <chrono>
+#include <limits>
 #include <iostream>
 
 namespace fs = std::filesystem;
 
 namespace kvstore {
 
+namespace {
+
+uint64_t ElapsedMicros(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+struct MemTableInserter : WriteBatch::Handler {
+    MemTable* memtable = nullptr;
+    
+    void Put(std::string_view key, std::string_view value,
+             uint64_t sequence, uint64_t timestamp) override {
+        memtable->Put(key, value, sequence, timestamp);
+    }
+    void Delete(std::string_view key, uint64_t sequence,
+                uint64_t timestamp) override {
+        memtable->Delete(key, sequence, timestamp);
+    }
+};
+
+// Parses a batch without applying it
+struct BatchValidator : WriteBatch::Handler {
+    void Put(std::string_view, std::string_view, uint64_t, uint64_t) override {}
+    void Delete(std::string_view, uint64_t, uint64_t) override {}
+};
+
+// Inserts replayed batches into memtables on worker threads. Each batch
+// carries its own sequence numbers, so the order they land in does not
+// matter. Batches are handed over in chunks to keep the queue's locking
+// out of the way of small writes.
+class BatchReplayer {
+public:
+    explicit BatchReplayer(size_t num_threads) : pending_bytes_(0), busy_(0),
+                                                 stop_(false) {
+        for (size_t i = 0; num_threads > 1 && i < num_threads; ++i) {
+            threads_.emplace_back(&BatchReplayer::Run, this);
+        }
+    }
+    
+    ~BatchReplayer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+    
+    void Add(MemTable* memtable, WriteBatch batch) {
+        if (threads_.empty()) {
+            Apply(memtable, batch);
+            return;
+        }
+        pending_bytes_ += batch.ApproximateSize();
+        pending_.emplace_back(memtable, std::move(batch));
+        if (pending_bytes_ >= kChunkBytes) {
+            Submit();
+        }
+    }
+    
+    // Returns once every batch added so far is in its memtable
+    void Wait() {
+        if (threads_.empty()) {
+            return;
+        }
+        Submit();
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return queue_.empty() && busy_ == 0; });
+    }
+    
+private:
+    using Chunk = std::vector<std::pair<MemTable*, WriteBatch>>;
+    static constexpr size_t kChunkBytes = 256 << 10;
+    static constexpr size_t kMaxQueuedChunks = 16;
+    
+    std::vector<std::thread> threads_;
+    Chunk pending_;
+    size_t pending_bytes_;
+    
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;   // a chunk was taken or finished
+    std::deque<Chunk> queue_;
+    size_t busy_;
+    bool stop_;
+    
+    static void Apply(MemTable* memtable, const WriteBatch& batch) {
+        MemTableInserter inserter;
+        inserter.memtable = memtable;
+        batch.Iterate(inserter);
+    }
+    
+    void Submit() {
+        if (pending_.empty()) {
+            return;
+        }
+        {
+            // Reading runs at most a few chunks ahead of the inserts
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cv_.wait(lock, [this] { return queue_.size() < kMaxQueuedChunks; });
+            queue_.push_back(std::move(pending_));
+        }
+        work_cv_.notify_one();
+        pending_.clear();
+        pending_bytes_ = 0;
+    }
+    
+    void Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            Chunk chunk = std::move(queue_.front());
+            queue_.pop_front();
+            ++busy_;
+            lock.unlock();
+            done_cv_.notify_all();
+            for (const auto& [memtable, batch] : chunk) {
+                Apply(memtable, batch);
+            }
+            lock.lock();
+            --busy_;
+            done_cv_.notify_all();
+        }
+    }
+};
+
+struct CacheInvalidator : WriteBatch::Handler {
+    LRUCache* cache = nullptr;
+    
+    void Put(std::string_view key, std::string_view, uint64_t, uint64_t) override {
+        cache->Invalidate(std::string(key));
+    }
+    void Delete(std::string_view key, uint64_t, uint64_t) override {
+        cache->Invalidate(std::string(key));
+    }
+};
+
+} // namespace
+
 KVStore::KVStore(const Config& config)
     : config_(config),
-      should_flush_(false),
-      next_sstable_id_(0) {
+      log_number_(0),
+      next_sstable_id_(0),
+      wal_unsynced_(false),
+      last_wal_sync_(std::chrono::steady_clock::now()),
+      num_writes_(0),
+      num_write_groups_(0),
+      num_wal_syncs_(0),
+      last_sequence_(0),
+      flush_scheduled_(false),
+      scheduled_compactions_(0),
+      flush_error_(false),
+      shutting_down_(false),
+      write_controller_(static_cast<uint64_t>(config.delayed_write_rate_mb) << 20),
+      pending_compaction_bytes_(0) {
     
     // Create data directory
     fs::create_directories(config_.data_dir);
     
-    // Initialize WAL
-    std::string wal_path = config_.data_dir + "/wal.log";
-    wal_ = std::make_unique<WAL>(wal_path);
-    
     // Initialize memtable
-    memtable_ = std::make_unique<MemTable>();
+    memtable_ = std::make_shared<MemTable>(config_.write_buffer_manager);
+    immutable_memtables_ = std::make_shared<MemTableList>();
+    version_ = std::make_shared<const Version>();
     
     // Initialize cache
     size_t cache_size = config_.cache_size_mb * 1024 * 1024;
@@ -30,141 +188,301 @@ KVStore::KVStore(const Config& config)
     // Load existing SSTables
     LoadSSTables();
     
-    // Recover from WAL if needed
+    // Recovered WALs are queued as immutable memtables, so the new
+    // memtable gets the next log number
     RecoverFromWAL();
+    wal_ = NewWAL(++log_number_);
+    UpdateWriteStallCondition();
+    
+    // Recovered memtables, and tables left over from before the store was
+    // opened, may already stall writes
+    scheduler_ = std::make_unique<Scheduler>(
+        1, std::max<size_t>(config_.max_background_compactions, 1));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        MaybeScheduleFlush();
+        MaybeScheduleCompaction();
+    }
+    sync_thread_ = std::thread(&KVStore::BackgroundSync, this);
 }
 
 KVStore::~KVStore() {
     Flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutting_down_ = true;
+    }
+    flush_done_cv_.notify_all();
+    sync_cv_.notify_all();
+    sync_thread_.join();
+    // Waits for the running jobs; queued compactions are dropped
+    scheduler_.reset();
+    if (config_.rate_limiter) {
+        config_.rate_limiter->RemoveCaller(this);
+    }
 }
 
 bool KVStore::Put(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Write to WAL first
-    if (!wal_->Append(WALRecordType::PUT, key, value)) {
-        return false;
+    return Put(key, value, config_.durability);
+}
+
+bool KVStore::Put(const std::string& key, const std::string& value,
+                  Durability durability) {
+    WriteBatch batch;
+    batch.Put(key, value);
+    return WriteImpl(&batch, durability);
+}
+
+bool KVStore::Get(const std::string& key, std::string& value,
+                  const Snapshot* snapshot) {
+    // The cache only holds current values
+    if (!snapshot && cache_->Get(key, value)) {
+        return true;
     }
+    uint64_t generation = cache_->Generation(key);
     
-    // Write to memtable
-    memtable_->Put(key, value);
-    
-    // Invalidate cache
-    cache_->Invalidate(key);
+    Snapshot current;
+    const Snapshot& view = snapshot ? *snapshot : (current = CurrentView());
     
-    // Check if we need to flush
-    size_t memtable_size = memtable_->SizeBytes();
-    size_t threshold = config_.memtable_size_mb * 1024 * 1024;
+    // A tombstone in a newer source hides every older version
+    bool deleted = false;
+    bool found = view.memtable_->Get(key, value, &deleted, view.sequence_);
+    for (auto it = view.immutables_->rbegin();
+         !found && !deleted && it != view.immutables_->rend(); ++it) {
+        found = (*it)->Get(key, value, &deleted, view.sequence_);
+    }
     
-    if (memtable_size >= threshold) {
-        should_flush_ = true;
-        FlushMemTable();
+    // Check SSTables (newest to oldest). A pinned version predates the
+    // snapshot, so everything in it is visible. Level 0 tables may overlap;
+    // below that at most one table per level can hold the key.
+    const SSTableList& level0 = view.version_->Level(0);
+    for (auto it = level0.rbegin();
+         !found && !deleted && it != level0.rend(); ++it) {
+        found = (*it)->Get(key, value, &deleted);
+    }
+    for (int level = 1; !found && !deleted && level < kNumLevels; ++level) {
+        const SSTable* sstable = view.version_->FindTable(level, key);
+        if (sstable) {
+            found = sstable->Get(key, value, &deleted);
+        }
     }
     
-    return true;
+    if (found && !snapshot) {
+        cache_->PutIfGeneration(key, value, generation);
+    }
+    return found;
 }
 
-bool KVStore::Get(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Check cache first
-    if (cache_->Get(key, value)) {
-        return true;
+bool KVStore::Delete(const std::string& key) {
+    return Delete(key, config_.durability);
+}
+
+bool KVStore::Delete(const std::string& key, Durability durability) {
+    WriteBatch batch;
+    batch.Delete(key);
+    return WriteImpl(&batch, durability);
+}
+
+bool KVStore::PutBatch(const std::vector<std::pair<std::string, std::string>>& entries) {
+    return PutBatch(entries, config_.durability);
+}
+
+bool KVStore::PutBatch(const std::vector<std::pair<std::string, std::string>>& entries,
+                       Durability durability) {
+    WriteBatch batch;
+    for (const auto& entry : entries) {
+        batch.Put(entry.first, entry.second);
     }
+    return WriteImpl(&batch, durability);
+}
+
+bool KVStore::Write(const WriteBatch& batch) {
+    return WriteImpl(&batch, config_.durability);
+}
+
+bool KVStore::Write(const WriteBatch& batch, Durability durability) {
+    return WriteImpl(&batch, durability);
+}
+
+bool KVStore::WriteImpl(const WriteBatch* batch, Durability durability) {
+    Writer w;
+    w.batch = batch;
+    w.durability = durability;
     
-    // Check memtable
-    if (memtable_->Get(key, value)) {
-        cache_->Put(key, value);
-        return true;
+    std::unique_lock<std::mutex> lock(mutex_);
+    writers_.push_back(&w);
+    w.cv.wait(lock, [&] { return w.done || &w == writers_.front(); });
+    if (w.done) {
+        return w.ok;
     }
     
-    // Check immutable memtable
-    if (immutable_memtable_ && immutable_memtable_->Get(key, value)) {
-        cache_->Put(key, value);
+    // This writer leads. Only the leader touches memtable_ and wal_ while
+    // the lock is released, so a switch has to wait its turn in the queue.
+    if (!batch) {
+        if (!memtable_->IsEmpty()) {
+            SwitchMemTable(lock);
+        }
+        writers_.pop_front();
+        if (!writers_.empty()) {
+            writers_.front()->cv.notify_one();
+        }
         return true;
     }
     
-    // Check SSTables (newest to oldest)
-    for (auto it = sstables_.rbegin(); it != sstables_.rend(); ++it) {
-        if ((*it)->MayContain(key) && (*it)->Get(key, value)) {
-            cache_->Put(key, value);
-            return true;
-        }
+    std::vector<Writer*> group;
+    size_t group_bytes = 0;
+    BuildWriteGroup(group, group_bytes);
+    DelayWrite(lock, group_bytes);
+    
+    // The group is logged as one batch, so recovery replays all of it or
+    // none. Sequences are handed out in queue order, but only published
+    // once the whole group is in the memtable.
+    WriteBatch group_batch;
+    bool sync = false;
+    bool periodic = false;
+    for (Writer* writer : group) {
+        group_batch.Append(*writer->batch);
+        sync |= writer->durability == Durability::kSync;
+        periodic |= writer->durability == Durability::kPeriodic;
+    }
+    auto now = std::chrono::steady_clock::now();
+    group_batch.SetSequence(last_sequence_ + 1);
+    group_batch.SetTimestamp(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    uint64_t sequence = last_sequence_ + group_batch.Count();
+    bool log = group.front()->durability != Durability::kNone &&
+               !group_batch.IsEmpty();
+    if (periodic && now - last_wal_sync_ >=
+                        std::chrono::milliseconds(config_.wal_sync_interval_ms)) {
+        sync = true;
     }
     
-    return false;
-}
-
-bool KVStore::Delete(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<WAL> wal = wal_;
+    std::shared_ptr<MemTable> memtable = memtable_;
+    lock.unlock();
     
-    // Write tombstone to WAL
-    if (!wal_->Append(WALRecordType::DELETE, key)) {
-        return false;
+    bool ok = !log || wal->AddRecord(group_batch.Data());
+    // Once appended, the group may be replayed after a restart even if the
+    // sync fails, so its sequence numbers are used up either way
+    bool logged = log && ok;
+    if (ok && log && sync) {
+        ok = wal->Sync();
+    }
+    if (ok) {
+        MemTableInserter inserter;
+        inserter.memtable = memtable.get();
+        ok = group_batch.Iterate(inserter);
     }
     
-    // Write tombstone to memtable
-    memtable_->Delete(key);
+    lock.lock();
+    ++num_write_groups_;
+    if (ok) {
+        if (log && sync) {
+            last_wal_sync_ = now;
+            wal_unsynced_ = false;
+            ++num_wal_syncs_;
+        } else if (log && periodic) {
+            wal_unsynced_ = true;
+        }
+        last_sequence_ = sequence;
+        CacheInvalidator invalidator;
+        invalidator.cache = cache_.get();
+        group_batch.Iterate(invalidator);
+        num_writes_ += group.size();
+    } else if (logged) {
+        last_sequence_ = sequence;
+    }
     
-    // Invalidate cache
-    cache_->Invalidate(key);
+    if (ok && MemTableFull()) {
+        SwitchMemTable(lock);
+    }
     
-    return true;
+    // Wake the group, then hand leadership to the next writer
+    for (Writer* writer : group) {
+        writers_.pop_front();
+        writer->ok = ok;
+        writer->done = true;
+        if (writer != &w) {
+            writer->cv.notify_one();
+        }
+    }
+    if (!writers_.empty()) {
+        writers_.front()->cv.notify_one();
+    }
+    return ok;
 }
 
-bool KVStore::PutBatch(const std::vector<std::pair<std::string, std::string>>& entries) {
-    std::lock_guard<std::mutex> lock(mutex_);
+void KVStore::BuildWriteGroup(std::vector<Writer*>& group, size_t& group_bytes) {
+    // Groups stay small when the leader's own write is small, so a small
+    // write is not held up behind a large batch
+    Writer* first = writers_.front();
+    group_bytes = first->batch->ApproximateSize();
+    size_t max_bytes = group_bytes <= (128 << 10) ? group_bytes + (128 << 10)
+                                                  : 1 << 20;
     
-    for (const auto& [key, value] : entries) {
-        if (!wal_->Append(WALRecordType::PUT, key, value)) {
-            return false;
+    group.push_back(first);
+    for (auto it = writers_.begin() + 1; it != writers_.end(); ++it) {
+        Writer* writer = *it;
+        // A switch request ends the group, and so does a change in whether
+        // the WAL is written at all
+        if (!writer->batch ||
+            (writer->durability == Durability::kNone) !=
+                (first->durability == Durability::kNone)) {
+            break;
         }
-        memtable_->Put(key, value);
-        cache_->Invalidate(key);
-    }
-    
-    // Check if flush needed
-    size_t memtable_size = memtable_->SizeBytes();
-    size_t threshold = config_.memtable_size_mb * 1024 * 1024;
-    
-    if (memtable_size >= threshold) {
-        FlushMemTable();
+        size_t bytes = writer->batch->ApproximateSize();
+        if (group_bytes + bytes > max_bytes) {
+            break;
+        }
+        group_bytes += bytes;
+        group.push_back(writer);
     }
-    
-    return true;
 }
 
 std::vector<std::pair<std::string, std::string>> KVStore::Scan(
     const std::string& start_key,
     const std::string& end_key,
-    size_t limit) {
+    size_t limit,
+    const Snapshot* snapshot) {
     
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::pair<std::string, std::string>> results;
+    // The memtables can be read while writers insert, so the lock is only
+    // held to pin them and the table list
+    Snapshot current;
+    const Snapshot& view = snapshot ? *snapshot : (current = CurrentView());
     
     // Merge from all sources
     std::map<std::string, std::string> merged;
+    auto apply = [&merged](const SSTableEntry& entry) {
+        if (!entry.is_deleted) {
+            merged[entry.key] = entry.value;
+        } else {
+            merged.erase(entry.key);
+        }
+    };
     
-    // Get from SSTables
-    for (auto& sstable : sstables_) {
-        auto entries = sstable->Scan(start_key, end_key, limit);
-        for (const auto& entry : entries) {
-            if (!entry.is_deleted) {
-                merged[entry.key] = entry.value;
-            }
+    // Get from SSTables (oldest first, so newer versions overwrite)
+    for (const auto& sstable : view.version_->Tables()) {
+        if (!TableMayOverlap(*sstable, start_key, end_key)) {
+            continue;
+        }
+        for (const auto& entry : sstable->Scan(start_key, end_key, limit)) {
+            apply(entry);
         }
     }
     
-    // Override with memtable data (more recent)
-    for (auto it = memtable_->Begin(); it != memtable_->End(); ++it) {
-        if (it->first >= start_key && it->first <= end_key) {
-            if (!it->second.is_deleted) {
-                merged[it->first] = it->second.value;
-            } else {
-                merged.erase(it->first);
-            }
+    // Override with memtable data (more recent), oldest memtable first
+    auto scan_memtable = [&](const MemTable& table) {
+        for (auto it = table.Seek(start_key, view.sequence_);
+             it != table.End() && it.key() <= end_key; ++it) {
+            apply({std::string(it.key()), std::string(it.value()),
+                   it.is_deleted(), 0, it.sequence()});
         }
+    };
+    for (const auto& immutable : *view.immutables_) {
+        scan_memtable(*immutable);
     }
+    scan_memtable(*view.memtable_);
     
     // Convert to vector
     for (const auto& [key, value] : merged) {
@@ -175,154 +493,972 @@ std::vector<std::pair<std::string, std::string>> KVStore::Scan(
     return results;
 }
 
+std::vector<std::pair<std::string, std::string>> KVStore::ScanTimeRange(
+    const std::string& start_key,
+    const std::string& end_key,
+    uint64_t min_timestamp,
+    uint64_t max_timestamp,
+    size_t limit,
+    const Snapshot* snapshot) {
+    
+    std::vector<std::pair<std::string, std::string>> results;
+    Snapshot current;
+    const Snapshot& view = snapshot ? *snapshot : (current = CurrentView());
+    
+    // Each key's newest version as of max_timestamp, kept only if it was
+    // written at or after min_timestamp
+    std::map<std::string, SSTableEntry> merged;
+    auto apply = [&merged, max_timestamp](const SSTableEntry& entry) {
+        if (entry.timestamp <= max_timestamp) {
+            merged[entry.key] = entry;
+        }
+    };
+    
+    // A table entirely outside the window can be skipped from its
+    // properties: newer tables only hold versions past the window, and a
+    // key whose newest version in range sits in an older table is excluded
+    // anyway. Tables are not truncated by `limit`, since entries outside the
+    // window do not count towards it.
+    for (const auto& sstable : view.version_->Tables()) {
+        const TableProperties& props = sstable->GetProperties();
+        if (!props.OverlapsTimeRange(min_timestamp, max_timestamp) ||
+            !TableMayOverlap(*sstable, start_key, end_key)) {
+            continue;
+        }
+        for (const auto& entry : sstable->Scan(start_key, end_key, SIZE_MAX)) {
+            apply(entry);
+        }
+    }
+    
+    auto scan_memtable = [&](const MemTable& table) {
+        for (auto it = table.Seek(start_key, view.sequence_);
+             it != table.End() && it.key() <= end_key; ++it) {
+            apply({std::string(it.key()), std::string(it.value()),
+                   it.is_deleted(), it.timestamp(), it.sequence()});
+        }
+    };
+    for (const auto& immutable : *view.immutables_) {
+        scan_memtable(*immutable);
+    }
+    scan_memtable(*view.memtable_);
+    
+    for (const auto& [key, entry] : merged) {
+        if (results.size() >= limit) break;
+        if (!entry.is_deleted && entry.timestamp >= min_timestamp) {
+            results.emplace_back(key, entry.value);
+        }
+    }
+    
+    return results;
+}
+
+const Snapshot* KVStore::GetSnapshot() {
+    auto snapshot = new Snapshot(CurrentView());
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshots_.insert(snapshot);
+    return snapshot;
+}
+
+void KVStore::ReleaseSnapshot(const Snapshot* snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshots_.erase(snapshot);
+    }
+    delete snapshot;
+}
+
+Snapshot KVStore::CurrentView() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Snapshot view;
+    view.sequence_ = last_sequence_;
+    view.memtable_ = memtable_;
+    view.immutables_ = immutable_memtables_;
+    view.version_ = version_;
+    return view;
+}
+
 KVStore::Stats KVStore::GetStats() const {
     std::lock_guard<std::mutex> lock(mutex_);
     
     Stats stats;
     stats.memtable_size = memtable_->SizeBytes();
-    stats.num_sstables = sstables_.size();
+    stats.memtable_allocated_bytes = memtable_->AllocatedBytes();
+    stats.num_immutable_memtables = immutable_memtables_->size();
+    stats.num_sstables = version_->NumTables();
+    for (int level = 0; level < kNumLevels; ++level) {
+        stats.num_sstables_per_level.push_back(version_->Level(level).size());
+    }
     stats.cache_hits = cache_->HitCount();
     stats.cache_misses = cache_->MissCount();
     
     // Count total keys and size
     stats.total_keys = memtable_->Size();
     stats.total_size_bytes = memtable_->SizeBytes();
+    for (const auto& immutable : *immutable_memtables_) {
+        stats.total_keys += immutable->Size();
+        stats.total_size_bytes += immutable->SizeBytes();
+    }
     
-    for (const auto& sstable : sstables_) {
-        stats.total_keys += sstable->GetNumEntries();
+    stats.raw_data_bytes = 0;
+    stats.stored_data_bytes = 0;
+    stats.num_tombstones = 0;
+    stats.filter_memory_bytes = 0;
+    stats.oldest_timestamp = 0;
+    stats.newest_timestamp = 0;
+    for (const auto& sstable : version_->Tables()) {
+        const TableProperties& props = sstable->GetProperties();
+        if (props.num_entries > 0) {
+            stats.oldest_timestamp = stats.oldest_timestamp == 0
+                ? props.min_timestamp
+                : std::min<uint64_t>(stats.oldest_timestamp, props.min_timestamp);
+            stats.newest_timestamp = std::max<uint64_t>(stats.newest_timestamp,
+                                                        props.max_timestamp);
+        }
+        stats.num_tombstones += props.num_deletions;
+        stats.filter_memory_bytes += sstable->GetFilterMemoryUsage();
+        stats.total_keys += props.num_entries - props.num_deletions;
         stats.total_size_bytes += sstable->GetSize();
+        stats.raw_data_bytes += sstable->GetRawDataSize();
+        stats.stored_data_bytes += sstable->GetDataSize();
+    }
+    stats.compression_ratio = stats.stored_data_bytes > 0
+        ? static_cast<double>(stats.raw_data_bytes) / stats.stored_data_bytes
+        : 1.0;
+    
+    stats.pending_compaction_bytes = pending_compaction_bytes_;
+    stats.num_running_compactions = scheduled_compactions_;
+    stats.write_stall_condition = write_controller_.Condition();
+    stats.write_delayed_micros = write_controller_.DelayedMicros();
+    stats.write_stopped_micros = write_controller_.StoppedMicros();
+    stats.rate_limited_bytes = 0;
+    stats.rate_limit_wait_micros = 0;
+    if (config_.rate_limiter) {
+        stats.rate_limited_bytes = config_.rate_limiter->BytesThrottled();
+        stats.rate_limit_wait_micros = config_.rate_limiter->MicrosWaited();
     }
+    stats.last_sequence = last_sequence_;
+    stats.num_snapshots = snapshots_.size();
+    stats.num_writes = num_writes_;
+    stats.num_write_groups = num_write_groups_;
+    stats.num_wal_syncs = num_wal_syncs_;
     
     return stats;
 }
 
 void KVStore::Compact() {
-    MaybeCompact();
+    // Background compactions hold tables this thread cannot pick; once
+    // nothing else is left, wait for them and look again
+    while (true) {
+        if (MaybeCompact()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (scheduled_compactions_ == 0) {
+            return;
+        }
+        flush_done_cv_.wait(lock, [this] { return scheduled_compactions_ == 0; });
+    }
 }
 
 void KVStore::Flush() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!memtable_->IsEmpty()) {
-        FlushMemTable();
-    }
+    // The switch queues behind pending writes, so it takes their data along
+    WriteImpl(nullptr, Durability::kNone);
+    std::unique_lock<std::mutex> lock(mutex_);
+    flush_done_cv_.wait(lock, [this] {
+        return immutable_memtables_->empty() || flush_error_;
+    });
 }
 
-void KVStore::FlushMemTable() {
-    if (memtable_->IsEmpty()) {
+void KVStore::SwitchMemTable(std::unique_lock<std::mutex>& lock) {
+    // Writers only stall here when the flush thread has fallen
+    // max_immutable_memtables behind
+    auto full = memtable_;
+    auto has_room = [&] {
+        return memtable_ != full ||
+               immutable_memtables_->size() < config_.max_immutable_memtables;
+    };
+    if (!has_room()) {
+        auto start = std::chrono::steady_clock::now();
+        flush_done_cv_.wait(lock, has_room);
+        write_controller_.RecordStop(ElapsedMicros(start));
+    }
+    // Another writer may have switched while this one waited
+    if (memtable_ != full || memtable_->IsEmpty()) {
         return;
     }
     
-    // Create new memtable
-    immutable_memtable_ = std::move(memtable_);
-    memtable_ = std::make_unique<MemTable>();
+    memtable_->MarkImmutable();
+    auto immutables = std::make_shared<MemTableList>(*immutable_memtables_);
+    immutables->push_back(std::move(memtable_));
+    immutable_memtables_ = std::move(immutables);
+    immutable_logs_.push_back(log_number_);
     
-    // Clear WAL
-    wal_->Clear();
+    // Periodic writes must not outlive their interval unsynced just because
+    // their WAL is no longer the one being synced
+    if (wal_unsynced_) {
+        if (wal_->Sync()) {
+            last_wal_sync_ = std::chrono::steady_clock::now();
+            ++num_wal_syncs_;
+        }
+        wal_unsynced_ = false;
+    }
+    wal_ = NewWAL(++log_number_);
+    memtable_ = std::make_shared<MemTable>(config_.write_buffer_manager);
+    UpdateWriteStallCondition();
+    MaybeScheduleFlush();
+}
+
+void KVStore::MaybePeriodicSync(std::unique_lock<std::mutex>& lock) {
+    auto now = std::chrono::steady_clock::now();
+    if (!wal_unsynced_ ||
+        now - last_wal_sync_ < std::chrono::milliseconds(config_.wal_sync_interval_ms)) {
+        return;
+    }
+    // Writes landing during the sync set the flag again
+    std::shared_ptr<WAL> wal = wal_;
+    wal_unsynced_ = false;
+    lock.unlock();
+    bool ok = wal->Sync();
+    lock.lock();
+    if (ok) {
+        last_wal_sync_ = now;
+        ++num_wal_syncs_;
+    } else {
+        wal_unsynced_ = true;
+    }
+}
+
+void KVStore::DelayWrite(std::unique_lock<std::mutex>& lock, size_t bytes) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t delay = write_controller_.GetDelay(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            now.time_since_epoch()).count(),
+        bytes);
+    if (delay > 0) {
+        // Readers and other writers go on while this one sleeps; their
+        // slots were reserved behind it
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        lock.lock();
+        write_controller_.RecordDelay(delay);
+    }
     
-    // Convert immutable memtable to SSTable
-    std::vector<SSTableEntry> entries;
-    for (auto it = immutable_memtable_->Begin(); 
-         it != immutable_memtable_->End(); ++it) {
-        SSTableEntry entry;
-        entry.key = it->first;
-        entry.value = it->second.value;
-        entry.is_deleted = it->second.is_deleted;
-        entry.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            it->second.timestamp.time_since_epoch()).count();
-        entries.push_back(entry);
+    if (write_controller_.Condition() == WriteStallCondition::kStopped) {
+        auto start = std::chrono::steady_clock::now();
+        flush_done_cv_.wait(lock, [this] {
+            return write_controller_.Condition() != WriteStallCondition::kStopped ||
+                   shutting_down_;
+        });
+        write_controller_.RecordStop(ElapsedMicros(start));
     }
+}
+
+void KVStore::UpdateWriteStallCondition() {
+    // Only level 0 tables add to every read; deeper levels cost one
+    // table each however many they hold
+    size_t num_tables = Compaction::Level0Backlog(*version_, GetCompactionStrategy());
+    size_t num_immutables = immutable_memtables_->size();
+    
+    pending_compaction_bytes_ =
+        Compaction::EstimatePendingBytes(*version_, GetCompactionStrategy());
     
-    // Write SSTable
-    std::string filename = GetSSTablePath(next_sstable_id_++);
-    if (SSTable::Create(filename, entries, 
-                       config_.enable_compression,
-                       config_.enable_bloom_filter)) {
-        sstables_.push_back(std::make_unique<SSTable>(filename));
+    uint64_t soft_limit = config_.soft_pending_compaction_bytes_limit;
+    uint64_t hard_limit = config_.hard_pending_compaction_bytes_limit;
+    if (config_.rate_limiter) {
+        // Compactions get the full rate by the time writes would slow down
+        double debt = static_cast<double>(num_tables) /
+                      std::max<size_t>(config_.level0_slowdown_writes_trigger, 1);
+        if (soft_limit > 0) {
+            debt = std::max(debt, static_cast<double>(pending_compaction_bytes_) /
+                                  soft_limit);
+        }
+        config_.rate_limiter->Tune(this, debt);
+    }
+    if (num_tables >= config_.level0_stop_writes_trigger ||
+        (hard_limit > 0 && pending_compaction_bytes_ >= hard_limit)) {
+        write_controller_.SetCondition(WriteStallCondition::kStopped);
+        return;
     }
     
-    // Clear immutable memtable
-    immutable_memtable_.reset();
+    // How far the worst signal is from its slowdown towards its stop
+    // threshold; negative while every signal is below its slowdown
+    double severity = -1;
+    auto measure = [&severity](double value, double slowdown, double stop) {
+        if (value >= slowdown) {
+            severity = std::max(severity,
+                                stop > slowdown ? (value - slowdown) / (stop - slowdown)
+                                                : 1.0);
+        }
+    };
+    measure(num_tables, config_.level0_slowdown_writes_trigger,
+            config_.level0_stop_writes_trigger);
+    if (soft_limit > 0) {
+        measure(pending_compaction_bytes_, soft_limit,
+                hard_limit > soft_limit ? hard_limit : soft_limit);
+    }
+    // With only one or two queued memtables allowed, a single flush in
+    // progress would already throttle writes
+    if (config_.max_immutable_memtables >= 3) {
+        measure(num_immutables, config_.max_immutable_memtables - 1,
+                config_.max_immutable_memtables);
+    }
     
-    // Maybe trigger compaction
-    MaybeCompact();
+    if (severity < 0) {
+        write_controller_.SetCondition(WriteStallCondition::kNormal);
+    } else {
+        write_controller_.SetCondition(WriteStallCondition::kDelayed, severity);
+    }
 }
 
-void KVStore::LoadSSTables() {
-    if (!fs::exists(config_.data_dir)) {
+void KVStore::MaybeScheduleFlush() {
+    if (flush_scheduled_ || shutting_down_ || immutable_memtables_->empty()) {
         return;
     }
+    flush_scheduled_ = true;
+    scheduler_->Schedule(JobPriority::kHigh, [this] { BackgroundFlush(); });
+}
+
+void KVStore::MaybeScheduleCompaction() {
+    if (shutting_down_ ||
+        scheduled_compactions_ >= std::max<size_t>(config_.max_background_compactions, 1)) {
+        return;
+    }
+    // Expiry is checked by every job. A compaction that starts schedules
+    // the next, so jobs fan out while there is work they do not share.
+    Compaction::Pick pick;
+    if (config_.ttl_seconds == 0 &&
+        !Compaction::PickCompaction(*version_, GetCompactionStrategy(),
+                                    compacting_, pick)) {
+        return;
+    }
+    ++scheduled_compactions_;
+    scheduler_->Schedule(JobPriority::kLow, [this] { BackgroundCompaction(); });
+}
+
+void KVStore::BackgroundFlush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!immutable_memtables_->empty()) {
+        // The memtable stays visible to readers until its table is installed
+        auto memtable = immutable_memtables_->front();
+        size_t id = next_sstable_id_++;
+        std::string filename = GetSSTablePath(id);
+        lock.unlock();
+        bool ok = WriteLevel0Table(*memtable, filename, id);
+        VersionEdit edit;
+        bool logged = false;
+        if (ok) {
+            edit.AddFile(0, id, std::make_shared<SSTable>(filename));
+            // The table is installed even if the MANIFEST cannot record it;
+            // the WAL then stays, and replays the data on the next open
+            logged = LogVersionEdit(edit);
+        }
+        lock.lock();
+        
+        if (!ok) {
+            // The WAL still holds the data; retry rather than drop it
+            flush_error_ = true;
+            flush_done_cv_.notify_all();
+            if (flush_done_cv_.wait_for(lock, std::chrono::seconds(1),
+                                        [this] { return shutting_down_; })) {
+                break;
+            }
+            continue;
+        }
+        flush_error_ = false;
+        
+        version_ = version_->Apply(edit);
+        immutable_memtables_ = std::make_shared<MemTableList>(
+            immutable_memtables_->begin() + 1, immutable_memtables_->end());
+        uint64_t log = immutable_logs_.front();
+        immutable_logs_.pop_front();
+        UpdateWriteStallCondition();
+        flush_done_cv_.notify_all();
+        if (logged) {
+            RetireWAL(log);
+        }
+        MaybeScheduleCompaction();
+        lock.unlock();
+        memtable.reset();
+        lock.lock();
+    }
+    flush_scheduled_ = false;
+}
+
+void KVStore::BackgroundCompaction() {
+    bool compacted = MaybeCompact();
+    std::lock_guard<std::mutex> lock(mutex_);
+    --scheduled_compactions_;
+    if (compacted) {
+        MaybeScheduleCompaction();
+    }
+    flush_done_cv_.notify_all();
+}
+
+void KVStore::BackgroundSync() {
+    auto sync_interval = std::chrono::milliseconds(
+        std::max<size_t>(config_.wal_sync_interval_ms, 1));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!sync_cv_.wait_for(lock, sync_interval, [this] { return shutting_down_; })) {
+        MaybePeriodicSync(lock);
+    }
+}
+
+bool KVStore::WriteLevel0Table(const MemTable& memtable,
+                               const std::string& filename, size_t id) const {
+    // Stream the memtable straight into the table file. Writers may be
+    // waiting for it, so it goes ahead of compactions.
+    SSTableOptions options = GetSSTableOptions();
+    options.io_priority = IOPriority::kHigh;
+    SSTableBuilder builder(filename, options);
+    builder.SetFileOrder(id);
+    for (auto it = memtable.Begin(); it != memtable.End(); ++it) {
+        builder.Add(it.key(), it.value(), it.is_deleted(), it.timestamp(),
+                    it.sequence());
+    }
+    return builder.Finish();
+}
+
+bool KVStore::MemTableFull() const {
+    if (memtable_->SizeBytes() >= config_.memtable_size_mb * 1024 * 1024) {
+        return true;
+    }
+    // Over the shared budget every writing store flushes its own memtable,
+    // which releases memory fastest without reaching into other stores
+    return config_.write_buffer_manager &&
+           config_.write_buffer_manager->ShouldFlush() &&
+           !memtable_->IsEmpty();
+}
+
+void KVStore::LoadSSTables() {
+    std::error_code ec;
+    // Table ids are not zero-padded, so parse them rather than sorting by
+    // file name
+    std::map<uint64_t, std::string> sstable_files;
+    for (const auto& entry : fs::directory_iterator(config_.data_dir, ec)) {
+        uint64_t id;
+        if (ParseTableNumber(entry.path().string(), id)) {
+            sstable_files.emplace(id, entry.path().string());
+            next_sstable_id_ = std::max<size_t>(next_sstable_id_.load(), id + 1);
+        }
+    }
     
-    std::vector<std::string> sstable_files;
-    for (const auto& entry : fs::directory_iterator(config_.data_dir)) {
-        if (entry.path().extension() == ".sst") {
-            sstable_files.push_back(entry.path().string());
+    // Replay the MANIFEST for each live table's level. Stores written
+    // before it existed only had flushed tables, so all of theirs go to
+    // level 0, ordered by file order. A damaged MANIFEST is replayed up to
+    // its last good record: loading every table instead would put replaced
+    // compaction inputs in level 0, above the newer data they became.
+    std::map<uint64_t, int> live;
+    bool have_manifest = fs::exists(GetManifestPath(), ec);
+    bool manifest_intact = true;
+    if (have_manifest) {
+        WALReader reader(GetManifestPath());
+        std::string_view record;
+        std::string scratch;
+        while (reader.ReadRecord(record, scratch)) {
+            VersionEdit edit;
+            if (!edit.Decode(record)) {
+                manifest_intact = false;
+                break;
+            }
+            for (const auto& [level, id] : edit.deleted_files) {
+                live.erase(id);
+            }
+            for (const auto& [level, id] : edit.new_files) {
+                live[id] = level;
+            }
+            next_sstable_id_ = std::max<size_t>(next_sstable_id_.load(),
+                                                edit.next_file_number);
+        }
+        manifest_intact = manifest_intact && !reader.Corrupted();
+        if (!manifest_intact) {
+            std::cerr << GetManifestPath() << " is damaged; using the tables "
+                      << "it lists up to the damage" << std::endl;
+        }
+    }
+    if (!have_manifest) {
+        for (const auto& [id, file] : sstable_files) {
+            live.emplace(id, 0);
         }
     }
     
-    std::sort(sstable_files.begin(), sstable_files.end());
+    // Opening a table only reads its footer and metadata blocks
+    std::vector<SSTableList> levels(kNumLevels);
+    for (const auto& [id, level] : live) {
+        auto file = sstable_files.find(id);
+        if (file == sstable_files.end()) {
+            continue;
+        }
+        auto sstable = std::make_shared<SSTable>(file->second);
+        sstable_files.erase(file);
+        if (sstable->IsOpen()) {
+            last_sequence_ = std::max(last_sequence_,
+                                      sstable->GetProperties().largest_sequence);
+            levels[level].push_back(std::move(sstable));
+        }
+    }
+    version_ = std::make_shared<const Version>(std::move(levels));
     
-    for (const auto& file : sstable_files) {
-        sstables_.push_back(std::make_unique<SSTable>(file));
-        
-        // Update next ID
-        std::string filename = fs::path(file).filename().string();
-        size_t id = std::stoull(filename.substr(0, filename.find('.')));
-        next_sstable_id_ = std::max(next_sstable_id_, id + 1);
+    // Tables the MANIFEST does not know were never installed (their data
+    // is still in a WAL) or were compaction inputs already replaced. Past
+    // a damaged record that is not certain, so they are moved into lost/
+    // rather than deleted.
+    if (have_manifest) {
+        std::string lost_dir = config_.data_dir + "/lost";
+        if (!manifest_intact && !sstable_files.empty()) {
+            fs::create_directories(lost_dir, ec);
+        }
+        for (const auto& [id, file] : sstable_files) {
+            if (manifest_intact) {
+                fs::remove(file, ec);
+            } else {
+                fs::rename(file, lost_dir + "/" + fs::path(file).filename().string(), ec);
+            }
+        }
     }
+    
+    // Start a new MANIFEST holding the whole version, so it only ever
+    // grows by one session's edits, and swap it in by rename
+    std::string temp_path = GetManifestPath() + ".tmp";
+    fs::remove(temp_path, ec);
+    auto manifest = std::make_unique<WAL>(temp_path);
+    VersionEdit edit;
+    for (int level = 0; level < kNumLevels; ++level) {
+        for (const auto& sstable : version_->Level(level)) {
+            uint64_t id;
+            ParseTableNumber(sstable->GetFilename(), id);
+            edit.new_files.emplace_back(level, id);
+        }
+    }
+    edit.next_file_number = next_sstable_id_;
+    if (manifest->AddRecord(edit.Encode()) && manifest->Sync()) {
+        fs::rename(temp_path, GetManifestPath(), ec);
+        if (!ec && SyncDirectory(config_.data_dir)) {
+            manifest_ = std::move(manifest);
+            return;
+        }
+    }
+    // The old MANIFEST stays; later edits fail to log, so tables written
+    // this session are replayed from their WALs next time
+    std::cerr << "Failed to write " << GetManifestPath() << std::endl;
+}
+
+bool KVStore::LogVersionEdit(VersionEdit& edit) {
+    std::lock_guard<std::mutex> manifest_lock(manifest_mutex_);
+    if (!manifest_) {
+        return false;
+    }
+    // The new tables' names must be durable before the MANIFEST refers
+    // to them
+    if (!edit.new_files.empty() && !SyncDirectory(config_.data_dir)) {
+        return false;
+    }
+    edit.next_file_number = next_sstable_id_;
+    return manifest_->AddRecord(edit.Encode()) && manifest_->Sync();
+}
+
+Compaction::Strategy KVStore::GetCompactionStrategy() const {
+    Compaction::Strategy strategy;
+    strategy.level0_file_trigger = config_.compaction_threshold;
+    strategy.base_level_bytes =
+        static_cast<uint64_t>(config_.max_bytes_for_level_base_mb) << 20;
+    strategy.multiplier = std::max<size_t>(config_.max_bytes_for_level_multiplier, 2);
+    if (config_.compaction_style == CompactionStyle::kTimeWindow) {
+        strategy.time_window_ms = std::max<uint64_t>(config_.compaction_window_ms, 1);
+    }
+    return strategy;
 }
 
-void KVStore::MaybeCompact() {
-    std::lock_guard<std::mutex> lock(compaction_mutex_);
+bool KVStore::MaybeCompact() {
+    if (DropExpiredTables()) {
+        return true;
+    }
     
-    if (sstables_.size() < config_.compaction_threshold) {
-        return;
+    // The picked tables are marked, so no other compaction removes them
+    // from the version before this one installs; flushes can only add
+    // newer level 0 tables
+    std::shared_ptr<const Version> current;
+    Compaction::Pick pick;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current = version_;
+        if (!Compaction::PickCompaction(*current, GetCompactionStrategy(),
+                                        compacting_, pick)) {
+            return false;
+        }
+        for (const auto& table : pick.inputs) {
+            compacting_.insert(table.get());
+        }
+        for (const auto& table : pick.overlaps) {
+            compacting_.insert(table.get());
+        }
+        MaybeScheduleCompaction();
     }
+    auto release = [this, &pick] {
+        for (const auto& table : pick.inputs) {
+            compacting_.erase(table.get());
+        }
+        for (const auto& table : pick.overlaps) {
+            compacting_.erase(table.get());
+        }
+    };
+    int output_level = pick.output_level;
     
-    auto files_to_compact = Compaction::SelectFilesForCompaction(
-        sstables_, config_.compaction_threshold);
+    VersionEdit edit;
+    std::vector<std::string> files_to_compact;
+    // Oldest first: the next level holds older data than the inputs
+    for (const auto& sst : pick.overlaps) {
+        uint64_t id;
+        ParseTableNumber(sst->GetFilename(), id);
+        edit.DeleteFile(output_level, id);
+        files_to_compact.push_back(sst->GetFilename());
+    }
+    for (const auto& sst : pick.inputs) {
+        uint64_t id;
+        ParseTableNumber(sst->GetFilename(), id);
+        edit.DeleteFile(pick.level, id);
+        files_to_compact.push_back(sst->GetFilename());
+    }
     
-    if (!files_to_compact.empty()) {
-        std::string output_file = GetSSTablePath(next_sstable_id_++);
+    // A lone table with nothing below to merge with moves down as it is
+    bool trivial_move = pick.inputs.size() == 1 && pick.overlaps.empty() &&
+                        output_level != pick.level;
+    if (trivial_move) {
+        uint64_t id;
+        ParseTableNumber(pick.inputs.front()->GetFilename(), id);
+        edit.AddFile(output_level, id, pick.inputs.front());
+    } else {
+        // Tombstones can only go once no deeper level is left to resurrect
+        // the keys they delete
+        bool drop_tombstones = !current->OverlapInLevelsBelow(
+            output_level, pick.smallest, pick.largest);
+        if (output_level == 0) {
+            // Time-window runs also sit above older level 0 tables
+            for (const auto& sst : current->Level(0)) {
+                if (sst == pick.inputs.front()) {
+                    break;
+                }
+                drop_tombstones = drop_tombstones &&
+                    !sst->GetProperties().OverlapsKeyRange(pick.smallest,
+                                                           pick.largest);
+            }
+        }
         
-        if (Compaction::CompactSSTables(files_to_compact, output_file, 
-                                        config_.enable_compression)) {
-            // Remove old SSTables
-            sstables_.erase(
-                std::remove_if(sstables_.begin(), sstables_.end(),
-                    [&](const std::unique_ptr<SSTable>& sst) {
-                        for (const auto& file : files_to_compact) {
-                            // Compare filenames
-                            return true; // Simplified
-                        }
-                        return false;
-                    }),
-                sstables_.end()
-            );
-            
-            // Add new SSTable
-            sstables_.push_back(std::make_unique<SSTable>(output_file));
-            
-            // Delete old files
-            for (const auto& file : files_to_compact) {
-                fs::remove(file);
+        SSTableOptions options = GetSSTableOptions(drop_tombstones);
+        if (!pick.split_outputs) {
+            // Also leaves the merge as one subcompaction
+            options.target_file_size = std::numeric_limits<uint64_t>::max();
+        }
+        std::vector<std::string> output_files;
+        if (!Compaction::CompactSSTables(
+                files_to_compact,
+                [this] { return GetSSTablePath(next_sstable_id_++); },
+                options, output_files,
+                drop_tombstones, config_.max_subcompactions)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            release();
+            return false;
+        }
+        for (const auto& file : output_files) {
+            uint64_t id;
+            ParseTableNumber(file, id);
+            edit.AddFile(output_level, id, std::make_shared<SSTable>(file));
+        }
+    }
+    
+    std::error_code ec;
+    if (!LogVersionEdit(edit)) {
+        if (!trivial_move) {
+            for (const auto& [level, id] : edit.new_files) {
+                fs::remove(GetSSTablePath(id), ec);
             }
         }
+        std::lock_guard<std::mutex> lock(mutex_);
+        release();
+        return false;
     }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        version_ = version_->Apply(edit);
+        release();
+        UpdateWriteStallCondition();
+    }
+    flush_done_cv_.notify_all();
+    
+    // Readers still holding the old version keep their mappings of these
+    if (!trivial_move) {
+        for (const auto& file : files_to_compact) {
+            fs::remove(file, ec);
+        }
+    }
+    return true;
+}
+
+bool KVStore::DropExpiredTables() {
+    if (config_.ttl_seconds == 0) {
+        return false;
+    }
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t ttl_ms = config_.ttl_seconds * 1000;
+    if (now <= ttl_ms) {
+        return false;
+    }
+    
+    // Judged from the properties alone, so expiry costs an unlink per table.
+    // Tables a compaction holds expire once it is done with them.
+    VersionEdit edit;
+    std::vector<const SSTable*> expired;
+    std::vector<std::string> files;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [level, sst] : Compaction::ExpiredTables(*version_, now - ttl_ms)) {
+            if (!compacting_.insert(sst.get()).second) {
+                continue;
+            }
+            uint64_t id;
+            ParseTableNumber(sst->GetFilename(), id);
+            edit.DeleteFile(level, id);
+            expired.push_back(sst.get());
+            files.push_back(sst->GetFilename());
+        }
+    }
+    if (files.empty()) {
+        return false;
+    }
+    bool logged = LogVersionEdit(edit);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (logged) {
+            version_ = version_->Apply(edit);
+            UpdateWriteStallCondition();
+        }
+        for (const SSTable* sst : expired) {
+            compacting_.erase(sst);
+        }
+    }
+    if (!logged) {
+        return false;
+    }
+    // Unlike a compaction this changes what reads return
+    cache_->Clear();
+    flush_done_cv_.notify_all();
+    
+    std::error_code ec;
+    for (const auto& file : files) {
+        fs::remove(file, ec);
+    }
+    return true;
 }
 
 void KVStore::RecoverFromWAL() {
-    auto records = wal_->ReadAll();
-    for (const auto& record : records) {
-        if (record.type == WALRecordType::PUT) {
-            memtable_->Put(record.key, record.value);
-        } else if (record.type == WALRecordType::DELETE) {
-            memtable_->Delete(record.key);
+    // Stores written before per-memtable WALs kept a single wal.log in the
+    // old unframed format; rewrite it as log 0 before replaying
+    std::error_code ec;
+    std::string legacy_path = config_.data_dir + "/wal.log";
+    if (fs::exists(legacy_path, ec)) {
+        WAL log(GetWALPath(0));
+        log.Clear();
+        bool ok = true;
+        for (const auto& record : WAL::ReadLegacyFile(legacy_path)) {
+            // Legacy records were logged one at a time, so each stays its
+            // own batch
+            WriteBatch batch;
+            if (record.type == WALRecordType::PUT) {
+                batch.Put(record.key, record.value);
+            } else {
+                batch.Delete(record.key);
+            }
+            batch.SetTimestamp(record.timestamp);
+            ok = ok && log.AddRecord(batch.Data());
+        }
+        if (ok && log.Sync()) {
+            fs::remove(legacy_path, ec);
         }
     }
+    
+    std::vector<uint64_t> logs;
+    std::vector<uint64_t> recycled;
+    for (const auto& entry : fs::directory_iterator(config_.data_dir, ec)) {
+        std::string stem = entry.path().stem().string();
+        if (stem.empty() || stem.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        if (entry.path().extension() == ".log") {
+            logs.push_back(std::stoull(stem));
+        } else if (entry.path().extension() == ".recycle") {
+            recycled.push_back(std::stoull(stem));
+        }
+    }
+    std::sort(logs.begin(), logs.end());
+    std::sort(recycled.begin(), recycled.end());
+    for (uint64_t number : recycled) {
+        // Recycled files keep their old number; new logs must not reuse it
+        log_number_ = std::max(log_number_, number);
+        if (recycled_logs_.size() < config_.recycle_wal_count) {
+            recycled_logs_.push_back(number);
+        } else {
+            fs::remove(GetRecycledWALPath(number), ec);
+        }
+    }
+    
+    // Logs are replayed in order as they are read, and a memtable that
+    // fills up is written straight to an L0 table, so recovery holds one
+    // memtable however long the logs are. Every log but the newest ends up
+    // entirely in tables and is retired, so a crash during recovery cannot
+    // leave a table from an older log ordered after one from a newer log.
+    // The newest log's tail is queued for the flush thread instead.
+    auto immutables = std::make_shared<MemTableList>();
+    size_t memtable_limit = config_.memtable_size_mb * 1024 * 1024;
+    bool can_flush = true;
+    BatchReplayer replayer(config_.wal_recovery_threads);
+    
+    for (size_t i = 0; i < logs.size(); ++i) {
+        uint64_t number = logs[i];
+        log_number_ = std::max(log_number_, number);
+        auto memtable = std::make_shared<MemTable>(config_.write_buffer_manager);
+        // Batches still queued for the workers are not in SizeBytes() yet
+        size_t replayed_bytes = 0;
+        VersionEdit edit;
+        // After a failed write the rest of recovery stays in memory
+        auto flush = [&] {
+            replayer.Wait();
+            size_t id = next_sstable_id_++;
+            if (!WriteLevel0Table(*memtable, GetSSTablePath(id), id)) {
+                can_flush = false;
+                return;
+            }
+            edit.AddFile(0, id, std::make_shared<SSTable>(GetSSTablePath(id)));
+            memtable = std::make_shared<MemTable>(config_.write_buffer_manager);
+            replayed_bytes = 0;
+        };
+        
+        WALReader reader(GetWALPath(number), number);
+        std::string_view record;
+        std::string scratch;
+        while (reader.ReadRecord(record, scratch)) {
+            // The CRC matched, so a batch that does not parse was written
+            // wrong; nothing after it can be trusted either
+            WriteBatch batch;
+            BatchValidator validator;
+            if (!batch.SetData(record) || !batch.Iterate(validator)) {
+                break;
+            }
+            // Batches from before sequence numbers continue after the
+            // newest one seen so far
+            if (batch.Sequence() == 0) {
+                batch.SetSequence(last_sequence_ + 1);
+            }
+            if (!batch.IsEmpty()) {
+                last_sequence_ = std::max(last_sequence_,
+                                          batch.Sequence() + batch.Count() - 1);
+            }
+            replayed_bytes += batch.ApproximateSize();
+            replayer.Add(memtable.get(), std::move(batch));
+            if (can_flush &&
+                std::max(memtable->SizeBytes(), replayed_bytes) >= memtable_limit) {
+                flush();
+            }
+        }
+        replayer.Wait();
+        
+        bool newest = i + 1 == logs.size();
+        if (can_flush && !newest && !memtable->IsEmpty()) {
+            flush();
+        }
+        // The log's tables are installed even if the MANIFEST cannot
+        // record them, but then the log has to stay
+        bool logged = edit.new_files.empty() || LogVersionEdit(edit);
+        version_ = version_->Apply(edit);
+        if (memtable->IsEmpty()) {
+            if (logged) {
+                RetireWAL(number);
+            }
+            continue;
+        }
+        memtable->MarkImmutable();
+        immutables->push_back(std::move(memtable));
+        immutable_logs_.push_back(number);
+    }
+    immutable_memtables_ = std::move(immutables);
+}
+
+std::shared_ptr<WAL> KVStore::NewWAL(uint64_t number) {
+    WALOptions options;
+    options.log_number = number;
+    // A full memtable's worth of records plus framing
+    options.preallocate_size = config_.memtable_size_mb * 1024 * 1024 / 10 * 11;
+    if (!recycled_logs_.empty()) {
+        std::error_code ec;
+        fs::rename(GetRecycledWALPath(recycled_logs_.front()), GetWALPath(number), ec);
+        recycled_logs_.pop_front();
+        options.reuse = !ec;
+    }
+    auto wal = std::make_shared<WAL>(GetWALPath(number), options);
+    // Synced writes to the log are only durable once its name is
+    SyncDirectory(config_.data_dir);
+    return wal;
+}
+
+void KVStore::RetireWAL(uint64_t number) {
+    std::error_code ec;
+    if (recycled_logs_.size() < config_.recycle_wal_count) {
+        fs::rename(GetWALPath(number), GetRecycledWALPath(number), ec);
+        if (!ec) {
+            recycled_logs_.push_back(number);
+            return;
+        }
+    }
+    fs::remove(GetWALPath(number), ec);
+}
+
+std::string KVStore::GetWALPath(uint64_t number) const {
+    return config_.data_dir + "/" + std::to_string(number) + ".log";
+}
+
+std::string KVStore::GetRecycledWALPath(uint64_t number) const {
+    return config_.data_dir + "/" + std::to_string(number) + ".recycle";
 }
 
 std::string KVStore::GetSSTablePath(size_t id) const {
     return config_.data_dir + "/" + std::to_string(id) + ".sst";
 }
 
+std::string KVStore::GetManifestPath() const {
+    return config_.data_dir + "/MANIFEST";
+}
+
+SSTableOptions KVStore::GetSSTableOptions(bool bottommost) const {
+    SSTableOptions options;
+    options.block_size = config_.block_size_kb * 1024;
+    options.compression = config_.enable_compression ? CompressionType::kLZ4
+                                                     : CompressionType::kNone;
+    options.compression_level = config_.compression_level;
+    options.max_dict_bytes = config_.compression_dict_kb * 1024;
+    options.filter_type = !config_.enable_bloom_filter ? FilterType::kNone
+                        : bottommost ? config_.bottommost_filter_type
+                                     : config_.filter_type;
+    options.target_file_size = config_.target_file_size_mb * 1024 * 1024;
+    options.prefix_extractor = config_.prefix_extractor;
+    options.rate_limiter = config_.rate_limiter;
+    return options;
+}
+
+bool KVStore::TableMayOverlap(const SSTable& sstable,
+                              const std::string& start_key,
+                              const std::string& end_key) const {
+    if (!sstable.GetProperties().OverlapsKeyRange(start_key, end_key)) {
+        return false;
+    }
+    // When both bounds share a prefix, every key in between has it too
+    const PrefixExtractor* extractor = config_.prefix_extractor.get();
+    if (extractor && extractor->InDomain(start_key)) {
+        std::string_view prefix = extractor->Transform(start_key);
+        if (std::string_view(end_key).substr(0, prefix.size()) == prefix) {
+            return sstable.MayContainPrefix(*extractor, prefix);
+        }
+    }
+    return true;
+}
+
 } // namespace kvstore
@@ -1,9 +1,12 @@
 #include "lru_cache.h"
+#include <functional>
 
 namespace kvstore {
 
 LRUCache::LRUCache(size_t capacity_bytes)
-    : capacity_(capacity_bytes), current_size_(0), hits_(0), misses_(0) {}
+    : capacity_(capacity_bytes), current_size_(0), hits_(0), misses_(0) {
+    generations_.fill(0);
+}
 
 bool LRUCache::Get(const std::string& key, std::string& value) {
     std::lock_guard<std::mutex> lock(mutex_);
@@ -24,7 +27,25 @@ bool LRUCache::Get(const std::string& key, std::string& value) {
 
 void LRUCache::Put(const std::string& key, const std::string& value) {
     std::lock_guard<std::mutex> lock(mutex_);
-    
+    PutLocked(key, value);
+}
+
+uint64_t LRUCache::Generation(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generations_[Stripe(key)];
+}
+
+bool LRUCache::PutIfGeneration(const std::string& key, const std::string& value,
+                               uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generations_[Stripe(key)] != generation) {
+        return false;
+    }
+    PutLocked(key, value);
+    return true;
+}
+
+void LRUCache::PutLocked(const std::string& key, const std::string& value) {
     size_t entry_size = EstimateSize(key, value);
     
     // Remove if exists
@@ -49,6 +70,7 @@ void LRUCache::Put(const std::string& key, const std::string& value) {
 
 void LRUCache::Invalidate(const std::string& key) {
     std::lock_guard<std::mutex> lock(mutex_);
+    ++generations_[Stripe(key)];
     
     auto it = cache_map_.find(key);
     if (it != cache_map_.end()) {
@@ -60,6 +82,10 @@ void LRUCache::Invalidate(const std::string& key) {
 
 void LRUCache::Clear() {
     std::lock_guard<std::mutex> lock(mutex_);
+    // Lookups already under way must not repopulate it either
+    for (auto& generation : generations_) {
+        ++generation;
+    }
     lru_list_.clear();
     cache_map_.clear();
     current_size_ = 0;
@@ -79,6 +105,10 @@ void LRUCache::Evict() {
     lru_list_.pop_back();
 }
 
+size_t LRUCache::Stripe(const std::string& key) const {
+    return std::hash<std::string>{}(key) % kGenerationStripes;
+}
+
 size_t LRUCache::EstimateSize(const std::string& key, const std::string& value) const {
     return key.size() + value.size() + sizeof(CacheEntry);
 }
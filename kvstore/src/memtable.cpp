@@ -1,52 +1,297 @@
 #include "memtable.h"
+#include "format.h"
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <random>
+#include <thread>
+#include <utility>
 
 namespace kvstore {
 
-void MemTable::Put(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = table_.find(key);
-    if (it != table_.end()) {
-        size_bytes_ -= EstimateSize(key, it->second);
+namespace {
+
+constexpr uint8_t kTypeDeletion = 0x01;
+
+// Entries are laid out in the arena as
+//   key_len(fixed32) key tag(fixed64) timestamp(fixed64)
+//   value_len(fixed32) value
+// where tag = sequence << 8 | type
+std::string_view EntryKey(const char* entry) {
+    return std::string_view(entry + 4, DecodeFixed32(entry));
+}
+
+uint64_t EntryTag(const char* entry) {
+    return DecodeFixed64(entry + 4 + DecodeFixed32(entry));
+}
+
+uint64_t EntryTimestamp(const char* entry) {
+    return DecodeFixed64(entry + 12 + DecodeFixed32(entry));
+}
+
+std::string_view EntryValue(const char* entry) {
+    const char* ptr = entry + 20 + DecodeFixed32(entry);
+    return std::string_view(ptr + 4, DecodeFixed32(ptr));
+}
+
+} // namespace
+
+struct MemTable::Node {
+    const char* entry;
+
+    Node* Next(int level) const {
+        return next_[level].load(std::memory_order_acquire);
+    }
+    void NoBarrierSetNext(int level, Node* node) {
+        next_[level].store(node, std::memory_order_relaxed);
+    }
+    bool CASNext(int level, Node* expected, Node* node) {
+        return next_[level].compare_exchange_strong(expected, node,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed);
+    }
+
+    // Sized to the node's height when allocated
+    std::atomic<Node*> next_[1];
+};
+
+namespace {
+
+// Orders node entries by key ascending, then sequence descending
+int Compare(const char* entry, std::string_view key, uint64_t sequence) {
+    int c = EntryKey(entry).compare(key);
+    if (c != 0) {
+        return c;
+    }
+    uint64_t entry_sequence = EntryTag(entry) >> 8;
+    if (entry_sequence > sequence) return -1;
+    if (entry_sequence < sequence) return 1;
+    return 0;
+}
+
+} // namespace
+
+MemTable::MemTable(std::shared_ptr<WriteBufferManager> write_buffer_manager)
+    : write_buffer_manager_(std::move(write_buffer_manager)),
+      immutable_(false),
+      arena_(write_buffer_manager_.get()),
+      head_(nullptr), max_height_(1), num_keys_(0) {
+    head_ = NewNode(nullptr, kMaxHeight);
+    for (int i = 0; i < kMaxHeight; ++i) {
+        head_->NoBarrierSetNext(i, nullptr);
+    }
+}
+
+MemTable::~MemTable() {
+    MarkImmutable();
+}
+
+void MemTable::MarkImmutable() {
+    if (write_buffer_manager_ && !immutable_) {
+        write_buffer_manager_->ScheduleFreeMem(arena_.MemoryUsage());
+    }
+    immutable_ = true;
+}
+
+void MemTable::Put(std::string_view key, std::string_view value,
+                   uint64_t sequence, uint64_t timestamp) {
+    Add(key, value, false, sequence, timestamp);
+}
+
+void MemTable::Delete(std::string_view key, uint64_t sequence,
+                      uint64_t timestamp) {
+    Add(key, std::string_view(), true, sequence, timestamp);
+}
+
+bool MemTable::Get(const std::string& key, std::string& value,
+                   bool* is_deleted, uint64_t snapshot) const {
+    // Versions are newest first, so this is the newest one in the snapshot
+    const Node* node = FindGreaterOrEqual(key, snapshot);
+    if (!node || EntryKey(node->entry) != key) {
+        return false;
+    }
+    bool deleted = (EntryTag(node->entry) & kTypeDeletion) != 0;
+    if (is_deleted) {
+        *is_deleted = deleted;
+    }
+    if (deleted) {
+        return false;
     }
-    
-    Entry entry(value);
-    size_bytes_ += EstimateSize(key, entry);
-    table_[key] = entry;
+    std::string_view stored = EntryValue(node->entry);
+    value.assign(stored.data(), stored.size());
+    return true;
 }
 
-bool MemTable::Get(const std::string& key, std::string& value) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = table_.find(key);
-    if (it != table_.end() && !it->second.is_deleted) {
-        value = it->second.value;
-        return true;
+MemTable::Iterator MemTable::Begin(uint64_t snapshot) const {
+    return Iterator(head_->Next(0), snapshot);
+}
+
+MemTable::Iterator MemTable::Seek(std::string_view key,
+                                  uint64_t snapshot) const {
+    return Iterator(FindGreaterOrEqual(key, snapshot), snapshot);
+}
+
+void MemTable::Add(std::string_view key, std::string_view value,
+                   bool is_deleted, uint64_t sequence, uint64_t timestamp) {
+    if (timestamp == 0) {
+        timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    size_t entry_size = 4 + key.size() + 8 + 8 + 4 + value.size();
+    char* entry = arena_.Allocate(entry_size);
+    char* ptr = entry;
+    EncodeFixed32(ptr, static_cast<uint32_t>(key.size()));
+    std::memcpy(ptr + 4, key.data(), key.size());
+    ptr += 4 + key.size();
+    EncodeFixed64(ptr, (sequence << 8) | (is_deleted ? kTypeDeletion : 0));
+    EncodeFixed64(ptr + 8, timestamp);
+    EncodeFixed32(ptr + 16, static_cast<uint32_t>(value.size()));
+    std::memcpy(ptr + 20, value.data(), value.size());
+
+    int height = RandomHeight();
+    Insert(NewNode(entry, height), height);
+}
+
+MemTable::Node* MemTable::NewNode(const char* entry, int height) {
+    char* mem = arena_.Allocate(
+        sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+    Node* node = new (mem) Node;
+    node->entry = entry;
+    for (int i = 1; i < height; ++i) {
+        new (&node->next_[i]) std::atomic<Node*>(nullptr);
+    }
+    return node;
+}
+
+void MemTable::Insert(Node* node, int height) {
+    std::string_view key = EntryKey(node->entry);
+    uint64_t sequence = EntryTag(node->entry) >> 8;
+
+    int max_height = max_height_.load(std::memory_order_relaxed);
+    while (height > max_height) {
+        if (max_height_.compare_exchange_weak(max_height, height,
+                                              std::memory_order_relaxed)) {
+            max_height = height;
+            break;
+        }
+    }
+
+    // Splice: for every level, the nodes the new one goes between
+    Node* prev[kMaxHeight + 1];
+    Node* next[kMaxHeight + 1];
+    prev[max_height] = head_;
+    next[max_height] = nullptr;
+    for (int i = max_height - 1; i >= 0; --i) {
+        FindSpliceForLevel(key, sequence, prev[i + 1], next[i + 1], i,
+                           &prev[i], &next[i]);
+    }
+
+    // Link bottom-up. A failed CAS means another insert got in between, so
+    // search again from the old predecessor, which is still before us.
+    for (int i = 0; i < height; ++i) {
+        while (true) {
+            node->NoBarrierSetNext(i, next[i]);
+            if (prev[i]->CASNext(i, next[i], node)) {
+                break;
+            }
+            FindSpliceForLevel(key, sequence, prev[i], nullptr, i,
+                               &prev[i], &next[i]);
+        }
+        if (i == 0) {
+            // Versions of one key are adjacent, so a neighbour tells whether
+            // this key was already present
+            bool existing = (prev[0] != head_ && EntryKey(prev[0]->entry) == key) ||
+                            (next[0] && EntryKey(next[0]->entry) == key);
+            if (!existing) {
+                num_keys_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void MemTable::FindSpliceForLevel(std::string_view key, uint64_t sequence,
+                                  Node* before, Node* after, int level,
+                                  Node** out_prev, Node** out_next) const {
+    while (true) {
+        Node* next = before->Next(level);
+        if (next == after || !next || Compare(next->entry, key, sequence) >= 0) {
+            *out_prev = before;
+            *out_next = next;
+            return;
+        }
+        before = next;
+    }
+}
+
+const MemTable::Node* MemTable::FindGreaterOrEqual(std::string_view key,
+                                                   uint64_t sequence) const {
+    const Node* node = head_;
+    int level = max_height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        const Node* next = node->Next(level);
+        if (next && Compare(next->entry, key, sequence) < 0) {
+            node = next;
+        } else if (level == 0) {
+            return next;
+        } else {
+            --level;
+        }
     }
-    return false;
 }
 
-void MemTable::Delete(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = table_.find(key);
-    if (it != table_.end()) {
-        size_bytes_ -= EstimateSize(key, it->second);
+int MemTable::RandomHeight() {
+    // Each level holds about a quarter of the nodes of the one below
+    thread_local std::minstd_rand rng(
+        std::hash<std::thread::id>()(std::this_thread::get_id()));
+    int height = 1;
+    while (height < kMaxHeight && rng() % 4 == 0) {
+        ++height;
     }
-    
-    Entry entry("", true);
-    size_bytes_ += EstimateSize(key, entry);
-    table_[key] = entry;
+    return height;
+}
+
+MemTable::Iterator::Iterator(const Node* node, uint64_t snapshot)
+    : node_(node), snapshot_(snapshot) {
+    SkipInvisible();
+}
+
+std::string_view MemTable::Iterator::key() const {
+    return EntryKey(node_->entry);
 }
 
-void MemTable::Clear() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    table_.clear();
-    size_bytes_ = 0;
+std::string_view MemTable::Iterator::value() const {
+    return EntryValue(node_->entry);
+}
+
+bool MemTable::Iterator::is_deleted() const {
+    return (EntryTag(node_->entry) & kTypeDeletion) != 0;
+}
+
+uint64_t MemTable::Iterator::timestamp() const {
+    return EntryTimestamp(node_->entry);
+}
+
+uint64_t MemTable::Iterator::sequence() const {
+    return EntryTag(node_->entry) >> 8;
+}
+
+void MemTable::Iterator::SkipInvisible() {
+    // A key whose versions are all too new is skipped entirely, since the
+    // next key's versions follow directly
+    while (node_ && (EntryTag(node_->entry) >> 8) > snapshot_) {
+        node_ = node_->Next(0);
+    }
 }
 
-size_t MemTable::EstimateSize(const std::string& key, const Entry& entry) const {
-    return key.size() + entry.value.size() + sizeof(Entry);
+MemTable::Iterator& MemTable::Iterator::operator++() {
+    // Skip the older versions of the current key
+    std::string_view current = key();
+    do {
+        node_ = node_->Next(0);
+    } while (node_ && EntryKey(node_->entry) == current);
+    SkipInvisible();
+    return *this;
 }
 
 } // namespace kvstore
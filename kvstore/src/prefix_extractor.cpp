@@ -0,0 +1,73 @@
+#include "prefix_extractor.h"
+
+namespace kvstore {
+
+namespace {
+
+class FixedPrefixExtractor : public PrefixExtractor {
+public:
+    explicit FixedPrefixExtractor(size_t length) : length_(length) {}
+
+    bool InDomain(std::string_view key) const override {
+        return key.size() >= length_;
+    }
+
+    std::string_view Transform(std::string_view key) const override {
+        return key.substr(0, length_);
+    }
+
+    std::string Name() const override {
+        return "kvstore.FixedPrefix(" + std::to_string(length_) + ")";
+    }
+
+private:
+    size_t length_;
+};
+
+class DelimitedPrefixExtractor : public PrefixExtractor {
+public:
+    DelimitedPrefixExtractor(char delimiter, size_t count)
+        : delimiter_(delimiter), count_(count) {}
+
+    bool InDomain(std::string_view key) const override {
+        return PrefixLength(key) != std::string_view::npos;
+    }
+
+    std::string_view Transform(std::string_view key) const override {
+        return key.substr(0, PrefixLength(key));
+    }
+
+    std::string Name() const override {
+        return "kvstore.DelimitedPrefix(" + std::string(1, delimiter_) + "," +
+               std::to_string(count_) + ")";
+    }
+
+private:
+    char delimiter_;
+    size_t count_;
+
+    size_t PrefixLength(std::string_view key) const {
+        size_t pos = 0;
+        for (size_t found = 0; found < count_; ++found) {
+            pos = key.find(delimiter_, pos);
+            if (pos == std::string_view::npos) {
+                return pos;
+            }
+            ++pos;
+        }
+        return pos;
+    }
+};
+
+} // namespace
+
+std::shared_ptr<const PrefixExtractor> NewFixedPrefixExtractor(size_t length) {
+    return std::make_shared<FixedPrefixExtractor>(length);
+}
+
+std::shared_ptr<const PrefixExtractor> NewDelimitedPrefixExtractor(
+    char delimiter, size_t count) {
+    return std::make_shared<DelimitedPrefixExtractor>(delimiter, count);
+}
+
+} // namespace kvstore
@@ -0,0 +1,120 @@
+#include "rate_limiter.h"
+#include <algorithm>
+
+namespace kvstore {
+
+RateLimiter::RateLimiter(uint64_t bytes_per_second, bool auto_tuned)
+    : max_rate_(std::max(bytes_per_second, kMinBytesPerSecond)),
+      rate_(max_rate_),
+      auto_tuned_(auto_tuned),
+      available_(0),
+      last_refill_(std::chrono::steady_clock::now()),
+      high_waiters_(0),
+      bytes_throttled_(0),
+      micros_waited_(0) {
+    UpdateRate();
+    available_ = Burst();
+}
+
+void RateLimiter::Request(uint64_t bytes, IOPriority priority) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool high = priority == IOPriority::kHigh;
+    uint64_t requested = bytes;
+    auto start = std::chrono::steady_clock::now();
+    bool waited = false;
+    while (bytes > 0) {
+        Refill();
+        // A burst at a time, so one large write cannot hold back the rest
+        uint64_t chunk = std::min<uint64_t>(bytes, std::max(Burst(), 1.0));
+        bool yield = !high && high_waiters_ > 0;
+        if (!yield && available_ >= chunk) {
+            available_ -= chunk;
+            bytes -= chunk;
+            continue;
+        }
+
+        // Sleep until the tokens should be there; a low priority request
+        // behind high ones looks again once they are served
+        waited = true;
+        uint64_t wait_micros = yield ? kRefillPeriodMicros
+            : static_cast<uint64_t>((chunk - available_) * 1e6 / rate_) + 1;
+        high_waiters_ += high;
+        cv_.wait_for(lock, std::chrono::microseconds(wait_micros));
+        high_waiters_ -= high;
+    }
+    if (waited) {
+        bytes_throttled_ += requested;
+        micros_waited_ += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (high) {
+            cv_.notify_all();
+        }
+    }
+}
+
+void RateLimiter::Tune(const void* caller, double debt) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!auto_tuned_) {
+        return;
+    }
+    Refill();
+    debts_[caller] = std::min(std::max(debt, 0.0), 1.0);
+    UpdateRate();
+}
+
+void RateLimiter::RemoveCaller(const void* caller) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (debts_.erase(caller) > 0) {
+        Refill();
+        UpdateRate();
+    }
+}
+
+void RateLimiter::SetBytesPerSecond(uint64_t bytes_per_second) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Refill();
+    max_rate_ = std::max(bytes_per_second, kMinBytesPerSecond);
+    UpdateRate();
+}
+
+uint64_t RateLimiter::GetBytesPerSecond() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rate_;
+}
+
+uint64_t RateLimiter::BytesThrottled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_throttled_;
+}
+
+uint64_t RateLimiter::MicrosWaited() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return micros_waited_;
+}
+
+double RateLimiter::Burst() const {
+    return static_cast<double>(rate_) * kRefillPeriodMicros / 1e6;
+}
+
+void RateLimiter::Refill() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+    last_refill_ = now;
+    available_ = std::min(available_ + elapsed * rate_, Burst());
+}
+
+void RateLimiter::UpdateRate() {
+    double share = auto_tuned_
+        ? kMinAutoTunedShare + (1 - kMinAutoTunedShare) * MaxDebt() : 1.0;
+    rate_ = std::max(static_cast<uint64_t>(max_rate_ * share), kMinBytesPerSecond);
+}
+
+double RateLimiter::MaxDebt() const {
+    double debt = 0;
+    for (const auto& [caller, caller_debt] : debts_) {
+        debt = std::max(debt, caller_debt);
+    }
+    return debt;
+}
+
+} // namespace kvstore
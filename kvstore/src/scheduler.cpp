@@ -0,0 +1,57 @@
+#include "scheduler.h"
+#include <algorithm>
+
+namespace kvstore {
+
+Scheduler::Scheduler(size_t high_threads, size_t low_threads)
+    : shutting_down_(false) {
+    for (auto [priority, count] : {std::make_pair(JobPriority::kHigh, high_threads),
+                                   std::make_pair(JobPriority::kLow, low_threads)}) {
+        Pool& pool = GetPool(priority);
+        for (size_t i = 0; i < std::max<size_t>(count, 1); ++i) {
+            pool.threads.emplace_back(&Scheduler::Run, this, std::ref(pool));
+        }
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutting_down_ = true;
+    }
+    for (Pool& pool : pools_) {
+        pool.cv.notify_all();
+        for (auto& thread : pool.threads) {
+            thread.join();
+        }
+    }
+}
+
+void Scheduler::Schedule(JobPriority priority, std::function<void()> job) {
+    Pool& pool = GetPool(priority);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (shutting_down_) {
+            return;
+        }
+        pool.queue.push_back(std::move(job));
+    }
+    pool.cv.notify_one();
+}
+
+void Scheduler::Run(Pool& pool) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        pool.cv.wait(lock, [&] { return shutting_down_ || !pool.queue.empty(); });
+        if (shutting_down_) {
+            return;
+        }
+        auto job = std::move(pool.queue.front());
+        pool.queue.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+} // namespace kvstore
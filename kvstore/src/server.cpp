@@ -8,6 +8,29 @@
 
 using namespace kvstore;
 
+// Limits on one BATCH, so a client cannot hold a connection thread
+// reading and buffering forever
+constexpr size_t kMaxBatchCount = 100000;
+constexpr size_t kMaxBatchBytes = 64 << 20;
+
+// One line of a BATCH body: "PUT key value" or "DELETE key"
+bool ParseBatchLine(std::string line, WriteBatch& batch) {
+    line.erase(line.find_last_not_of("\r") + 1);
+    if (line.substr(0, 4) == "PUT ") {
+        size_t pos = line.find(' ', 4);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        batch.Put(line.substr(4, pos - 4), line.substr(pos + 1));
+        return true;
+    }
+    if (line.substr(0, 7) == "DELETE ") {
+        batch.Delete(line.substr(7));
+        return true;
+    }
+    return false;
+}
+
 void HandleClient(int client_socket, KVStore& store) {
     char buffer[4096];
     
@@ -22,7 +45,7 @@ void HandleClient(int client_socket, KVStore& store) {
         std::string request(buffer);
         std::string response;
         
-        // Parse command: PUT key value, GET key, DELETE key
+        // Parse command: PUT key value, GET key, DELETE key, BATCH count
         if (request.substr(0, 3) == "PUT") {
             size_t pos1 = request.find(' ', 4);
             std::string key = request.substr(4, pos1 - 4);
@@ -55,6 +78,54 @@ void HandleClient(int client_socket, KVStore& store) {
                 response = "ERROR\n";
             }
         }
+        else if (request.substr(0, 5) == "BATCH") {
+            // BATCH <count> is followed by <count> lines, each a PUT or
+            // DELETE, which are committed together; they may arrive over
+            // several reads. An empty or oversized batch is an error.
+            size_t count = std::strtoul(request.c_str() + 5, nullptr, 10);
+            if (count == 0 || count > kMaxBatchCount) {
+                response = "ERROR\n";
+            } else {
+                size_t eol = request.find('\n');
+                std::string body = eol == std::string::npos ? "" : request.substr(eol + 1);
+                
+                WriteBatch batch;
+                bool ok = true;
+                bool connected = true;
+                while (ok && batch.Count() < count) {
+                    eol = body.find('\n');
+                    if (eol == std::string::npos) {
+                        if (body.size() + batch.ApproximateSize() > kMaxBatchBytes) {
+                            // The rest of the batch is still on its way, so
+                            // the stream cannot be resynchronized
+                            response = "ERROR\n";
+                            send(client_socket, response.c_str(), response.size(), 0);
+                            connected = false;
+                            break;
+                        }
+                        memset(buffer, 0, sizeof(buffer));
+                        bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+                        if (bytes_read <= 0) {
+                            connected = false;
+                            break;
+                        }
+                        body.append(buffer, bytes_read);
+                        continue;
+                    }
+                    ok = ParseBatchLine(body.substr(0, eol), batch);
+                    body.erase(0, eol + 1);
+                }
+                if (!connected) {
+                    break;
+                }
+                
+                if (ok && store.Write(batch)) {
+                    response = "OK " + std::to_string(batch.Count()) + "\n";
+                } else {
+                    response = "ERROR\n";
+                }
+            }
+        }
         else {
             response = "UNKNOWN_COMMAND\n";
         }
@@ -75,6 +146,9 @@ int main(int argc, char* argv[]) {
     config.data_dir = "./data";
     config.memtable_size_mb = 64;
     config.compaction_threshold = 4;
+    // Keys look like "log:<service>:<timestamp>"; per-service scans can
+    // then skip tables holding other services only
+    config.prefix_extractor = NewDelimitedPrefixExtractor(':', 2);
     
     KVStore store(config);
     std::cout << "KVStore server starting on port " << port << std::endl;
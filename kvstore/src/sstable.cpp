@@ -1,208 +1,404 @@
 #include "sstable.h"
+#include "sstable_builder.h"
+#include "block.h"
+#include "format.h"
 #include <algorithm>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace kvstore {
 
+namespace {
+
+// Splits an encoded entry value into its header fields and the user value
+bool DecodeEntryValue(uint32_t format_version, std::string_view& encoded,
+                      uint8_t& flags, uint64_t& sequence, uint64_t& timestamp) {
+    if (encoded.empty()) {
+        return false;
+    }
+    flags = static_cast<uint8_t>(encoded[0]);
+    encoded.remove_prefix(1);
+    sequence = 0;
+    if (format_version >= 2 && !GetVarint64(encoded, sequence)) {
+        return false;
+    }
+    return GetVarint64(encoded, timestamp);
+}
+
+} // namespace
+
 SSTable::SSTable(const std::string& filename)
-    : filename_(filename), file_size_(0), num_entries_(0),
-      creation_time_(0), compression_enabled_(false) {
-    
-    file_.open(filename, std::ios::binary);
-    if (file_.is_open()) {
-        LoadIndex();
-        LoadBloomFilter();
+    : filename_(filename), fd_(-1), data_(nullptr), filter_loaded_(false),
+      prefix_filter_loaded_(false), file_size_(0), creation_time_(0) {
+
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) == 0 && st.st_size > 0) {
+        void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr != MAP_FAILED) {
+            data_ = static_cast<const char*>(addr);
+            file_size_ = st.st_size;
+            creation_time_ = st.st_mtime;
+        }
+    }
+
+    if (data_) {
+        LoadTable();
     }
 }
 
 SSTable::~SSTable() {
-    if (file_.is_open()) {
-        file_.close();
+    if (data_) {
+        ::munmap(const_cast<char*>(data_), file_size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
     }
 }
 
-bool SSTable::Get(const std::string& key, std::string& value) {
+bool SSTable::Get(const std::string& key, std::string& value,
+                  bool* is_deleted) const {
     if (!MayContain(key)) {
         return false;
     }
-    
-    SSTableEntry entry;
-    if (BinarySearch(key, entry) && !entry.is_deleted) {
-        value = entry.value;
-        return true;
+
+    bool deleted = false;
+    if (!BinarySearch(key, value, deleted)) {
+        return false;
+    }
+    if (is_deleted) {
+        *is_deleted = deleted;
     }
-    return false;
+    return !deleted;
 }
 
 std::vector<SSTableEntry> SSTable::Scan(const std::string& start_key,
                                          const std::string& end_key,
-                                         size_t limit) {
+                                         size_t limit) const {
     std::vector<SSTableEntry> results;
-    
-    for (const auto& idx : index_) {
-        if (idx.key < start_key) continue;
-        if (idx.key > end_key) break;
-        if (results.size() >= limit) break;
-        
-        file_.seekg(idx.offset);
-        
+    if (!index_block_ || !properties_.OverlapsKeyRange(start_key, end_key)) {
+        return results;
+    }
+
+    Iterator iter(*this);
+    for (iter.Seek(start_key); iter.Valid() && results.size() < limit;
+         iter.Next()) {
+        if (iter.key() > end_key) {
+            break;
+        }
         SSTableEntry entry;
-        // Read entry (simplified)
-        uint32_t key_len, value_len;
-        file_.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
-        
-        entry.key.resize(key_len);
-        file_.read(&entry.key[0], key_len);
-        
-        file_.read(reinterpret_cast<char*>(&value_len), sizeof(value_len));
-        entry.value.resize(value_len);
-        file_.read(&entry.value[0], value_len);
-        
-        file_.read(reinterpret_cast<char*>(&entry.is_deleted), sizeof(entry.is_deleted));
-        file_.read(reinterpret_cast<char*>(&entry.timestamp), sizeof(entry.timestamp));
-        
-        results.push_back(entry);
-    }
-    
+        entry.key.assign(iter.key());
+        entry.value.assign(iter.value());
+        entry.is_deleted = iter.is_deleted();
+        entry.timestamp = iter.timestamp();
+        entry.sequence = iter.sequence();
+        results.push_back(std::move(entry));
+    }
+
     return results;
 }
 
+std::vector<std::string> SSTable::GetBlockSeparators() const {
+    std::vector<std::string> separators;
+    if (!index_block_) {
+        return separators;
+    }
+    auto iter = index_block_->NewIterator();
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        separators.emplace_back(iter.key());
+    }
+    return separators;
+}
+
+SSTable::Iterator::Iterator(const SSTable& table)
+    : table_(table), valid_(false), corrupted_(false), is_deleted_(false),
+      timestamp_(0), sequence_(0) {
+    if (table.index_block_) {
+        index_iter_.emplace(*table.index_block_);
+    }
+}
+
+void SSTable::Iterator::SeekToFirst() {
+    if (!index_iter_) return;
+    index_iter_->SeekToFirst();
+    if (LoadBlock()) {
+        data_iter_->SeekToFirst();
+    }
+    FindEntry();
+}
+
+void SSTable::Iterator::Seek(std::string_view target) {
+    if (!index_iter_) return;
+    // First block whose separator is >= target
+    index_iter_->Seek(target);
+    if (LoadBlock()) {
+        data_iter_->Seek(target);
+    }
+    FindEntry();
+}
+
+void SSTable::Iterator::Next() {
+    if (!valid_) return;
+    data_iter_->Next();
+    FindEntry();
+}
+
+bool SSTable::Iterator::LoadBlock() {
+    data_iter_.reset();
+    if (corrupted_ || !index_iter_->Valid()) {
+        corrupted_ = corrupted_ || index_iter_->Corrupted();
+        return false;
+    }
+    BlockHandle handle;
+    std::string_view input = index_iter_->value();
+    std::string_view contents;
+    if (!handle.DecodeFrom(input) ||
+        !table_.ReadBlock(handle, scratch_, contents, table_.dictionary_)) {
+        corrupted_ = true;
+        return false;
+    }
+    // The iterator reads the contents directly, so the block object itself
+    // need not be kept
+    data_iter_.emplace(Block(contents));
+    return true;
+}
+
+void SSTable::Iterator::FindEntry() {
+    valid_ = false;
+    while (data_iter_ && !data_iter_->Valid()) {
+        if (data_iter_->Corrupted()) {
+            corrupted_ = true;
+            return;
+        }
+        index_iter_->Next();
+        if (LoadBlock()) {
+            data_iter_->SeekToFirst();
+        }
+    }
+    if (!data_iter_) {
+        return;
+    }
+    std::string_view encoded = data_iter_->value();
+    uint8_t flags;
+    if (!DecodeEntryValue(table_.footer_.format_version, encoded, flags,
+                          sequence_, timestamp_)) {
+        corrupted_ = true;
+        return;
+    }
+    value_ = encoded;
+    is_deleted_ = (flags & kEntryDeleted) != 0;
+    valid_ = true;
+}
+
 bool SSTable::Create(const std::string& filename,
                      const std::vector<SSTableEntry>& entries,
                      bool use_compression,
                      bool use_bloom_filter) {
-    std::ofstream out(filename, std::ios::binary);
-    if (!out.is_open()) {
-        return false;
-    }
-    
-    // Write header
-    WriteHeader(out, entries.size(), use_compression, use_bloom_filter);
-    
-    // Build index and write data
-    std::vector<SSTableIndex> index;
-    uint64_t current_offset = 0;
-    
+    SSTableOptions options;
+    options.compression = use_compression ? CompressionType::kLZ4
+                                          : CompressionType::kNone;
+    options.filter_type = use_bloom_filter ? FilterType::kBloom
+                                           : FilterType::kNone;
+    return Create(filename, entries, options);
+}
+
+bool SSTable::Create(const std::string& filename,
+                     const std::vector<SSTableEntry>& entries,
+                     const SSTableOptions& options) {
+    SSTableBuilder builder(filename, options);
     for (const auto& entry : entries) {
-        SSTableIndex idx;
-        idx.key = entry.key;
-        idx.offset = current_offset;
-        
-        // Write entry
-        uint32_t key_len = entry.key.size();
-        uint32_t value_len = entry.value.size();
-        
-        out.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-        out.write(entry.key.c_str(), key_len);
-        out.write(reinterpret_cast<const char*>(&value_len), sizeof(value_len));
-        out.write(entry.value.c_str(), value_len);
-        out.write(reinterpret_cast<const char*>(&entry.is_deleted), sizeof(entry.is_deleted));
-        out.write(reinterpret_cast<const char*>(&entry.timestamp), sizeof(entry.timestamp));
-        
-        idx.size = sizeof(key_len) + key_len + sizeof(value_len) + value_len +
-                   sizeof(entry.is_deleted) + sizeof(entry.timestamp);
-        
-        current_offset += idx.size;
-        index.push_back(idx);
-    }
-    
-    // Write index
-    WriteIndex(out, index);
-    
-    // Write bloom filter
-    if (use_bloom_filter) {
-        BloomFilter bf(entries.size());
-        for (const auto& entry : entries) {
-            bf.Add(entry.key);
-        }
-        auto bf_data = bf.Serialize();
-        uint32_t bf_size = bf_data.size();
-        out.write(reinterpret_cast<const char*>(&bf_size), sizeof(bf_size));
-        out.write(reinterpret_cast<const char*>(bf_data.data()), bf_size);
+        builder.Add(entry);
     }
-    
-    out.close();
-    return true;
+    return builder.Finish();
 }
 
 bool SSTable::MayContain(const std::string& key) const {
-    if (key < first_key_ || key > last_key_) {
+    if (!index_block_ || key < properties_.smallest_key ||
+        key > properties_.largest_key) {
         return false;
     }
-    
-    if (bloom_filter_) {
-        return bloom_filter_->MayContain(key);
+
+    std::call_once(filter_once_, &SSTable::LoadFilter, this);
+    if (filter_) {
+        return filter_->MayContain(key);
     }
-    
-    return true;
-}
 
-bool SSTable::LoadIndex() {
-    // Simplified index loading
     return true;
 }
 
-bool SSTable::LoadBloomFilter() {
-    // Simplified bloom filter loading
-    return true;
-}
+bool SSTable::LoadTable() {
+    if (file_size_ < Footer::kEncodedLength ||
+        !footer_.DecodeFrom(data_ + file_size_ - Footer::kEncodedLength)) {
+        return false;
+    }
 
-bool SSTable::BinarySearch(const std::string& key, SSTableEntry& entry) {
-    int left = 0, right = index_.size() - 1;
-    
-    while (left <= right) {
-        int mid = left + (right - left) / 2;
-        
-        if (index_[mid].key == key) {
-            file_.seekg(index_[mid].offset);
-            // Read entry
-            return true;
+    std::string scratch;
+    std::string_view contents;
+    if (!ReadBlock(footer_.properties_handle, scratch, contents) ||
+        !properties_.Decode(contents)) {
+        return false;
+    }
+
+    if (!ReadBlock(footer_.metaindex_handle, scratch, contents)) {
+        return false;
+    }
+    Block metaindex(contents);
+    auto meta_iter = metaindex.NewIterator();
+    meta_iter.Seek(kDictionaryBlockName);
+    if (meta_iter.Valid() && meta_iter.key() == kDictionaryBlockName) {
+        BlockHandle dict_handle;
+        std::string_view input = meta_iter.value();
+        std::string unused;
+        if (!dict_handle.DecodeFrom(input) ||
+            !ReadBlock(dict_handle, unused, dictionary_) || !unused.empty()) {
+            return false;
         }
-        
-        if (index_[mid].key < key) {
-            left = mid + 1;
-        } else {
-            right = mid - 1;
+    }
+
+    meta_iter.Seek(kPrefixFilterBlockName);
+    if (meta_iter.Valid() && meta_iter.key() == kPrefixFilterBlockName) {
+        std::string_view input = meta_iter.value();
+        if (!prefix_filter_handle_.DecodeFrom(input)) {
+            return false;
         }
     }
-    
-    return false;
-}
-
-bool SSTable::WriteHeader(std::ofstream& out, size_t num_entries,
-                         bool compression, bool bloom_filter) {
-    uint32_t magic = 0x53535401; // SST1
-    out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
-    out.write(reinterpret_cast<const char*>(&num_entries), sizeof(num_entries));
-    
-    uint8_t flags = 0;
-    if (compression) flags |= 0x01;
-    if (bloom_filter) flags |= 0x02;
-    out.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
-    
+
+    // The index is searched in place rather than parsed, so opening a table
+    // costs the same no matter how much data it holds
+    if (!ReadBlock(footer_.index_handle, scratch, contents)) {
+        return false;
+    }
+    if (scratch.empty()) {
+        index_block_ = std::make_unique<Block>(contents);
+    } else {
+        index_block_ = std::make_unique<Block>(std::move(scratch));
+    }
     return true;
 }
 
-bool SSTable::WriteIndex(std::ofstream& out,
-                        const std::vector<SSTableIndex>& index) {
-    uint32_t index_size = index.size();
-    out.write(reinterpret_cast<const char*>(&index_size), sizeof(index_size));
-    
-    for (const auto& idx : index) {
-        uint32_t key_len = idx.key.size();
-        out.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-        out.write(idx.key.c_str(), key_len);
-        out.write(reinterpret_cast<const char*>(&idx.offset), sizeof(idx.offset));
-        out.write(reinterpret_cast<const char*>(&idx.size), sizeof(idx.size));
+FilterType SSTable::GetFilterType() const {
+    if (footer_.filter_handle.size == 0 ||
+        footer_.filter_handle.offset > file_size_ ||
+        footer_.filter_handle.size > file_size_ - footer_.filter_handle.offset) {
+        return FilterType::kNone;
+    }
+    // The type is the last byte of the block contents
+    return static_cast<FilterType>(
+        data_[footer_.filter_handle.offset + footer_.filter_handle.size - 1]);
+}
+
+bool SSTable::MayContainPrefix(const PrefixExtractor& extractor,
+                               std::string_view prefix) const {
+    if (!index_block_ || properties_.num_entries == 0) {
+        return false;
+    }
+    if (prefix_filter_handle_.size == 0 ||
+        properties_.prefix_extractor != extractor.Name()) {
+        return true;
+    }
+    std::call_once(prefix_filter_once_, &SSTable::LoadPrefixFilter, this);
+    return !prefix_filter_ || prefix_filter_->MayContain(prefix);
+}
+
+size_t SSTable::GetFilterMemoryUsage() const {
+    size_t usage = 0;
+    if (filter_loaded_.load(std::memory_order_acquire) && filter_) {
+        usage += filter_->MemoryUsage();
+    }
+    if (prefix_filter_loaded_.load(std::memory_order_acquire) && prefix_filter_) {
+        usage += prefix_filter_->MemoryUsage();
+    }
+    return usage;
+}
+
+void SSTable::LoadFilter() const {
+    // A missing or unreadable filter only costs extra block reads
+    std::string scratch;
+    std::string_view contents;
+    if (footer_.filter_handle.size > 0 &&
+        ReadBlock(footer_.filter_handle, scratch, contents)) {
+        filter_ = ParseFilterBlock(contents);
+    }
+    filter_loaded_.store(true, std::memory_order_release);
+}
+
+void SSTable::LoadPrefixFilter() const {
+    std::string scratch;
+    std::string_view contents;
+    if (ReadBlock(prefix_filter_handle_, scratch, contents)) {
+        prefix_filter_ = ParseFilterBlock(contents);
+    }
+    prefix_filter_loaded_.store(true, std::memory_order_release);
+}
+
+bool SSTable::ReadBlock(const BlockHandle& handle, std::string& scratch,
+                        std::string_view& contents,
+                        std::string_view dictionary) const {
+    // Handles come from the file, so a corrupt size must not wrap around
+    if (handle.offset > file_size_ ||
+        file_size_ - handle.offset < kBlockTrailerSize ||
+        handle.size > file_size_ - handle.offset - kBlockTrailerSize) {
+        return false;
+    }
+    std::string_view stored(data_ + handle.offset, handle.size);
+    auto type = static_cast<CompressionType>(data_[handle.offset + handle.size]);
+    if (type == CompressionType::kNone) {
+        contents = stored;
+        return true;
     }
-    
+    if (!DecompressBlock(type, stored, scratch, dictionary)) {
+        return false;
+    }
+    contents = scratch;
     return true;
 }
 
-bool SSTable::WriteData(std::ofstream& out,
-                       const std::vector<SSTableEntry>& entries,
-                       bool compression) {
-    // Already written in Create method
+bool SSTable::BinarySearch(const std::string& key, std::string& value,
+                           bool& is_deleted) const {
+    // Sparse index: find the first block whose separator is >= key
+    auto index_iter = index_block_->NewIterator();
+    index_iter.Seek(key);
+    if (!index_iter.Valid()) {
+        return false;
+    }
+
+    BlockHandle handle;
+    std::string_view input = index_iter.value();
+    std::string scratch;
+    std::string_view contents;
+    if (!handle.DecodeFrom(input) ||
+        !ReadBlock(handle, scratch, contents, dictionary_)) {
+        return false;
+    }
+
+    // Binary search over restart points, then scan within the interval
+    Block block(contents);
+    auto iter = block.NewIterator();
+    iter.Seek(key);
+    if (!iter.Valid() || iter.key() != key) {
+        return false;
+    }
+
+    // Decode straight from the mapped block into the caller's string
+    std::string_view encoded = iter.value();
+    uint8_t flags;
+    uint64_t sequence;
+    uint64_t timestamp;
+    if (!DecodeEntryValue(footer_.format_version, encoded, flags, sequence,
+                          timestamp)) {
+        return false;
+    }
+    is_deleted = (flags & kEntryDeleted) != 0;
+    if (!is_deleted) {
+        value.assign(encoded.data(), encoded.size());
+    }
     return true;
 }
 
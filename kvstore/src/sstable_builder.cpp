@@ -0,0 +1,330 @@
+#include "sstable_builder.h"
+#include "filter.h"
+#include "hash.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kvstore {
+
+namespace {
+
+// Dictionary samples are collected until the held-back values reach this
+// multiple of the dictionary size
+constexpr uint64_t kDictSampleFactor = 64;
+
+void EncodeEntryValue(bool is_deleted, uint64_t sequence, uint64_t timestamp,
+                      std::string_view value, std::string& dst) {
+    dst.push_back(static_cast<char>(is_deleted ? kEntryDeleted : 0));
+    PutVarint64(dst, sequence);
+    PutVarint64(dst, timestamp);
+    dst.append(value);
+}
+
+// Returns a short key k with start <= k < limit, so the index stores as few
+// bytes per block as possible
+std::string_view ShortestSeparator(std::string_view start, std::string_view limit,
+                                   std::string& scratch) {
+    size_t min_len = std::min(start.size(), limit.size());
+    size_t diff = 0;
+    while (diff < min_len && start[diff] == limit[diff]) {
+        ++diff;
+    }
+    if (diff < min_len) {
+        uint8_t byte = static_cast<uint8_t>(start[diff]);
+        if (byte < 0xff && byte + 1 < static_cast<uint8_t>(limit[diff])) {
+            scratch.assign(start.data(), diff + 1);
+            scratch[diff] = static_cast<char>(byte + 1);
+            return scratch;
+        }
+    }
+    return start;
+}
+
+} // namespace
+
+SSTableBuilder::SSTableBuilder(const std::string& filename,
+                               const SSTableOptions& options)
+    : filename_(filename), options_(options), fd_(-1), ok_(true),
+      closed_(false), offset_(0),
+      data_block_(options.block_restart_interval),
+      // Every index entry is its own restart point so lookups never decode
+      // more than one key
+      index_block_(1),
+      pending_index_entry_(false),
+      buffering_(options.compression != CompressionType::kNone &&
+                 options.max_dict_bytes > 0),
+      buffered_bytes_(0) {
+    props_.compression = options.compression;
+    props_.compression_level = options.compression_level;
+    if (options.prefix_extractor && options.filter_type != FilterType::kNone) {
+        props_.prefix_extractor = options.prefix_extractor->Name();
+    }
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        ok_ = false;
+        closed_ = true;
+    }
+    buffer_.reserve(kWriteBufferSize);
+}
+
+SSTableBuilder::~SSTableBuilder() {
+    if (!closed_) {
+        Abandon();
+    }
+}
+
+void SSTableBuilder::Add(const SSTableEntry& entry) {
+    Add(entry.key, entry.value, entry.is_deleted, entry.timestamp,
+        entry.sequence);
+}
+
+void SSTableBuilder::Add(std::string_view key, std::string_view value,
+                         bool is_deleted, uint64_t timestamp,
+                         uint64_t sequence) {
+    if (closed_) {
+        return;
+    }
+    if (buffering_) {
+        buffered_.push_back({std::string(key), std::string(value), is_deleted,
+                             timestamp, sequence});
+        buffered_bytes_ += key.size() + value.size();
+        if (buffered_bytes_ >= options_.max_dict_bytes * kDictSampleFactor) {
+            LeaveBufferedMode();
+        }
+        return;
+    }
+    AddToBlock(key, value, is_deleted, timestamp, sequence);
+}
+
+void SSTableBuilder::AddToBlock(std::string_view key, std::string_view value,
+                                bool is_deleted, uint64_t timestamp,
+                                uint64_t sequence) {
+    if (pending_index_entry_) {
+        encoded_.clear();
+        pending_handle_.EncodeTo(encoded_);
+        std::string scratch;
+        index_block_.Add(ShortestSeparator(last_key_, key, scratch), encoded_);
+        pending_index_entry_ = false;
+    }
+
+    if (props_.num_entries++ == 0) {
+        props_.smallest_key.assign(key.data(), key.size());
+        props_.min_timestamp = timestamp;
+        props_.max_timestamp = timestamp;
+    }
+    props_.min_timestamp = std::min(props_.min_timestamp, timestamp);
+    props_.max_timestamp = std::max(props_.max_timestamp, timestamp);
+    props_.largest_sequence = std::max(props_.largest_sequence, sequence);
+    if (is_deleted) {
+        ++props_.num_deletions;
+    }
+    if (options_.filter_type != FilterType::kNone) {
+        key_hashes_.push_back(Hash64(key));
+    }
+    if (!props_.prefix_extractor.empty() &&
+        options_.prefix_extractor->InDomain(key)) {
+        std::string_view prefix = options_.prefix_extractor->Transform(key);
+        if (prefix_hashes_.empty() || prefix != last_prefix_) {
+            prefix_hashes_.push_back(Hash64(prefix));
+            last_prefix_.assign(prefix.data(), prefix.size());
+        }
+    }
+
+    encoded_.clear();
+    EncodeEntryValue(is_deleted, sequence, timestamp, value, encoded_);
+    data_block_.Add(key, encoded_);
+    last_key_.assign(key.data(), key.size());
+
+    if (data_block_.CurrentSizeEstimate() >= options_.block_size) {
+        FlushDataBlock();
+    }
+}
+
+void SSTableBuilder::FlushDataBlock() {
+    if (data_block_.Empty()) {
+        return;
+    }
+    std::string_view contents = data_block_.Finish();
+    WriteBlock(contents, options_.compression, dictionary_.get(), pending_handle_);
+    props_.raw_data_size += contents.size();
+    props_.data_size += pending_handle_.size + kBlockTrailerSize;
+    ++props_.num_data_blocks;
+    data_block_.Reset();
+    pending_index_entry_ = true;
+}
+
+void SSTableBuilder::LeaveBufferedMode() {
+    buffering_ = false;
+
+    std::vector<std::string_view> samples;
+    for (const auto& entry : buffered_) {
+        if (!entry.is_deleted && !entry.value.empty()) {
+            samples.push_back(entry.value);
+        }
+    }
+    std::string dict_data = TrainDictionary(samples, options_.max_dict_bytes);
+    if (!dict_data.empty()) {
+        dictionary_ = std::make_unique<lz4::Dictionary>(
+            std::move(dict_data), options_.compression_level);
+    }
+
+    for (const auto& entry : buffered_) {
+        AddToBlock(entry.key, entry.value, entry.is_deleted, entry.timestamp,
+                   entry.sequence);
+    }
+    buffered_.clear();
+    buffered_.shrink_to_fit();
+    buffered_bytes_ = 0;
+}
+
+uint64_t SSTableBuilder::EstimatedFileSize() const {
+    return offset_ + buffered_bytes_ + data_block_.CurrentSizeEstimate();
+}
+
+bool SSTableBuilder::Finish() {
+    if (closed_) {
+        return false;
+    }
+    if (buffering_) {
+        LeaveBufferedMode();
+    }
+    FlushDataBlock();
+    if (pending_index_entry_) {
+        // The last block's index key is its exact last key, which is also
+        // the table's largest key
+        encoded_.clear();
+        pending_handle_.EncodeTo(encoded_);
+        index_block_.Add(last_key_, encoded_);
+        pending_index_entry_ = false;
+    }
+    props_.largest_key = last_key_;
+
+    // Meta blocks are written uncompressed so readers use them in place
+    BlockBuilder metaindex_block(1);
+    if (dictionary_) {
+        BlockHandle dict_handle;
+        WriteRawBlock(dictionary_->data(), dict_handle);
+        encoded_.clear();
+        dict_handle.EncodeTo(encoded_);
+        metaindex_block.Add(kDictionaryBlockName, encoded_);
+    }
+
+    if (!props_.prefix_extractor.empty()) {
+        BlockHandle prefix_handle;
+        WriteRawBlock(BuildFilterBlock(options_.filter_type,
+                                       std::move(prefix_hashes_)),
+                      prefix_handle);
+        encoded_.clear();
+        prefix_handle.EncodeTo(encoded_);
+        metaindex_block.Add(kPrefixFilterBlockName, encoded_);
+    }
+
+    Footer footer;
+    if (options_.filter_type != FilterType::kNone) {
+        WriteRawBlock(BuildFilterBlock(options_.filter_type, std::move(key_hashes_)),
+                      footer.filter_handle);
+    }
+
+    WriteRawBlock(props_.Encode(), footer.properties_handle);
+    WriteRawBlock(metaindex_block.Finish(), footer.metaindex_handle);
+    WriteRawBlock(index_block_.Finish(), footer.index_handle);
+
+    // Fixed-size footer so readers can find everything from the end of file
+    encoded_.clear();
+    footer.EncodeTo(encoded_);
+    Append(encoded_);
+
+    FlushBuffer();
+    if (ok_ && ::fdatasync(fd_) != 0) {
+        ok_ = false;
+    }
+    Close();
+    if (!ok_) {
+        ::unlink(filename_.c_str());
+    }
+    return ok_;
+}
+
+void SSTableBuilder::Abandon() {
+    if (closed_) {
+        return;
+    }
+    Close();
+    ::unlink(filename_.c_str());
+}
+
+void SSTableBuilder::WriteBlock(std::string_view raw, CompressionType compression,
+                                const lz4::Dictionary* dictionary,
+                                BlockHandle& handle) {
+    std::string_view stored = raw;
+    CompressionType type = CompressionType::kNone;
+    if (compression != CompressionType::kNone) {
+        CompressBlock(compression, options_.compression_level, raw,
+                      compressed_, dictionary);
+        // Keep the block raw unless compression saves at least 12.5%
+        if (compressed_.size() < raw.size() - raw.size() / 8) {
+            stored = compressed_;
+            type = compression;
+        }
+    }
+
+    handle.offset = offset_;
+    handle.size = stored.size();
+    Append(stored);
+    char trailer = static_cast<char>(type);
+    Append(std::string_view(&trailer, kBlockTrailerSize));
+}
+
+void SSTableBuilder::WriteRawBlock(std::string_view raw, BlockHandle& handle) {
+    WriteBlock(raw, CompressionType::kNone, nullptr, handle);
+}
+
+void SSTableBuilder::Append(std::string_view data) {
+    offset_ += data.size();
+    if (buffer_.size() + data.size() > kWriteBufferSize) {
+        FlushBuffer();
+    }
+    if (data.size() >= kWriteBufferSize) {
+        // Too big to be worth copying; write it straight through
+        WriteFully(data);
+        return;
+    }
+    buffer_.append(data.data(), data.size());
+}
+
+void SSTableBuilder::FlushBuffer() {
+    WriteFully(buffer_);
+    buffer_.clear();
+}
+
+void SSTableBuilder::WriteFully(std::string_view data) {
+    if (ok_ && options_.rate_limiter) {
+        options_.rate_limiter->Request(data.size(), options_.io_priority);
+    }
+    while (ok_ && !data.empty()) {
+        ssize_t written = ::write(fd_, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok_ = false;
+            break;
+        }
+        data.remove_prefix(written);
+    }
+}
+
+void SSTableBuilder::Close() {
+    if (fd_ >= 0) {
+        if (::close(fd_) != 0) {
+            ok_ = false;
+        }
+        fd_ = -1;
+    }
+    closed_ = true;
+}
+
+} // namespace kvstore
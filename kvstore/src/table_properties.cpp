@@ -0,0 +1,106 @@
+#include "table_properties.h"
+#include "block.h"
+#include "format.h"
+#include <map>
+
+namespace kvstore {
+
+namespace {
+
+const char kCompression[] = "kvstore.compression";
+const char kCompressionLevel[] = "kvstore.compression.level";
+const char kDataSize[] = "kvstore.data.size";
+const char kFileOrder[] = "kvstore.file.order";
+const char kLargestKey[] = "kvstore.key.largest";
+const char kSmallestKey[] = "kvstore.key.smallest";
+const char kNumDataBlocks[] = "kvstore.num.data.blocks";
+const char kNumDeletions[] = "kvstore.num.deletions";
+const char kNumEntries[] = "kvstore.num.entries";
+const char kRawDataSize[] = "kvstore.raw.data.size";
+const char kMaxTimestamp[] = "kvstore.timestamp.max";
+const char kMinTimestamp[] = "kvstore.timestamp.min";
+const char kPrefixExtractor[] = "kvstore.prefix.extractor";
+const char kLargestSequence[] = "kvstore.sequence.largest";
+
+std::string EncodeNumber(uint64_t value) {
+    std::string encoded;
+    PutVarint64(encoded, value);
+    return encoded;
+}
+
+} // namespace
+
+std::string TableProperties::Encode() const {
+    // BlockBuilder needs sorted keys
+    std::map<std::string, std::string> props;
+    props[kCompression] = EncodeNumber(static_cast<uint8_t>(compression));
+    props[kCompressionLevel] = EncodeNumber(compression_level);
+    props[kDataSize] = EncodeNumber(data_size);
+    props[kFileOrder] = EncodeNumber(file_order);
+    props[kLargestKey] = largest_key;
+    props[kSmallestKey] = smallest_key;
+    props[kNumDataBlocks] = EncodeNumber(num_data_blocks);
+    props[kNumDeletions] = EncodeNumber(num_deletions);
+    props[kNumEntries] = EncodeNumber(num_entries);
+    props[kRawDataSize] = EncodeNumber(raw_data_size);
+    props[kMaxTimestamp] = EncodeNumber(max_timestamp);
+    props[kMinTimestamp] = EncodeNumber(min_timestamp);
+    props[kPrefixExtractor] = prefix_extractor;
+    props[kLargestSequence] = EncodeNumber(largest_sequence);
+
+    BlockBuilder builder(1);
+    for (const auto& [name, value] : props) {
+        builder.Add(name, value);
+    }
+    return std::string(builder.Finish());
+}
+
+bool TableProperties::Decode(std::string_view contents) {
+    std::map<std::string_view, uint64_t*> numbers = {
+        {kDataSize, &data_size},
+        {kFileOrder, &file_order},
+        {kNumDataBlocks, &num_data_blocks},
+        {kNumDeletions, &num_deletions},
+        {kNumEntries, &num_entries},
+        {kRawDataSize, &raw_data_size},
+        {kMaxTimestamp, &max_timestamp},
+        {kMinTimestamp, &min_timestamp},
+        {kLargestSequence, &largest_sequence},
+    };
+    uint64_t codec = static_cast<uint8_t>(compression);
+    uint64_t level = compression_level;
+    numbers[kCompression] = &codec;
+    numbers[kCompressionLevel] = &level;
+
+    Block block(contents);
+    auto iter = block.NewIterator();
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+        std::string_view value = iter.value();
+        if (iter.key() == kSmallestKey) {
+            smallest_key.assign(value.data(), value.size());
+        } else if (iter.key() == kLargestKey) {
+            largest_key.assign(value.data(), value.size());
+        } else if (iter.key() == kPrefixExtractor) {
+            prefix_extractor.assign(value.data(), value.size());
+        } else {
+            auto it = numbers.find(iter.key());
+            if (it != numbers.end() && !GetVarint64(value, *it->second)) {
+                return false;
+            }
+        }
+    }
+    compression = static_cast<CompressionType>(codec);
+    compression_level = static_cast<int>(level);
+    return !iter.Corrupted();
+}
+
+bool TableProperties::OverlapsKeyRange(std::string_view start,
+                                       std::string_view end) const {
+    return num_entries > 0 && start <= largest_key && end >= smallest_key;
+}
+
+bool TableProperties::OverlapsTimeRange(uint64_t min_ts, uint64_t max_ts) const {
+    return num_entries > 0 && min_ts <= max_timestamp && max_ts >= min_timestamp;
+}
+
+} // namespace kvstore
@@ -0,0 +1,195 @@
+#include "version.h"
+#include "format.h"
+#include <algorithm>
+#include <filesystem>
+
+namespace kvstore {
+
+namespace {
+
+enum EditTag : uint32_t {
+    kNextFileNumber = 1,
+    kDeletedFile = 2,
+    kNewFile = 3,
+};
+
+bool GetLevel(std::string_view& input, int& level) {
+    uint32_t value;
+    if (!GetVarint32(input, value) || value >= kNumLevels) {
+        return false;
+    }
+    level = static_cast<int>(value);
+    return true;
+}
+
+} // namespace
+
+bool ParseTableNumber(const std::string& path, uint64_t& number) {
+    std::filesystem::path file(path);
+    std::string stem = file.stem().string();
+    if (file.extension() != ".sst" || stem.empty() || stem.size() > 19 ||
+        stem.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    number = std::stoull(stem);
+    return true;
+}
+
+void VersionEdit::AddFile(int level, uint64_t number,
+                          std::shared_ptr<SSTable> table) {
+    new_files.emplace_back(level, number);
+    new_tables.push_back(std::move(table));
+}
+
+void VersionEdit::DeleteFile(int level, uint64_t number) {
+    deleted_files.emplace_back(level, number);
+}
+
+std::string VersionEdit::Encode() const {
+    std::string encoded;
+    if (next_file_number > 0) {
+        PutVarint32(encoded, kNextFileNumber);
+        PutVarint64(encoded, next_file_number);
+    }
+    for (const auto& [level, number] : deleted_files) {
+        PutVarint32(encoded, kDeletedFile);
+        PutVarint32(encoded, level);
+        PutVarint64(encoded, number);
+    }
+    for (const auto& [level, number] : new_files) {
+        PutVarint32(encoded, kNewFile);
+        PutVarint32(encoded, level);
+        PutVarint64(encoded, number);
+    }
+    return encoded;
+}
+
+bool VersionEdit::Decode(std::string_view encoded) {
+    *this = VersionEdit();
+    uint32_t tag;
+    while (!encoded.empty()) {
+        int level;
+        uint64_t number;
+        if (!GetVarint32(encoded, tag)) {
+            return false;
+        }
+        switch (tag) {
+        case kNextFileNumber:
+            if (!GetVarint64(encoded, next_file_number)) {
+                return false;
+            }
+            break;
+        case kDeletedFile:
+        case kNewFile:
+            if (!GetLevel(encoded, level) || !GetVarint64(encoded, number)) {
+                return false;
+            }
+            (tag == kNewFile ? new_files : deleted_files).emplace_back(level, number);
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+Version::Version() : levels_(kNumLevels) {}
+
+Version::Version(std::vector<SSTableList> levels) : levels_(std::move(levels)) {
+    levels_.resize(kNumLevels);
+    SortLevels();
+}
+
+void Version::SortLevels() {
+    // Level 0 goes by file order, falling back to the table number for
+    // tables that share one
+    auto number = [](const std::shared_ptr<SSTable>& table) {
+        uint64_t n = 0;
+        ParseTableNumber(table->GetFilename(), n);
+        return n;
+    };
+    std::sort(levels_[0].begin(), levels_[0].end(),
+              [&number](const auto& a, const auto& b) {
+                  uint64_t order_a = a->GetProperties().file_order;
+                  uint64_t order_b = b->GetProperties().file_order;
+                  return order_a != order_b ? order_a < order_b
+                                            : number(a) < number(b);
+              });
+    for (int level = 1; level < kNumLevels; ++level) {
+        std::sort(levels_[level].begin(), levels_[level].end(),
+                  [](const auto& a, const auto& b) {
+                      return a->GetProperties().smallest_key <
+                             b->GetProperties().smallest_key;
+                  });
+    }
+
+    tables_.clear();
+    for (int level = kNumLevels - 1; level >= 0; --level) {
+        tables_.insert(tables_.end(), levels_[level].begin(), levels_[level].end());
+    }
+}
+
+std::shared_ptr<const Version> Version::Apply(const VersionEdit& edit) const {
+    std::vector<SSTableList> levels = levels_;
+    for (const auto& [level, number] : edit.deleted_files) {
+        auto& tables = levels[level];
+        tables.erase(std::remove_if(tables.begin(), tables.end(),
+                                    [number = number](const auto& table) {
+                                        uint64_t n;
+                                        return ParseTableNumber(table->GetFilename(), n) &&
+                                               n == number;
+                                    }),
+                     tables.end());
+    }
+    for (size_t i = 0; i < edit.new_files.size() && i < edit.new_tables.size(); ++i) {
+        levels[edit.new_files[i].first].push_back(edit.new_tables[i]);
+    }
+    return std::make_shared<const Version>(std::move(levels));
+}
+
+uint64_t Version::LevelBytes(int level) const {
+    uint64_t bytes = 0;
+    for (const auto& table : levels_[level]) {
+        bytes += table->GetSize();
+    }
+    return bytes;
+}
+
+const SSTable* Version::FindTable(int level, std::string_view key) const {
+    // First table whose largest key is >= key; the one before it ends
+    // below the key
+    const SSTableList& tables = levels_[level];
+    auto it = std::lower_bound(tables.begin(), tables.end(), key,
+                               [](const auto& table, std::string_view k) {
+                                   return table->GetProperties().largest_key < k;
+                               });
+    if (it == tables.end() || !(*it)->GetProperties().OverlapsKeyRange(key, key)) {
+        return nullptr;
+    }
+    return it->get();
+}
+
+SSTableList Version::OverlappingTables(int level, std::string_view start,
+                                       std::string_view end) const {
+    SSTableList overlapping;
+    for (const auto& table : levels_[level]) {
+        if (table->GetProperties().OverlapsKeyRange(start, end)) {
+            overlapping.push_back(table);
+        }
+    }
+    return overlapping;
+}
+
+bool Version::OverlapInLevelsBelow(int level, std::string_view start,
+                                   std::string_view end) const {
+    for (int deeper = level + 1; deeper < kNumLevels; ++deeper) {
+        for (const auto& table : levels_[deeper]) {
+            if (table->GetProperties().OverlapsKeyRange(start, end)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace kvstore
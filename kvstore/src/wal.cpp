@@ -1,130 +1,402 @@
 #include "wal.h"
+#include "crc32c.h"
+#include "format.h"
+#include "write_batch.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace kvstore {
 
-WAL::WAL(const std::string& filename)
-    : filename_(filename), current_size_(0) {
-    file_.open(filename, std::ios::app | std::ios::binary);
+bool SyncDirectory(const std::string& dirname) {
+    int fd = ::open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+WAL::WAL(const std::string& filename, const WALOptions& options)
+    : filename_(filename), options_(options), fd_(-1), current_size_(0),
+      offset_(0), block_offset_(0), failed_(false) {
+    // Not O_APPEND: a reused file is overwritten from the start
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        return;
+    }
+    struct stat st;
+    if (!options_.reuse && ::fstat(fd_, &st) == 0) {
+        offset_ = st.st_size;
+        block_offset_ = offset_ % kBlockSize;
+        current_size_ = offset_;
+    }
+#ifdef FALLOC_FL_KEEP_SIZE
+    // Best effort; KEEP_SIZE leaves the file size at the data written, so
+    // reopening for append still finds the end
+    if (options_.preallocate_size > 0) {
+        ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, options_.preallocate_size);
+    }
+#endif
 }
 
 WAL::~WAL() {
-    if (file_.is_open()) {
-        Sync();
-        file_.close();
+    if (fd_ >= 0) {
+        ::close(fd_);
     }
 }
 
 bool WAL::Append(WALRecordType type, const std::string& key,
-                const std::string& value) {
+                const std::string& value, uint64_t sequence) {
+    WriteBatch batch;
+    if (type == WALRecordType::PUT) {
+        batch.Put(key, value);
+    } else {
+        batch.Delete(key);
+    }
+    batch.SetSequence(sequence);
+    batch.SetTimestamp(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    return AddRecord(batch.Data());
+}
+
+bool WAL::AddRecord(std::string_view encoded) {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || failed_) {
+        return false;
+    }
     
-    WALRecord record;
-    record.type = type;
-    record.key = key;
-    record.value = value;
-    record.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
-    record.checksum = ComputeChecksum(record);
+    bool recyclable = options_.log_number != 0;
+    size_t header_size = recyclable ? kRecyclableHeaderSize : kHeaderSize;
+    // The fragment types are consecutive in both variants
+    uint8_t base_type = static_cast<uint8_t>(
+        recyclable ? WALFragmentType::kRecyclableFull : WALFragmentType::kFull);
+    std::string trailer;
+    if (recyclable) {
+        PutFixed32(trailer, static_cast<uint32_t>(options_.log_number));
+    }
     
-    return WriteRecord(record);
+    // Frame the whole record first so it goes out in one write
+    buffer_.clear();
+    bool begin = true;
+    bool end = false;
+    while (!end) {
+        size_t leftover = kBlockSize - block_offset_;
+        if (leftover < header_size) {
+            buffer_.append(leftover, '\0');
+            block_offset_ = 0;
+        }
+        
+        size_t available = kBlockSize - block_offset_ - header_size;
+        size_t length = std::min(encoded.size(), available);
+        end = length == encoded.size();
+        uint8_t type = base_type + (begin && end ? 0 : begin ? 1 : end ? 3 : 2);
+        
+        char type_byte = static_cast<char>(type);
+        uint32_t crc = crc32c::Value(&type_byte, 1);
+        crc = crc32c::Extend(crc, trailer.data(), trailer.size());
+        crc = crc32c::Extend(crc, encoded.data(), length);
+        PutFixed32(buffer_, crc32c::Mask(crc));
+        buffer_.push_back(static_cast<char>(length & 0xff));
+        buffer_.push_back(static_cast<char>(length >> 8));
+        buffer_.push_back(type_byte);
+        buffer_.append(trailer);
+        buffer_.append(encoded.data(), length);
+        
+        encoded.remove_prefix(length);
+        block_offset_ += header_size + length;
+        begin = false;
+    }
+    
+    if (!WriteFully(buffer_)) {
+        failed_ = true;
+        return false;
+    }
+    offset_ += buffer_.size();
+    current_size_ = offset_;
+    return true;
+}
+
+bool WAL::WriteFully(std::string_view data) {
+    uint64_t offset = offset_;
+    while (!data.empty()) {
+        ssize_t written = ::pwrite(fd_, data.data(), data.size(), offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(written);
+        offset += written;
+    }
+    return true;
 }
 
 bool WAL::Sync() {
-    if (file_.is_open()) {
-        file_.flush();
-        return true;
+    if (fd_ < 0 || failed_) {
+        return false;
     }
-    return false;
+    if (::fdatasync(fd_) != 0) {
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool WAL::DecodeRecords(std::string_view encoded, std::vector<WALRecord>& records) {
+    struct Collector : WriteBatch::Handler {
+        std::vector<WALRecord>* records;
+        
+        void Add(WALRecordType type, std::string_view key, std::string_view value,
+                 uint64_t sequence, uint64_t timestamp) {
+            WALRecord record;
+            record.type = type;
+            record.key.assign(key);
+            record.value.assign(value);
+            record.timestamp = timestamp;
+            record.sequence = sequence;
+            records->push_back(std::move(record));
+        }
+        void Put(std::string_view key, std::string_view value,
+                 uint64_t sequence, uint64_t timestamp) override {
+            Add(WALRecordType::PUT, key, value, sequence, timestamp);
+        }
+        void Delete(std::string_view key, uint64_t sequence,
+                    uint64_t timestamp) override {
+            Add(WALRecordType::DELETE, key, std::string_view(), sequence, timestamp);
+        }
+    };
+    
+    WriteBatch batch;
+    if (!batch.SetData(encoded)) {
+        return false;
+    }
+    // All of the batch or none of it
+    std::vector<WALRecord> decoded;
+    Collector collector;
+    collector.records = &decoded;
+    if (!batch.Iterate(collector)) {
+        return false;
+    }
+    records.insert(records.end(), std::make_move_iterator(decoded.begin()),
+                   std::make_move_iterator(decoded.end()));
+    return true;
 }
 
 std::vector<WALRecord> WAL::ReadAll() {
     std::vector<WALRecord> records;
-    std::ifstream in(filename_, std::ios::binary);
-    
-    if (!in.is_open()) {
-        return records;
+    WALReader reader(filename_, options_.log_number);
+    std::string_view record;
+    std::string scratch;
+    while (reader.ReadRecord(record, scratch)) {
+        // The CRC matched, so a record that does not parse was written
+        // wrong; nothing after it can be trusted either
+        if (!DecodeRecords(record, records)) {
+            break;
+        }
     }
+    return records;
+}
+
+std::vector<WALRecord> WAL::ReadLegacyFile(const std::string& filename) {
+    // type (1 byte) | key_len (u32) | key | value_len (u32) | value |
+    // timestamp (u64) | checksum (u32), all native-endian, the checksum a
+    // byte sum. Lengths are checked against the file, so a torn tail ends
+    // the log instead of driving a huge allocation.
+    std::vector<WALRecord> records;
+    std::ifstream in(filename, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+    std::string_view input = contents;
     
-    WALRecord record;
-    while (ReadRecord(in, record)) {
-        if (VerifyChecksum(record)) {
-            records.push_back(record);
+    auto take = [&input](void* dst, size_t n) {
+        if (input.size() < n) {
+            return false;
         }
-    }
+        std::memcpy(dst, input.data(), n);
+        input.remove_prefix(n);
+        return true;
+    };
+    auto take_string = [&](std::string& dst) {
+        uint32_t length;
+        if (!take(&length, sizeof(length)) || input.size() < length) {
+            return false;
+        }
+        dst.assign(input.data(), length);
+        input.remove_prefix(length);
+        return true;
+    };
     
+    while (!input.empty()) {
+        WALRecord record;
+        uint8_t type;
+        uint32_t checksum;
+        if (!take(&type, sizeof(type)) || !take_string(record.key) ||
+            !take_string(record.value) ||
+            !take(&record.timestamp, sizeof(record.timestamp)) ||
+            !take(&checksum, sizeof(checksum))) {
+            break;
+        }
+        record.type = static_cast<WALRecordType>(type);
+        record.sequence = 0;
+        
+        uint32_t expected = 0;
+        for (char c : record.key) expected += c;
+        for (char c : record.value) expected += c;
+        expected += type;
+        expected += record.timestamp;
+        if (checksum == expected) {
+            records.push_back(std::move(record));
+        }
+    }
     return records;
 }
 
 void WAL::Clear() {
     std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (file_.is_open()) {
-        file_.close();
+    if (fd_ >= 0 && ::ftruncate(fd_, 0) == 0) {
+        current_size_ = 0;
+        offset_ = 0;
+        block_offset_ = 0;
+        failed_ = false;
     }
-    
-    file_.open(filename_, std::ios::trunc | std::ios::binary);
-    current_size_ = 0;
 }
 
-uint32_t WAL::ComputeChecksum(const WALRecord& record) const {
-    uint32_t checksum = 0;
-    for (char c : record.key) checksum += c;
-    for (char c : record.value) checksum += c;
-    checksum += static_cast<uint32_t>(record.type);
-    checksum += record.timestamp;
-    return checksum;
+WALReader::WALReader(const std::string& filename, uint64_t log_number)
+    : fd_(::open(filename.c_str(), O_RDONLY | O_CLOEXEC)),
+      log_number_(log_number), eof_(false), corrupted_(false),
+      recyclable_(false) {
+    block_.resize(WAL::kBlockSize);
 }
 
-bool WAL::VerifyChecksum(const WALRecord& record) const {
-    return record.checksum == ComputeChecksum(record);
+WALReader::~WALReader() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
 }
 
-bool WAL::WriteRecord(const WALRecord& record) {
-    uint8_t type = static_cast<uint8_t>(record.type);
-    file_.write(reinterpret_cast<const char*>(&type), sizeof(type));
-    
-    uint32_t key_len = record.key.size();
-    file_.write(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
-    file_.write(record.key.c_str(), key_len);
-    
-    uint32_t value_len = record.value.size();
-    file_.write(reinterpret_cast<const char*>(&value_len), sizeof(value_len));
-    file_.write(record.value.c_str(), value_len);
-    
-    file_.write(reinterpret_cast<const char*>(&record.timestamp), 
-                sizeof(record.timestamp));
-    file_.write(reinterpret_cast<const char*>(&record.checksum), 
-                sizeof(record.checksum));
-    
-    current_size_ += sizeof(type) + sizeof(key_len) + key_len +
-                     sizeof(value_len) + value_len + sizeof(record.timestamp) +
-                     sizeof(record.checksum);
-    
-    return file_.good();
+bool WALReader::ReadBlock() {
+    size_t filled = 0;
+    while (filled < WAL::kBlockSize) {
+        ssize_t n = ::read(fd_, &block_[filled], WAL::kBlockSize - filled);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // A read error ends the log like the end of the file does
+            eof_ = true;
+            break;
+        }
+        filled += n;
+    }
+    remaining_ = std::string_view(block_.data(), filled);
+    return filled > 0;
 }
 
-bool WAL::ReadRecord(std::ifstream& in, WALRecord& record) {
-    uint8_t type;
-    if (!in.read(reinterpret_cast<char*>(&type), sizeof(type))) {
+bool WALReader::ReadFragment(WALFragmentType& type, std::string_view& fragment) {
+    while (true) {
+        // Anything short of a header at the end of a block is padding
+        while (remaining_.size() < WAL::kHeaderSize) {
+            if (fd_ < 0 || eof_ || !ReadBlock()) {
+                return false;
+            }
+        }
+        
+        const char* header = remaining_.data();
+        size_t length = static_cast<uint8_t>(header[4]) |
+                        (static_cast<size_t>(static_cast<uint8_t>(header[5])) << 8);
+        uint8_t raw_type = static_cast<uint8_t>(header[6]);
+        if (raw_type == 0 && length == 0) {
+            // Padding too long to tell from a header
+            remaining_ = std::string_view();
+            continue;
+        }
+        
+        bool recyclable = raw_type >= static_cast<uint8_t>(WALFragmentType::kRecyclableFull);
+        size_t header_size = recyclable ? WAL::kRecyclableHeaderSize : WAL::kHeaderSize;
+        // In a recyclable log, bytes that do not check out past the last
+        // good fragment are most likely the file's previous contents, so
+        // they end the log without counting as corruption
+        if (header_size + length > remaining_.size()) {
+            // Past the end of a short last block the write was torn; inside
+            // a full block the length itself is wrong
+            corrupted_ = !eof_ && !recyclable_;
+            return false;
+        }
+        
+        uint32_t expected = crc32c::Unmask(DecodeFixed32(header));
+        uint32_t actual = crc32c::Value(header + 6, header_size - 6 + length);
+        if (actual != expected) {
+            corrupted_ = !recyclable_;
+            return false;
+        }
+        if (recyclable) {
+            if (log_number_ != 0 &&
+                DecodeFixed32(header + WAL::kHeaderSize) != static_cast<uint32_t>(log_number_)) {
+                return false;
+            }
+            recyclable_ = true;
+            raw_type -= static_cast<uint8_t>(WALFragmentType::kRecyclableFull) -
+                        static_cast<uint8_t>(WALFragmentType::kFull);
+        } else if (recyclable_) {
+            return false;
+        }
+        
+        type = static_cast<WALFragmentType>(raw_type);
+        fragment = remaining_.substr(header_size, length);
+        remaining_.remove_prefix(header_size + length);
+        return true;
+    }
+}
+
+bool WALReader::ReadRecord(std::string_view& record, std::string& scratch) {
+    scratch.clear();
+    bool in_record = false;
+    WALFragmentType type;
+    std::string_view fragment;
+    while (ReadFragment(type, fragment)) {
+        switch (type) {
+        case WALFragmentType::kFull:
+            if (in_record) {
+                break;
+            }
+            record = fragment;
+            return true;
+        case WALFragmentType::kFirst:
+            if (in_record) {
+                break;
+            }
+            scratch.assign(fragment);
+            in_record = true;
+            continue;
+        case WALFragmentType::kMiddle:
+            if (!in_record) {
+                break;
+            }
+            scratch.append(fragment);
+            continue;
+        case WALFragmentType::kLast:
+            if (!in_record) {
+                break;
+            }
+            scratch.append(fragment);
+            record = scratch;
+            return true;
+        default:
+            break;
+        }
+        // Fragments out of order: the log was damaged here
+        corrupted_ = true;
         return false;
     }
-    record.type = static_cast<WALRecordType>(type);
-    
-    uint32_t key_len;
-    in.read(reinterpret_cast<char*>(&key_len), sizeof(key_len));
-    record.key.resize(key_len);
-    in.read(&record.key[0], key_len);
-    
-    uint32_t value_len;
-    in.read(reinterpret_cast<char*>(&value_len), sizeof(value_len));
-    record.value.resize(value_len);
-    in.read(&record.value[0], value_len);
-    
-    in.read(reinterpret_cast<char*>(&record.timestamp), sizeof(record.timestamp));
-    in.read(reinterpret_cast<char*>(&record.checksum), sizeof(record.checksum));
-    
-    return in.good();
+    return false;
 }
 
 } // namespace kvstore
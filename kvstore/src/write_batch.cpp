@@ -0,0 +1,95 @@
+#include "write_batch.h"
+#include "format.h"
+#include "wal.h"
+
+namespace kvstore {
+
+WriteBatch::WriteBatch() {
+    Clear();
+}
+
+void WriteBatch::Put(std::string_view key, std::string_view value) {
+    SetCount(Count() + 1);
+    rep_.push_back(static_cast<char>(WALRecordType::PUT));
+    PutLengthPrefixed(rep_, key);
+    PutLengthPrefixed(rep_, value);
+}
+
+void WriteBatch::Delete(std::string_view key) {
+    SetCount(Count() + 1);
+    rep_.push_back(static_cast<char>(WALRecordType::DELETE));
+    PutLengthPrefixed(rep_, key);
+}
+
+void WriteBatch::Append(const WriteBatch& other) {
+    SetCount(Count() + other.Count());
+    rep_.append(other.rep_, kHeaderSize, std::string::npos);
+}
+
+void WriteBatch::Clear() {
+    rep_.assign(kHeaderSize, '\0');
+}
+
+uint32_t WriteBatch::Count() const {
+    return DecodeFixed32(rep_.data() + 16);
+}
+
+void WriteBatch::SetCount(uint32_t count) {
+    EncodeFixed32(&rep_[16], count);
+}
+
+uint64_t WriteBatch::Sequence() const {
+    return DecodeFixed64(rep_.data());
+}
+
+void WriteBatch::SetSequence(uint64_t sequence) {
+    EncodeFixed64(&rep_[0], sequence);
+}
+
+uint64_t WriteBatch::Timestamp() const {
+    return DecodeFixed64(rep_.data() + 8);
+}
+
+void WriteBatch::SetTimestamp(uint64_t timestamp) {
+    EncodeFixed64(&rep_[8], timestamp);
+}
+
+bool WriteBatch::SetData(std::string_view data) {
+    if (data.size() < kHeaderSize) {
+        return false;
+    }
+    rep_.assign(data);
+    return true;
+}
+
+bool WriteBatch::Iterate(Handler& handler) const {
+    std::string_view input(rep_);
+    input.remove_prefix(kHeaderSize);
+    // A sequence of 0 predates sequence numbers; every operation keeps it
+    uint64_t base = Sequence();
+    uint64_t timestamp = Timestamp();
+    uint32_t found = 0;
+    while (!input.empty()) {
+        auto type = static_cast<WALRecordType>(input[0]);
+        input.remove_prefix(1);
+        uint64_t sequence = base == 0 ? 0 : base + found;
+        std::string_view key, value;
+        if (!GetLengthPrefixed(input, key)) {
+            return false;
+        }
+        if (type == WALRecordType::PUT) {
+            if (!GetLengthPrefixed(input, value)) {
+                return false;
+            }
+            handler.Put(key, value, sequence, timestamp);
+        } else if (type == WALRecordType::DELETE) {
+            handler.Delete(key, sequence, timestamp);
+        } else {
+            return false;
+        }
+        ++found;
+    }
+    return found == Count();
+}
+
+} // namespace kvstore
@@ -0,0 +1,39 @@
+#include "write_buffer_manager.h"
+
+namespace kvstore {
+
+WriteBufferManager::WriteBufferManager(size_t buffer_size)
+    : buffer_size_(buffer_size),
+      // Flush a little before the budget so memtables being flushed do not
+      // push the total over it
+      mutable_limit_(buffer_size / 8 * 7),
+      memory_used_(0),
+      memory_active_(0) {}
+
+bool WriteBufferManager::ShouldFlush() const {
+    if (buffer_size_ == 0) {
+        return false;
+    }
+    size_t active = MutableMemtableMemoryUsage();
+    if (active >= mutable_limit_) {
+        return true;
+    }
+    // Over budget because of memtables already being flushed: only flush
+    // more if that would actually free a meaningful share
+    return MemoryUsage() >= buffer_size_ && active >= buffer_size_ / 2;
+}
+
+void WriteBufferManager::ReserveMem(size_t bytes) {
+    memory_used_.fetch_add(bytes, std::memory_order_relaxed);
+    memory_active_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void WriteBufferManager::ScheduleFreeMem(size_t bytes) {
+    memory_active_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void WriteBufferManager::FreeMem(size_t bytes) {
+    memory_used_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+} // namespace kvstore
@@ -0,0 +1,33 @@
+#include "write_controller.h"
+#include <algorithm>
+
+namespace kvstore {
+
+WriteController::WriteController(uint64_t delayed_write_rate)
+    : max_rate_(std::max(delayed_write_rate, kMinWriteRate)),
+      current_rate_(max_rate_),
+      condition_(WriteStallCondition::kNormal),
+      next_write_micros_(0),
+      delayed_micros_(0),
+      stopped_micros_(0) {}
+
+void WriteController::SetCondition(WriteStallCondition condition,
+                                   double severity) {
+    condition_ = condition;
+    severity = std::min(std::max(severity, 0.0), 1.0);
+    current_rate_ = std::max(
+        static_cast<uint64_t>(max_rate_ * (1.0 - severity)), kMinWriteRate);
+}
+
+uint64_t WriteController::GetDelay(uint64_t now_micros, uint64_t bytes) {
+    if (condition_ != WriteStallCondition::kDelayed) {
+        return 0;
+    }
+    // An idle period does not bank credit for a later burst
+    next_write_micros_ = std::max(next_write_micros_, now_micros);
+    uint64_t delay = next_write_micros_ - now_micros;
+    next_write_micros_ += bytes * 1000000 / current_rate_;
+    return delay;
+}
+
+} // namespace kvstore
@@ -0,0 +1,153 @@
+#include "xor_filter.h"
+#include "format.h"
+#include <algorithm>
+#include <cmath>
+
+namespace kvstore {
+
+namespace {
+
+constexpr uint64_t kInitialSeed = 0x726b2b9d438b9d4dull;
+constexpr int kMaxBuildAttempts = 64;
+
+uint64_t RotateLeft(uint64_t value, int shift) {
+    return shift == 0 ? value : (value << shift) | (value >> (64 - shift));
+}
+
+} // namespace
+
+uint64_t XorFilter::Mix(uint64_t hash, uint64_t seed) {
+    uint64_t h = hash + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint8_t XorFilter::Fingerprint(uint64_t mixed) {
+    return static_cast<uint8_t>(mixed ^ (mixed >> 32));
+}
+
+// Slot `index` lives in the index-th third of the table, so a key's three
+// slots are always distinct
+uint32_t XorFilter::Slot(uint64_t mixed, int index) const {
+    uint32_t r = static_cast<uint32_t>(RotateLeft(mixed, 21 * index));
+    return static_cast<uint32_t>((static_cast<uint64_t>(r) * block_length_) >> 32) +
+           index * block_length_;
+}
+
+bool XorFilter::Build(std::vector<uint64_t> hashes, XorFilter& filter) {
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    size_t capacity = 32 + static_cast<size_t>(std::ceil(1.23 * hashes.size()));
+    filter.block_length_ = static_cast<uint32_t>(capacity / 3);
+    capacity = 3 * static_cast<size_t>(filter.block_length_);
+
+    std::vector<uint32_t> counts(capacity);
+    std::vector<uint64_t> xor_masks(capacity);
+    std::vector<uint32_t> queue;
+    // Peeled keys and the slot each one owns, in peeling order
+    std::vector<std::pair<uint64_t, uint32_t>> stack;
+    stack.reserve(hashes.size());
+
+    uint64_t seed = kInitialSeed;
+    for (int attempt = 0; attempt < kMaxBuildAttempts; ++attempt) {
+        filter.seed_ = seed;
+        std::fill(counts.begin(), counts.end(), 0);
+        std::fill(xor_masks.begin(), xor_masks.end(), 0);
+        queue.clear();
+        stack.clear();
+
+        for (uint64_t hash : hashes) {
+            uint64_t mixed = Mix(hash, seed);
+            for (int i = 0; i < 3; ++i) {
+                uint32_t slot = filter.Slot(mixed, i);
+                ++counts[slot];
+                xor_masks[slot] ^= mixed;
+            }
+        }
+
+        // Repeatedly peel keys that are alone in one of their slots
+        for (uint32_t slot = 0; slot < capacity; ++slot) {
+            if (counts[slot] == 1) {
+                queue.push_back(slot);
+            }
+        }
+        while (!queue.empty()) {
+            uint32_t slot = queue.back();
+            queue.pop_back();
+            if (counts[slot] != 1) {
+                continue;
+            }
+            uint64_t mixed = xor_masks[slot];
+            stack.emplace_back(mixed, slot);
+            for (int i = 0; i < 3; ++i) {
+                uint32_t other = filter.Slot(mixed, i);
+                xor_masks[other] ^= mixed;
+                if (--counts[other] == 1) {
+                    queue.push_back(other);
+                }
+            }
+        }
+
+        if (stack.size() == hashes.size()) {
+            break;
+        }
+        seed = Mix(seed, attempt + 1);
+    }
+    if (stack.size() != hashes.size()) {
+        return false;
+    }
+
+    // Assign in reverse peeling order: each key's owned slot is set last
+    filter.fingerprints_.assign(capacity, 0);
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+        uint64_t mixed = it->first;
+        uint8_t fingerprint = Fingerprint(mixed);
+        for (int i = 0; i < 3; ++i) {
+            uint32_t slot = filter.Slot(mixed, i);
+            if (slot != it->second) {
+                fingerprint ^= filter.fingerprints_[slot];
+            }
+        }
+        filter.fingerprints_[it->second] = fingerprint;
+    }
+    return true;
+}
+
+bool XorFilter::MayContainHash(uint64_t hash) const {
+    uint64_t mixed = Mix(hash, seed_);
+    uint8_t fingerprint = fingerprints_[Slot(mixed, 0)] ^
+                          fingerprints_[Slot(mixed, 1)] ^
+                          fingerprints_[Slot(mixed, 2)];
+    return fingerprint == Fingerprint(mixed);
+}
+
+std::string XorFilter::Serialize() const {
+    std::string data;
+    PutFixed64(data, seed_);
+    PutFixed32(data, block_length_);
+    data.append(fingerprints_.begin(), fingerprints_.end());
+    return data;
+}
+
+bool XorFilter::Deserialize(std::string_view data, XorFilter& filter) {
+    if (data.size() < 12) {
+        return false;
+    }
+    uint64_t seed = DecodeFixed64(data.data());
+    uint32_t block_length = DecodeFixed32(data.data() + 8);
+    data.remove_prefix(12);
+    if (block_length == 0 || data.size() != 3 * static_cast<uint64_t>(block_length)) {
+        return false;
+    }
+    filter.seed_ = seed;
+    filter.block_length_ = block_length;
+    filter.fingerprints_.assign(data.begin(), data.end());
+    return true;
+}
+
+} // namespace kvstore
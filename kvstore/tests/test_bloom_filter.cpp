@@ -1 +1,71 @@
-// Tests implemented in test_wal.cpp
+#include <gtest/gtest.h>
+#include "bloom_filter.h"
+#include "hash.h"
+
+using namespace kvstore;
+
+TEST(BloomFilterTest, NoFalseNegatives) {
+    BloomFilter filter(10000, 0.01);
+    for (int i = 0; i < 10000; ++i) {
+        filter.Add("log:web:" + std::to_string(i));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(filter.MayContain("log:web:" + std::to_string(i)));
+    }
+}
+
+TEST(BloomFilterTest, FalsePositiveRate) {
+    BloomFilter filter(10000, 0.01);
+    for (int i = 0; i < 10000; ++i) {
+        filter.Add("key" + std::to_string(i));
+    }
+    
+    int false_positives = 0;
+    for (int i = 10000; i < 110000; ++i) {
+        if (filter.MayContain("key" + std::to_string(i))) {
+            false_positives++;
+        }
+    }
+    
+    // Blocking costs a little accuracy over a classic filter of equal size
+    EXPECT_LT(false_positives, 2000);
+}
+
+TEST(BloomFilterTest, Serialization) {
+    BloomFilter filter(1000, 0.01);
+    filter.Add("key1");
+    filter.Add("key2");
+    
+    auto data = filter.Serialize();
+    auto restored = BloomFilter::Deserialize(data);
+    
+    EXPECT_TRUE(restored.MayContain("key1"));
+    EXPECT_TRUE(restored.MayContain("key2"));
+    EXPECT_EQ(restored.Size(), filter.Size());
+}
+
+TEST(BloomFilterTest, XorFilter) {
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < 10000; ++i) {
+        hashes.push_back(Hash64("key" + std::to_string(i)));
+    }
+    
+    auto filter = ParseFilterBlock(BuildFilterBlock(FilterType::kXor, hashes));
+    ASSERT_NE(filter, nullptr);
+    ASSERT_EQ(filter->Type(), FilterType::kXor);
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(filter->MayContain("key" + std::to_string(i)));
+    }
+    
+    int false_positives = 0;
+    for (int i = 10000; i < 110000; ++i) {
+        if (filter->MayContain("key" + std::to_string(i))) {
+            false_positives++;
+        }
+    }
+    EXPECT_LT(false_positives, 700);
+    
+    // Smaller than a Bloom filter with a comparable false-positive rate
+    BloomFilter bloom(10000, 0.004);
+    EXPECT_LT(filter->MemoryUsage(), bloom.MemoryUsage());
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include "compression.h"
+
+using namespace kvstore;
+
+TEST(CompressionTest, RoundTripAllLevels) {
+    std::string input;
+    for (int i = 0; i < 200; ++i) {
+        input += "{\"service\": \"web\", \"level\": \"INFO\", \"timestamp\": \"2024-01-01T00:00:" +
+                 std::to_string(i) + "\", \"metadata\": {}}";
+    }
+
+    for (int level = lz4::kMinLevel; level <= lz4::kMaxLevel; ++level) {
+        std::string compressed;
+        CompressBlock(CompressionType::kLZ4, level, input, compressed);
+        ASSERT_LT(compressed.size(), input.size() / 4);
+
+        std::string output;
+        ASSERT_TRUE(DecompressBlock(CompressionType::kLZ4, compressed, output));
+        ASSERT_EQ(output, input);
+    }
+}
+
+TEST(CompressionTest, RejectsCorruptInput) {
+    std::string input(1000, 'a');
+    std::string compressed;
+    CompressBlock(CompressionType::kLZ4, 1, input, compressed);
+
+    std::string output;
+    ASSERT_FALSE(DecompressBlock(CompressionType::kLZ4,
+                                 compressed.substr(0, compressed.size() - 3), output));
+
+    std::string huge_length = "\xff\xff\xff\xff\x0f";
+    ASSERT_FALSE(DecompressBlock(CompressionType::kLZ4, huge_length + "\x10", output));
+}
+
+TEST(CompressionTest, DictionaryImprovesSmallValues) {
+    std::vector<std::string> values;
+    for (int i = 0; i < 2000; ++i) {
+        values.push_back("{\"service\": \"svc" + std::to_string(i % 7) +
+                         "\", \"level\": \"WARN\", \"timestamp\": \"2024-03-0" +
+                         std::to_string(i % 9) + "T12:00:00Z\", \"metadata\": {\"host\": \"node-" +
+                         std::to_string(i % 13) + "\"}}");
+    }
+    std::vector<std::string_view> samples(values.begin(), values.end());
+    std::string dict_data = TrainDictionary(samples, 4096);
+    ASSERT_FALSE(dict_data.empty());
+    ASSERT_LE(dict_data.size(), 4096u);
+    lz4::Dictionary dictionary(dict_data, 1);
+
+    size_t plain = 0, with_dict = 0;
+    for (const auto& value : values) {
+        std::string compressed, output;
+        CompressBlock(CompressionType::kLZ4, 1, value, compressed);
+        plain += compressed.size();
+
+        CompressBlock(CompressionType::kLZ4, 1, value, compressed, &dictionary);
+        with_dict += compressed.size();
+        ASSERT_TRUE(DecompressBlock(CompressionType::kLZ4, compressed, output,
+                                    dictionary.data()));
+        ASSERT_EQ(output, value);
+    }
+    ASSERT_LT(with_dict * 2, plain);
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 #include "kvstore.h"
+#include <filesystem>
+#include <thread>
+#include <fstream>
 
 using namespace kvstore;
 
@@ -39,3 +42,737 @@ TEST(KVStoreTest, Scan) {
     auto results = store.Scan("key_a", "key_c", 10);
     ASSERT_GE(results.size(), 2);
 }
+
+TEST(KVStoreTest, DeleteHidesFlushedValue) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_tombstone";
+    KVStore store(config);
+    
+    store.Put("key3", "value3");
+    store.Flush();
+    ASSERT_TRUE(store.Delete("key3"));
+    
+    std::string value;
+    ASSERT_FALSE(store.Get("key3", value));
+    
+    store.Flush();
+    ASSERT_FALSE(store.Get("key3", value));
+}
+
+TEST(KVStoreTest, ReopenKeepsNewestTableOrder) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_reopen";
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        // More than ten tables, so "10.sst" sorts before "2.sst" by name
+        for (int i = 0; i < 12; ++i) {
+            store.Put("key", "value" + std::to_string(i));
+            store.Flush();
+        }
+    }
+
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("key", value));
+    ASSERT_EQ(value, "value11");
+}
+
+TEST(KVStoreTest, CompactionKeepsNewestVersions) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_compaction";
+    config.compaction_threshold = 4;
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        for (int i = 0; i < 6; ++i) {
+            store.Put("shared", "v" + std::to_string(i));
+            store.Put("only" + std::to_string(i), "x");
+            store.Flush();
+        }
+        store.Delete("only0");
+        store.Flush();
+        ASSERT_LT(store.GetStats().num_sstables, 7u);
+
+        std::string value;
+        ASSERT_TRUE(store.Get("shared", value));
+        ASSERT_EQ(value, "v5");
+        ASSERT_FALSE(store.Get("only0", value));
+        ASSERT_TRUE(store.Get("only5", value));
+    }
+
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("shared", value));
+    ASSERT_EQ(value, "v5");
+    ASSERT_FALSE(store.Get("only0", value));
+    ASSERT_EQ(store.Scan("a", "z").size(), 6u);
+}
+
+TEST(KVStoreTest, ScanTimeRange) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_time_range";
+    std::filesystem::remove_all(config.data_dir);
+    KVStore store(config);
+
+    auto now = [] {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+    };
+
+    store.Put("log:1", "old");
+    store.Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    uint64_t begin = now();
+    store.Put("log:2", "in window");
+    store.Flush();
+    uint64_t end = now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    store.Put("log:2", "too new");
+    store.Put("log:3", "too new");
+
+    auto results = store.ScanTimeRange("log:", "log:~", begin, end);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].first, "log:2");
+    EXPECT_EQ(results[0].second, "in window");
+}
+
+TEST(KVStoreTest, PrefixScanSkipsOtherServices) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_prefix";
+    config.prefix_extractor = NewDelimitedPrefixExtractor(':', 2);
+    std::filesystem::remove_all(config.data_dir);
+    KVStore store(config);
+
+    for (const char* service : {"api", "web", "api"}) {
+        for (int i = 0; i < 10; ++i) {
+            store.Put(std::string("log:") + service + ":" + std::to_string(i),
+                      service);
+        }
+        store.Flush();
+    }
+    store.Delete("log:api:3");
+
+    auto results = store.Scan("log:api:", "log:api:~");
+    ASSERT_EQ(results.size(), 9u);
+    for (const auto& [key, value] : results) {
+        EXPECT_EQ(value, "api");
+    }
+    EXPECT_EQ(store.Scan("log:web:", "log:web:~").size(), 10u);
+    EXPECT_TRUE(store.Scan("log:db:", "log:db:~").empty());
+    EXPECT_EQ(store.Scan("log:", "log:~", 100).size(), 19u);
+}
+
+TEST(KVStoreTest, SharedWriteBufferBudget) {
+    auto manager = std::make_shared<WriteBufferManager>(1 << 20);
+    Config config;
+    config.write_buffer_manager = manager;
+    config.data_dir = "/tmp/kvstore_test_budget_a";
+    std::filesystem::remove_all(config.data_dir);
+    KVStore a(config);
+    config.data_dir = "/tmp/kvstore_test_budget_b";
+    std::filesystem::remove_all(config.data_dir);
+    KVStore b(config);
+    
+    std::string value(200, 'v');
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(a.Put("a" + std::to_string(i), value));
+        ASSERT_TRUE(b.Put("b" + std::to_string(i), value));
+        // Queued memtables are flushed in the background; only the ones
+        // taking writes are held to the budget
+        ASSERT_LE(manager->MutableMemtableMemoryUsage(), manager->BufferSize());
+    }
+    
+    // Neither memtable reached memtable_size_mb; the shared budget flushed
+    auto stats = a.GetStats();
+    ASSERT_GT(stats.num_sstables + stats.num_immutable_memtables, 0u);
+    stats = b.GetStats();
+    ASSERT_GT(stats.num_sstables + stats.num_immutable_memtables, 0u);
+    std::string read;
+    ASSERT_TRUE(a.Get("a0", read));
+    ASSERT_TRUE(b.Get("b9999", read));
+}
+
+TEST(KVStoreTest, BackgroundFlushKeepsDataVisible) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_background_flush";
+    config.memtable_size_mb = 1;
+    config.compaction_threshold = 100;
+    std::filesystem::remove_all(config.data_dir);
+    
+    std::string value(1000, 'v');
+    {
+        KVStore store(config);
+        // Keys stay readable while their memtable waits to be flushed
+        for (int i = 0; i < 4000; ++i) {
+            std::string key = "key" + std::to_string(i);
+            ASSERT_TRUE(store.Put(key, value + std::to_string(i)));
+            std::string read;
+            ASSERT_TRUE(store.Get("key" + std::to_string(i / 2), read));
+        }
+        EXPECT_EQ(store.Scan("key", "key~", 10000).size(), 4000u);
+        
+        store.Flush();
+        auto stats = store.GetStats();
+        EXPECT_GE(stats.num_sstables, 3u);
+        EXPECT_EQ(stats.num_immutable_memtables, 0u);
+    }
+    
+    // Every flushed memtable's WAL is retired, and the data survives
+    // reopening
+    size_t logs = 0;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(config.data_dir)) {
+        if (entry.path().extension() == ".log") {
+            WALOptions options;
+            options.log_number = std::stoull(entry.path().stem().string());
+            logs += !WAL(entry.path().string(), options).ReadAll().empty();
+        }
+    }
+    EXPECT_EQ(logs, 0u);
+    
+    KVStore store(config);
+    std::string read;
+    ASSERT_TRUE(store.Get("key3999", read));
+    EXPECT_EQ(read, value + "3999");
+}
+
+TEST(KVStoreTest, WriteControllerPacing) {
+    WriteController controller(1 << 20);
+    EXPECT_EQ(controller.GetDelay(0, 1 << 20), 0u);
+    
+    controller.SetCondition(WriteStallCondition::kDelayed);
+    EXPECT_EQ(controller.GetDelay(0, 1 << 20), 0u);
+    // The next write queues behind the megabyte reserved above
+    EXPECT_EQ(controller.GetDelay(0, 1), 1000000u);
+    
+    controller.SetCondition(WriteStallCondition::kDelayed, 0.5);
+    EXPECT_EQ(controller.DelayedWriteRate(), 1u << 19);
+    controller.SetCondition(WriteStallCondition::kDelayed, 1.0);
+    EXPECT_GT(controller.DelayedWriteRate(), 0u);
+}
+
+TEST(KVStoreTest, RateLimiterPacing) {
+    RateLimiter limiter(1 << 20);
+    // A full burst is available up front; past it requests wait
+    auto start = std::chrono::steady_clock::now();
+    limiter.Request(100 * 1024, IOPriority::kLow);
+    EXPECT_EQ(limiter.BytesThrottled(), 0u);
+    limiter.Request(100 * 1024, IOPriority::kHigh);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(90));
+    EXPECT_EQ(limiter.BytesThrottled(), 100u * 1024);
+    EXPECT_GT(limiter.MicrosWaited(), 0u);
+    
+    // Auto-tuned limiters rise towards the limit with compaction debt
+    RateLimiter tuned(10 << 20, true);
+    EXPECT_EQ(tuned.GetBytesPerSecond(), 1u << 20);
+    int behind, idle;
+    tuned.Tune(&behind, 1.0);
+    EXPECT_EQ(tuned.GetBytesPerSecond(), 10u << 20);
+    // An idle store sharing the limiter does not slow the one behind
+    tuned.Tune(&idle, 0);
+    EXPECT_EQ(tuned.GetBytesPerSecond(), 10u << 20);
+    tuned.RemoveCaller(&behind);
+    tuned.SetBytesPerSecond(20 << 20);
+    EXPECT_EQ(tuned.GetBytesPerSecond(), 2u << 20);
+    
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_rate_limiter";
+    config.memtable_size_mb = 1;
+    config.enable_compression = false;
+    config.rate_limiter = std::make_shared<RateLimiter>(8 << 20);
+    std::filesystem::remove_all(config.data_dir);
+    KVStore store(config);
+    std::string value(1024, 'v');
+    for (int i = 0; i < 2048; ++i) {
+        ASSERT_TRUE(store.Put("key" + std::to_string(i), value));
+    }
+    store.Flush();
+    auto stats = store.GetStats();
+    EXPECT_GT(stats.rate_limited_bytes, 0u);
+    EXPECT_GT(stats.rate_limit_wait_micros, 0u);
+    std::string read;
+    ASSERT_TRUE(store.Get("key2047", read));
+}
+
+TEST(KVStoreTest, TableCountDelaysWrites) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_write_stall";
+    config.compaction_threshold = 100;
+    config.level0_slowdown_writes_trigger = 2;
+    config.delayed_write_rate_mb = 1;
+    std::filesystem::remove_all(config.data_dir);
+    KVStore store(config);
+    
+    for (int i = 0; i < 2; ++i) {
+        store.Put("key" + std::to_string(i), "value");
+        store.Flush();
+    }
+    auto stats = store.GetStats();
+    ASSERT_EQ(stats.write_stall_condition, WriteStallCondition::kDelayed);
+    
+    std::string value(256 * 1024, 'v');
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(store.Put("big" + std::to_string(i), value));
+    }
+    stats = store.GetStats();
+    // Three quarter-megabyte writes at 1 MB/s: the last two waited
+    EXPECT_GE(stats.write_delayed_micros, 400000u);
+    EXPECT_EQ(stats.write_stopped_micros, 0u);
+}
+
+TEST(KVStoreTest, SnapshotIsolation) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_snapshot";
+    std::filesystem::remove_all(config.data_dir);
+    KVStore store(config);
+    
+    store.Put("a", "1");
+    store.Put("b", "1");
+    store.Flush();
+    store.Put("a", "2");
+    const Snapshot* snapshot = store.GetSnapshot();
+    EXPECT_EQ(snapshot->GetSequenceNumber(), 3u);
+    
+    // Later writes, a flush and a delete do not show through the snapshot
+    store.Put("a", "3");
+    store.Put("c", "1");
+    store.Delete("b");
+    store.Flush();
+    
+    std::string value;
+    ASSERT_TRUE(store.Get("a", value, snapshot));
+    EXPECT_EQ(value, "2");
+    ASSERT_TRUE(store.Get("b", value, snapshot));
+    EXPECT_FALSE(store.Get("c", value, snapshot));
+    auto results = store.Scan("a", "z", 100, snapshot);
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0].second, "2");
+    
+    ASSERT_TRUE(store.Get("a", value));
+    EXPECT_EQ(value, "3");
+    EXPECT_FALSE(store.Get("b", value));
+    EXPECT_EQ(store.GetStats().num_snapshots, 1u);
+    store.ReleaseSnapshot(snapshot);
+    EXPECT_EQ(store.GetStats().num_snapshots, 0u);
+}
+
+TEST(KVStoreTest, SequenceSurvivesReopen) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_sequence";
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        store.Put("a", "1");
+        store.Put("a", "2");
+        store.Flush();
+        store.Put("b", "1");
+    }
+    KVStore store(config);
+    EXPECT_EQ(store.GetStats().last_sequence, 3u);
+    store.Put("a", "3");
+    EXPECT_EQ(store.GetStats().last_sequence, 4u);
+    store.Flush();
+    store.Compact();
+    std::string value;
+    ASSERT_TRUE(store.Get("a", value));
+    EXPECT_EQ(value, "3");
+}
+
+TEST(KVStoreTest, GroupCommit) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_group_commit";
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 8; ++t) {
+            writers.emplace_back([&store, t]() {
+                for (int i = 0; i < 200; ++i) {
+                    std::string key = "key" + std::to_string(t) + "_" + std::to_string(i);
+                    ASSERT_TRUE(store.Put(key, "v", Durability::kSync));
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        auto stats = store.GetStats();
+        EXPECT_EQ(stats.num_writes, 1600u);
+        EXPECT_LE(stats.num_write_groups, stats.num_writes);
+        EXPECT_EQ(stats.num_wal_syncs, stats.num_write_groups);
+        EXPECT_EQ(stats.last_sequence, 1600u);
+        
+        // Buffered and memtable-only writes never sync
+        ASSERT_TRUE(store.Put("buffered", "v", Durability::kBuffered));
+        ASSERT_TRUE(store.Delete("key0_0", Durability::kNone));
+        EXPECT_EQ(store.GetStats().num_wal_syncs, stats.num_wal_syncs);
+    }
+    
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("key7_199", value));
+    ASSERT_TRUE(store.Get("buffered", value));
+    EXPECT_FALSE(store.Get("key0_0", value));
+}
+
+TEST(KVStoreTest, ReplaysLegacyWAL) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_legacy_wal";
+    std::filesystem::remove_all(config.data_dir);
+    std::filesystem::create_directories(config.data_dir);
+    {
+        // type | key_len | key | value_len | value | timestamp | byte-sum checksum
+        std::ofstream out(config.data_dir + "/wal.log", std::ios::binary);
+        auto write = [&out](const void* data, size_t size) {
+            out.write(static_cast<const char*>(data), size);
+        };
+        std::string key = "old", value = "value";
+        uint8_t type = 1;
+        uint32_t key_len = key.size(), value_len = value.size();
+        uint64_t timestamp = 1000;
+        uint32_t checksum = type + timestamp;
+        for (char c : key + value) checksum += c;
+        write(&type, 1);
+        write(&key_len, 4);
+        write(key.data(), key.size());
+        write(&value_len, 4);
+        write(value.data(), value.size());
+        write(&timestamp, 8);
+        write(&checksum, 4);
+        // Torn second record
+        write(&type, 1);
+        key_len = 1 << 30;
+        write(&key_len, 4);
+    }
+    
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("old", value));
+    EXPECT_EQ(value, "value");
+    EXPECT_FALSE(std::filesystem::exists(config.data_dir + "/wal.log"));
+}
+
+TEST(KVStoreTest, RecyclesFlushedWALs) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_recycle";
+    config.recycle_wal_count = 2;
+    std::filesystem::remove_all(config.data_dir);
+    auto count_files = [&config](const std::string& extension) {
+        size_t count = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(config.data_dir)) {
+            count += entry.path().extension() == extension;
+        }
+        return count;
+    };
+    
+    for (int round = 0; round < 3; ++round) {
+        KVStore store(config);
+        for (int i = 0; i < 4; ++i) {
+            store.Put("key" + std::to_string(i), "round" + std::to_string(round));
+            store.Flush();
+            EXPECT_LE(count_files(".recycle"), 2u);
+        }
+        store.Put("tail", std::to_string(round));
+    }
+    // Flushed logs are retired before Flush() returns, so the next
+    // memtable may already have taken one back
+    EXPECT_GE(count_files(".recycle"), 1u);
+    EXPECT_LE(count_files(".recycle"), 2u);
+    
+    // Logs written into recycled files replay only their own records
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("key3", value));
+    EXPECT_EQ(value, "round2");
+    ASSERT_TRUE(store.Get("tail", value));
+    EXPECT_EQ(value, "2");
+}
+
+TEST(KVStoreTest, WriteBatchAppliesAtomically) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_write_batch";
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        store.Put("anomaly:1", "stale");
+        const Snapshot* before = store.GetSnapshot();
+        
+        WriteBatch batch;
+        batch.Put("log:api:1", "request failed");
+        batch.Put("anomaly:2", "error burst");
+        batch.Delete("anomaly:1");
+        ASSERT_TRUE(store.Write(batch, Durability::kSync));
+        EXPECT_EQ(store.GetStats().last_sequence, 4u);
+        
+        std::string value;
+        EXPECT_FALSE(store.Get("log:api:1", value, before));
+        ASSERT_TRUE(store.Get("anomaly:1", value, before));
+        EXPECT_FALSE(store.Get("anomaly:1", value));
+        ASSERT_TRUE(store.Get("anomaly:2", value));
+        store.ReleaseSnapshot(before);
+    }
+    
+    KVStore store(config);
+    std::string value;
+    ASSERT_TRUE(store.Get("log:api:1", value));
+    EXPECT_EQ(value, "request failed");
+    EXPECT_FALSE(store.Get("anomaly:1", value));
+}
+
+TEST(KVStoreTest, RecoveryFlushesToLevel0) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_recovery";
+    std::filesystem::remove_all(config.data_dir);
+    std::string copy_dir = config.data_dir + "_copy";
+    
+    std::string value(500, 'v');
+    KVStore store(config);
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(store.Put("key" + std::to_string(i), value + std::to_string(i)));
+    }
+    
+    for (size_t threads : {1, 4}) {
+        // A copy of the live directory is what a crash would leave behind
+        std::filesystem::remove_all(copy_dir);
+        std::filesystem::copy(config.data_dir, copy_dir);
+        Config recovery = config;
+        recovery.data_dir = copy_dir;
+        recovery.memtable_size_mb = 1;
+        recovery.compaction_threshold = 100;
+        recovery.wal_recovery_threads = threads;
+        
+        KVStore recovered(recovery);
+        auto stats = recovered.GetStats();
+        EXPECT_GE(stats.num_sstables, 4u);
+        EXPECT_LE(stats.num_immutable_memtables, 1u);
+        EXPECT_EQ(stats.last_sequence, 10000u);
+        std::string read;
+        for (int i = 0; i < 10000; i += 7) {
+            ASSERT_TRUE(recovered.Get("key" + std::to_string(i), read));
+            ASSERT_EQ(read, value + std::to_string(i));
+        }
+    }
+}
+
+TEST(KVStoreTest, LeveledCompactionKeepsLevelsAcrossReopen) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_leveled";
+    config.memtable_size_mb = 1;
+    config.compaction_threshold = 2;
+    config.max_bytes_for_level_base_mb = 1;
+    config.max_bytes_for_level_multiplier = 2;
+    config.target_file_size_mb = 1;
+    // Compactions run side by side and split into subcompactions
+    config.max_background_compactions = 2;
+    config.max_subcompactions = 4;
+    config.enable_compression = false;
+    std::filesystem::remove_all(config.data_dir);
+    
+    auto key = [](int i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key%06d", (i * 7919) % 10000);
+        return std::string(buf);
+    };
+    std::vector<size_t> levels;
+    {
+        KVStore store(config);
+        // Keys arrive shuffled so every flush overlaps the levels below
+        for (int round = 0; round < 2; ++round) {
+            for (int i = 0; i < 10000; ++i) {
+                if (round == 0 || i % 2 == 0) {
+                    ASSERT_TRUE(store.Put(key(i), std::to_string(round) +
+                                                  std::string(400, 'v')));
+                }
+            }
+        }
+        store.Flush();
+        store.Compact();
+        auto stats = store.GetStats();
+        levels = stats.num_sstables_per_level;
+        ASSERT_EQ(levels.size(), static_cast<size_t>(kNumLevels));
+        EXPECT_LT(levels[0], 2u);
+        // Data reached the deeper levels; a compaction into the next level
+        // may have emptied any one of them, so none is required in particular
+        size_t deeper = 0;
+        for (size_t level = 2; level < levels.size(); ++level) {
+            deeper += levels[level];
+        }
+        EXPECT_GT(deeper, 0u);
+    }
+    
+    // Tables missing from the MANIFEST are leftovers and get removed
+    std::filesystem::copy_file(config.data_dir + "/MANIFEST",
+                               config.data_dir + "/999999.sst");
+    
+    KVStore store(config);
+    EXPECT_EQ(store.GetStats().num_sstables_per_level, levels);
+    EXPECT_FALSE(std::filesystem::exists(config.data_dir + "/999999.sst"));
+    std::string value;
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_TRUE(store.Get(key(i), value));
+        ASSERT_EQ(value[0], i % 2 == 0 ? '1' : '0');
+    }
+    EXPECT_EQ(store.Scan("key", "key~", 20000).size(), 10000u);
+}
+
+TEST(KVStoreTest, DamagedManifestKeepsReplayedVersion) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_damaged_manifest";
+    config.compaction_threshold = 2;
+    std::filesystem::remove_all(config.data_dir);
+    {
+        KVStore store(config);
+        store.Put("key", "fresh");
+        store.Put("gone", "x");
+        store.Flush();
+        store.Delete("gone");
+        store.Flush();
+        store.Compact();
+        ASSERT_EQ(store.GetStats().num_sstables_per_level[0], 0u);
+    }
+    
+    // A replaced compaction input that was never removed, then a record
+    // torn by a bad checksum at the end of the MANIFEST
+    ASSERT_TRUE(SSTable::Create(config.data_dir + "/999999.sst",
+                                {{"gone", "stale", false, 1, 1},
+                                 {"key", "stale", false, 1, 2}}));
+    {
+        std::ofstream manifest(config.data_dir + "/MANIFEST",
+                               std::ios::binary | std::ios::app);
+        const char fragment[] = {'\x12', '\x34', '\x56', '\x78', 4, 0, 1,
+                                 'b', 'a', 'd', '!'};
+        manifest.write(fragment, sizeof(fragment));
+    }
+    
+    for (int reopen = 0; reopen < 2; ++reopen) {
+        KVStore store(config);
+        std::string value;
+        ASSERT_TRUE(store.Get("key", value));
+        EXPECT_EQ(value, "fresh");
+        EXPECT_FALSE(store.Get("gone", value));
+        EXPECT_EQ(store.GetStats().num_sstables_per_level[0], 0u);
+    }
+    EXPECT_FALSE(std::filesystem::exists(config.data_dir + "/999999.sst"));
+    EXPECT_TRUE(std::filesystem::exists(config.data_dir + "/lost/999999.sst"));
+}
+
+TEST(KVStoreTest, TimeWindowCompactionAndTTL) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_time_window";
+    config.compaction_style = CompactionStyle::kTimeWindow;
+    config.compaction_window_ms = 60 * 60 * 1000;
+    config.compaction_threshold = 4;
+    config.ttl_seconds = 24 * 60 * 60;
+    std::filesystem::remove_all(config.data_dir);
+    std::filesystem::create_directories(config.data_dir);
+    
+    // Tables from two days ago, and from two hours ago, oldest first
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t hour = 60 * 60 * 1000;
+    int id = 1;
+    for (uint64_t age : {48 * hour, 48 * hour, 2 * hour, 2 * hour}) {
+        std::string key = "log:" + std::to_string(now - age) + ":" + std::to_string(id);
+        ASSERT_TRUE(SSTable::Create(config.data_dir + "/" + std::to_string(id++) + ".sst",
+                                    {{key, "entry", false, now - age}}));
+    }
+    
+    KVStore store(config);
+    for (int i = 0; i < 2; ++i) {
+        store.Put("log:new:" + std::to_string(i), "entry");
+        store.Flush();
+    }
+    store.Compact();
+    
+    // The expired tables were deleted whole, the closed window merged into
+    // one table, and the open window still waits for more flushes
+    EXPECT_FALSE(std::filesystem::exists(config.data_dir + "/1.sst"));
+    EXPECT_FALSE(std::filesystem::exists(config.data_dir + "/2.sst"));
+    auto stats = store.GetStats();
+    EXPECT_EQ(stats.num_sstables_per_level[0], 3u);
+    EXPECT_EQ(stats.num_sstables, 3u);
+    EXPECT_GE(stats.oldest_timestamp, now - 3 * hour);
+    
+    EXPECT_EQ(store.Scan("log:", "log:~").size(), 4u);
+}
+
+TEST(KVStoreTest, TimeWindowMergeLargerThanTargetSize) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_time_window_large";
+    config.compaction_style = CompactionStyle::kTimeWindow;
+    config.compaction_window_ms = 60 * 60 * 1000;
+    config.compaction_threshold = 4;
+    config.target_file_size_mb = 1;
+    config.max_subcompactions = 4;
+    config.enable_compression = false;
+    std::filesystem::remove_all(config.data_dir);
+    std::filesystem::create_directories(config.data_dir);
+    
+    // A closed window holding about 3 MB over three tables
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t written = now - 2 * 60 * 60 * 1000;
+    SSTableOptions options;
+    options.compression = CompressionType::kNone;
+    for (int id = 1; id <= 3; ++id) {
+        std::vector<SSTableEntry> entries;
+        for (int i = 0; i < 1000; ++i) {
+            entries.push_back({"log:" + std::to_string(id * 1000 + i),
+                               std::string(1000, 'v'), false, written,
+                               static_cast<uint64_t>(id * 1000 + i)});
+        }
+        ASSERT_TRUE(SSTable::Create(config.data_dir + "/" + std::to_string(id) + ".sst",
+                                    entries, options));
+    }
+    
+    KVStore store(config);
+    store.Put("log:new", "entry");
+    store.Flush();
+    store.Compact();
+    
+    // The window is one table, so nothing is left to pick or owed
+    auto stats = store.GetStats();
+    EXPECT_EQ(stats.num_sstables_per_level[0], 2u);
+    EXPECT_EQ(stats.pending_compaction_bytes, 0u);
+    store.Compact();
+    EXPECT_EQ(store.GetStats().num_sstables, 2u);
+    EXPECT_EQ(store.Scan("log:", "log:~", 5000).size(), 3001u);
+}
+
+TEST(KVStoreTest, RecoveryKeepsWriteTimes) {
+    Config config;
+    config.data_dir = "/tmp/kvstore_test_recovered_times";
+    config.ttl_seconds = 24 * 60 * 60;
+    std::filesystem::remove_all(config.data_dir);
+    std::filesystem::create_directories(config.data_dir);
+    
+    // A log left by a crash two days ago, never flushed
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t written = now - 48 * 60 * 60 * 1000;
+    {
+        WriteBatch batch;
+        batch.Put("log:old", "entry");
+        batch.SetSequence(1);
+        batch.SetTimestamp(written);
+        WAL wal(config.data_dir + "/1.log");
+        ASSERT_TRUE(wal.AddRecord(batch.Data()));
+        ASSERT_TRUE(wal.Sync());
+    }
+    
+    KVStore store(config);
+    auto results = store.ScanTimeRange("log:", "log:~", written, written);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0].first, "log:old");
+    EXPECT_TRUE(store.ScanTimeRange("log:", "log:~", written + 1, now + 1000).empty());
+    
+    store.Flush();
+    EXPECT_EQ(store.GetStats().oldest_timestamp, written);
+    store.Compact();
+    std::string value;
+    EXPECT_FALSE(store.Get("log:old", value));
+    EXPECT_EQ(store.GetStats().num_sstables, 0u);
+}
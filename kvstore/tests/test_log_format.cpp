@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+#include "crc32c.h"
+#include "wal.h"
+#include "write_batch.h"
+#include <filesystem>
+#include <fstream>
+
+using namespace kvstore;
+
+TEST(Crc32cTest, StandardResults) {
+    // From RFC 3720 section B.4
+    std::string zeros(32, '\0');
+    std::string ones(32, '\xff');
+    EXPECT_EQ(crc32c::Value(zeros.data(), zeros.size()), 0x8a9136aau);
+    EXPECT_EQ(crc32c::Value(ones.data(), ones.size()), 0x62a8ab43u);
+    EXPECT_EQ(crc32c::Value("123456789", 9), 0xe3069283u);
+    
+    std::string data = "hello world, this spans more than eight bytes";
+    EXPECT_EQ(crc32c::Value(data.data(), data.size()),
+              crc32c::Extend(crc32c::Value(data.data(), 13), data.data() + 13,
+                             data.size() - 13));
+    
+    uint32_t crc = crc32c::Value("foo", 3);
+    EXPECT_NE(crc32c::Mask(crc), crc);
+    EXPECT_EQ(crc32c::Unmask(crc32c::Mask(crc)), crc);
+}
+
+class LogFormatTest : public ::testing::Test {
+protected:
+    std::string path_ = "/tmp/test_log_format.log";
+    
+    void SetUp() override { std::filesystem::remove(path_); }
+    void TearDown() override { std::filesystem::remove(path_); }
+    
+    // Sizes chosen to land records exactly on, just short of and far
+    // across block boundaries
+    std::vector<size_t> Sizes() const {
+        return {10, 100000, WAL::kBlockSize - 2 * WAL::kHeaderSize - 30,
+                1, WAL::kBlockSize * 3, 5, 0, 700};
+    }
+    
+    void WriteLog() {
+        WAL wal(path_);
+        int i = 0;
+        for (size_t size : Sizes()) {
+            ASSERT_TRUE(wal.Append(WALRecordType::PUT, "key" + std::to_string(i),
+                                   std::string(size, 'a' + i), i + 1));
+            ++i;
+        }
+    }
+};
+
+TEST_F(LogFormatTest, RecordsSpanBlocks) {
+    WriteLog();
+    auto records = WAL(path_).ReadAll();
+    ASSERT_EQ(records.size(), Sizes().size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        EXPECT_EQ(records[i].key, "key" + std::to_string(i));
+        EXPECT_EQ(records[i].value, std::string(Sizes()[i], 'a' + i));
+        EXPECT_EQ(records[i].sequence, i + 1);
+    }
+    
+    // Reopening continues the block layout where it left off
+    {
+        WAL wal(path_);
+        ASSERT_TRUE(wal.Append(WALRecordType::DELETE, "gone", "", 99));
+    }
+    records = WAL(path_).ReadAll();
+    ASSERT_EQ(records.size(), Sizes().size() + 1);
+    EXPECT_EQ(records.back().type, WALRecordType::DELETE);
+}
+
+TEST_F(LogFormatTest, TornTailIsEndOfLog) {
+    WriteLog();
+    auto size = std::filesystem::file_size(path_);
+    std::filesystem::resize_file(path_, size - 3);
+    
+    WALReader reader(path_);
+    std::string_view record;
+    std::string scratch;
+    size_t count = 0;
+    while (reader.ReadRecord(record, scratch)) {
+        ++count;
+    }
+    EXPECT_EQ(count, Sizes().size() - 1);
+    EXPECT_FALSE(reader.Corrupted());
+}
+
+TEST_F(LogFormatTest, StopsAtCorruption) {
+    WriteLog();
+    {
+        // Damage the third record, which sits in the fourth block
+        std::fstream file(path_, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(3 * WAL::kBlockSize + 2000);
+        file.put('\x7f');
+    }
+    
+    WALReader reader(path_);
+    std::string_view record;
+    std::string scratch;
+    size_t count = 0;
+    while (reader.ReadRecord(record, scratch)) {
+        ++count;
+    }
+    EXPECT_EQ(count, 2u);
+    EXPECT_TRUE(reader.Corrupted());
+    EXPECT_EQ(WAL(path_).ReadAll().size(), 2u);
+}
+
+TEST(WALSyncTest, FailedSyncFailsLog) {
+    // fdatasync is not supported on /dev/null
+    WAL wal("/dev/null");
+    ASSERT_TRUE(wal.Append(WALRecordType::PUT, "key", "value", 1));
+    EXPECT_FALSE(wal.Sync());
+    // The appended record's fate is unknown, so nothing may follow it
+    EXPECT_FALSE(wal.Append(WALRecordType::PUT, "key", "value", 2));
+    EXPECT_FALSE(wal.Sync());
+}
+
+TEST_F(LogFormatTest, RecycledFileHidesOldRecords) {
+    WALOptions options;
+    options.log_number = 7;
+    options.preallocate_size = 1 << 20;
+    {
+        WAL wal(path_, options);
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_TRUE(wal.Append(WALRecordType::PUT, "old" + std::to_string(i),
+                                   std::string(1000, 'o'), i + 1));
+        }
+        EXPECT_LT(wal.Size(), 200u * 1000);
+    }
+    // Preallocated space does not count as log contents
+    EXPECT_EQ(WAL(path_, options).ReadAll().size(), 100u);
+    
+    options.log_number = 8;
+    options.reuse = true;
+    {
+        WAL wal(path_, options);
+        EXPECT_EQ(wal.Size(), 0u);
+        for (int i = 0; i < 3; ++i) {
+            ASSERT_TRUE(wal.Append(WALRecordType::PUT, "new" + std::to_string(i),
+                                   "v", 101 + i));
+        }
+    }
+    WALReader reader(path_, 8);
+    std::string_view record;
+    std::string scratch;
+    std::vector<WALRecord> records;
+    while (reader.ReadRecord(record, scratch)) {
+        ASSERT_TRUE(WAL::DecodeRecords(record, records));
+    }
+    EXPECT_FALSE(reader.Corrupted());
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[2].key, "new2");
+}
+
+TEST(WriteBatchTest, EncodesOneRecord) {
+    WriteBatch batch;
+    batch.Put("a", "1");
+    batch.Delete("b");
+    WriteBatch more;
+    more.Put("c", std::string(100, 'x'));
+    batch.Append(more);
+    EXPECT_EQ(batch.Count(), 3u);
+    batch.SetSequence(10);
+    batch.SetTimestamp(1234);
+    
+    std::vector<WALRecord> records;
+    ASSERT_TRUE(WAL::DecodeRecords(batch.Data(), records));
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].key, "a");
+    EXPECT_EQ(records[1].type, WALRecordType::DELETE);
+    EXPECT_EQ(records[2].value, std::string(100, 'x'));
+    EXPECT_EQ(records[2].sequence, 12u);
+    EXPECT_EQ(records[2].timestamp, 1234u);
+    
+    // A damaged batch yields nothing rather than a prefix
+    std::string_view data = batch.Data();
+    EXPECT_FALSE(WAL::DecodeRecords(data.substr(0, data.size() - 1), records));
+    EXPECT_EQ(records.size(), 3u);
+    
+    batch.Clear();
+    EXPECT_TRUE(batch.IsEmpty());
+    EXPECT_EQ(batch.Sequence(), 0u);
+}
@@ -1,11 +1,15 @@
 #include <gtest/gtest.h>
 #include "memtable.h"
+#include "arena.h"
+#include <atomic>
+#include <thread>
+#include <vector>
 
 using namespace kvstore;
 
 TEST(MemTableTest, PutAndGet) {
     MemTable table;
-    table.Put("test", "value");
+    table.Put("test", "value", 1);
     
     std::string value;
     ASSERT_TRUE(table.Get("test", value));
@@ -14,9 +18,129 @@ TEST(MemTableTest, PutAndGet) {
 
 TEST(MemTableTest, Delete) {
     MemTable table;
-    table.Put("test", "value");
-    table.Delete("test");
+    table.Put("test", "value", 1);
+    table.Delete("test", 2);
     
     std::string value;
     ASSERT_FALSE(table.Get("test", value));
 }
+
+TEST(MemTableTest, IteratesNewestVersion) {
+    MemTable table;
+    table.Put("b", "1", 1);
+    table.Put("a", "1", 2);
+    table.Put("b", "2", 3);
+    table.Delete("a", 4);
+    table.Put("c", "1", 5);
+    
+    std::vector<std::string> seen;
+    for (auto it = table.Begin(); it != table.End(); ++it) {
+        seen.push_back(std::string(it.key()) + "=" +
+                       (it.is_deleted() ? "-" : std::string(it.value())));
+    }
+    ASSERT_EQ(seen, (std::vector<std::string>{"a=-", "b=2", "c=1"}));
+    ASSERT_EQ(table.Size(), 3u);
+    
+    auto it = table.Seek("bb");
+    ASSERT_TRUE(it != table.End());
+    ASSERT_EQ(it.key(), "c");
+}
+
+TEST(MemTableTest, ConcurrentPuts) {
+    MemTable table;
+    std::atomic<uint64_t> sequence(0);
+    const int kThreads = 4;
+    const int kKeysPerThread = 5000;
+    
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&table, &sequence, t] {
+            for (int i = 0; i < kKeysPerThread; ++i) {
+                // Every thread also rewrites a shared key
+                table.Put("key" + std::to_string(t * kKeysPerThread + i),
+                          std::to_string(t), ++sequence);
+                table.Put("shared", std::to_string(t), ++sequence);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    ASSERT_EQ(table.Size(), static_cast<size_t>(kThreads * kKeysPerThread + 1));
+    std::string value;
+    for (int i = 0; i < kThreads * kKeysPerThread; ++i) {
+        ASSERT_TRUE(table.Get("key" + std::to_string(i), value));
+        ASSERT_EQ(value, std::to_string(i / kKeysPerThread));
+    }
+    
+    size_t count = 0;
+    std::string last;
+    for (auto it = table.Begin(); it != table.End(); ++it, ++count) {
+        ASSERT_LT(last, it.key());
+        last = std::string(it.key());
+    }
+    ASSERT_EQ(count, table.Size());
+}
+
+TEST(MemTableTest, ChargesWriteBufferManager) {
+    auto manager = std::make_shared<WriteBufferManager>(1 << 20);
+    {
+        MemTable table(manager);
+        for (int i = 0; i < 8000; ++i) {
+            table.Put("key" + std::to_string(i), std::string(100, 'v'), i + 1);
+        }
+        ASSERT_EQ(manager->MemoryUsage(), table.SizeBytes());
+        ASSERT_GE(table.SizeBytes(), table.AllocatedBytes());
+        ASSERT_GT(table.AllocatedBytes(), 8000u * 100);
+        ASSERT_TRUE(manager->ShouldFlush());
+        
+        table.MarkImmutable();
+        ASSERT_EQ(manager->MutableMemtableMemoryUsage(), 0u);
+        ASSERT_FALSE(manager->ShouldFlush());
+    }
+    ASSERT_EQ(manager->MemoryUsage(), 0u);
+}
+
+TEST(MemTableTest, ArenaLargeAllocationsKeepCurrentBlock) {
+    Arena arena;
+    for (int i = 0; i < 16; ++i) {
+        arena.Allocate(3000);
+    }
+    size_t usage = arena.MemoryUsage();
+    arena.Allocate(20 * 1024);
+    // The large object does not fit in the first block's tail, but small
+    // ones still do, so only the large one's own block is added
+    size_t with_large = arena.MemoryUsage();
+    EXPECT_LT(with_large - usage, 32u * 1024);
+    for (int i = 0; i < 100; ++i) {
+        arena.Allocate(64);
+    }
+    EXPECT_EQ(arena.MemoryUsage(), with_large);
+}
+
+TEST(MemTableTest, SnapshotReads) {
+    MemTable table;
+    table.Put("a", "1", 1);
+    table.Put("b", "1", 2);
+    table.Put("a", "2", 3);
+    table.Delete("b", 4);
+    table.Put("c", "1", 5);
+    
+    std::string value;
+    ASSERT_TRUE(table.Get("a", value, nullptr, 2));
+    EXPECT_EQ(value, "1");
+    ASSERT_TRUE(table.Get("b", value, nullptr, 3));
+    bool deleted = false;
+    EXPECT_FALSE(table.Get("b", value, &deleted, 4));
+    EXPECT_TRUE(deleted);
+    EXPECT_FALSE(table.Get("c", value, nullptr, 4));
+    
+    // Keys written after the snapshot are skipped entirely
+    std::vector<std::string> seen;
+    for (auto it = table.Begin(2); it != table.End(); ++it) {
+        seen.push_back(std::string(it.key()) + "=" + std::string(it.value()) +
+                       "@" + std::to_string(it.sequence()));
+    }
+    EXPECT_EQ(seen, (std::vector<std::string>{"a=1@1", "b=1@2"}));
+}
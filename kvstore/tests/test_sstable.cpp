@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 #include "sstable.h"
+#include "sstable_builder.h"
+#include "compaction.h"
+#include <fstream>
+#include <thread>
+#include <atomic>
 
 using namespace kvstore;
 
@@ -19,3 +24,375 @@ TEST(SSTableTest, CreateAndRead) {
     ASSERT_TRUE(table.Get("test_key", value));
     ASSERT_EQ(value, "test_value");
 }
+
+TEST(SSTableTest, MultiBlockLookup) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 5000; ++i) {
+        char key[64];
+        snprintf(key, sizeof(key), "log:web:2024-01-01T00:%05d", i);
+        entries.push_back({key, "value_" + std::to_string(i), false,
+                           static_cast<uint64_t>(i)});
+    }
+
+    ASSERT_TRUE(SSTable::Create("/tmp/test_blocks.sst", entries));
+
+    SSTable table("/tmp/test_blocks.sst");
+    ASSERT_EQ(table.GetNumEntries(), 5000u);
+    ASSERT_EQ(table.GetFirstKey(), entries.front().key);
+    ASSERT_EQ(table.GetLastKey(), entries.back().key);
+
+    for (int i = 0; i < 5000; i += 97) {
+        std::string value;
+        ASSERT_TRUE(table.Get(entries[i].key, value));
+        ASSERT_EQ(value, entries[i].value);
+    }
+
+    std::string value;
+    ASSERT_FALSE(table.Get("log:web:2024-01-01T00:00000x", value));
+    ASSERT_FALSE(table.Get("log:zzz", value));
+}
+
+TEST(SSTableTest, ScanAcrossBlocks) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 2000; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%06d", i);
+        entries.push_back({key, std::string(50, 'v'), i % 10 == 0,
+                           static_cast<uint64_t>(i)});
+    }
+    ASSERT_TRUE(SSTable::Create("/tmp/test_scan.sst", entries));
+
+    SSTable table("/tmp/test_scan.sst");
+    auto results = table.Scan("key000100", "key001099", 10000);
+    ASSERT_EQ(results.size(), 1000u);
+    ASSERT_EQ(results.front().key, "key000100");
+    ASSERT_TRUE(results.front().is_deleted);
+    ASSERT_EQ(results.back().key, "key001099");
+    ASSERT_EQ(results.back().timestamp, 1099u);
+
+    ASSERT_EQ(table.Scan("key", "key999999", 25).size(), 25u);
+}
+
+TEST(SSTableTest, ConcurrentReaders) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 10000; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%06d", i);
+        entries.push_back({key, "value" + std::to_string(i), false, 0});
+    }
+    ASSERT_TRUE(SSTable::Create("/tmp/test_concurrent.sst", entries));
+
+    SSTable table("/tmp/test_concurrent.sst");
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 8; ++t) {
+        readers.emplace_back([&, t]() {
+            std::string value;
+            for (int i = t; i < 10000; i += 8) {
+                if (!table.Get(entries[i].key, value) || value != entries[i].value) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(mismatches.load(), 0);
+}
+
+TEST(SSTableTest, CompressedBlocks) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 3000; ++i) {
+        char key[64];
+        snprintf(key, sizeof(key), "log:api:2024-01-01T00:%05d", i);
+        std::string value = "{\"service\": \"api\", \"level\": \"INFO\", \"message\": \"request " +
+                            std::to_string(i) + " served\"}";
+        entries.push_back({key, value, false, static_cast<uint64_t>(i)});
+    }
+
+    SSTableOptions options;
+    options.compression = CompressionType::kLZ4;
+    options.compression_level = 4;
+    ASSERT_TRUE(SSTable::Create("/tmp/test_compressed.sst", entries, options));
+
+    SSTable table("/tmp/test_compressed.sst");
+    ASSERT_EQ(table.GetCompression(), CompressionType::kLZ4);
+    ASSERT_EQ(table.GetCompressionLevel(), 4);
+    ASSERT_GT(table.GetRawDataSize(), 2 * table.GetDataSize());
+
+    std::string value;
+    ASSERT_TRUE(table.Get(entries[1234].key, value));
+    ASSERT_EQ(value, entries[1234].value);
+    ASSERT_EQ(table.Scan("log:api:", "log:api:~", 10000).size(), 3000u);
+}
+
+TEST(SSTableTest, DictionaryCompression) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 3000; ++i) {
+        char key[64];
+        snprintf(key, sizeof(key), "log:db:2024-01-01T00:%05d", i);
+        std::string value = "{\"service\": \"db\", \"level\": \"ERROR\", \"timestamp\": \"" +
+                            std::string(key + 7) + "\", \"metadata\": {\"query_ms\": " +
+                            std::to_string(i % 500) + "}}";
+        entries.push_back({key, value, false, static_cast<uint64_t>(i)});
+    }
+
+    SSTableOptions plain;
+    plain.block_size = 1024;
+    ASSERT_TRUE(SSTable::Create("/tmp/test_nodict.sst", entries, plain));
+    SSTableOptions with_dict = plain;
+    with_dict.max_dict_bytes = 8 * 1024;
+    ASSERT_TRUE(SSTable::Create("/tmp/test_dict.sst", entries, with_dict));
+
+    SSTable without("/tmp/test_nodict.sst");
+    SSTable table("/tmp/test_dict.sst");
+    ASSERT_GT(table.GetDictionarySize(), 0u);
+    ASSERT_LT(table.GetDataSize(), without.GetDataSize());
+
+    std::string value;
+    for (int i = 0; i < 3000; i += 111) {
+        ASSERT_TRUE(table.Get(entries[i].key, value));
+        ASSERT_EQ(value, entries[i].value);
+    }
+    ASSERT_EQ(table.Scan("log:db:", "log:db:~", 10000).size(), 3000u);
+}
+
+TEST(SSTableTest, FooterAndProperties) {
+    std::vector<SSTableEntry> entries;
+    for (int i = 0; i < 2000; ++i) {
+        char key[32];
+        snprintf(key, sizeof(key), "key%06d", i);
+        entries.push_back({key, std::string(50, 'v'), i % 10 == 0,
+                           static_cast<uint64_t>(1000 + i),
+                           static_cast<uint64_t>(5000 - i)});
+    }
+    ASSERT_TRUE(SSTable::Create("/tmp/test_footer.sst", entries));
+
+    SSTable table("/tmp/test_footer.sst");
+    ASSERT_TRUE(table.IsOpen());
+    EXPECT_EQ(table.GetFormatVersion(), Footer::kFormatVersion);
+    const TableProperties& props = table.GetProperties();
+    EXPECT_EQ(props.num_entries, 2000u);
+    EXPECT_EQ(props.smallest_key, "key000000");
+    EXPECT_EQ(props.largest_key, "key001999");
+    EXPECT_GT(props.num_data_blocks, 1u);
+    EXPECT_EQ(props.compression, CompressionType::kLZ4);
+    EXPECT_EQ(props.num_deletions, 200u);
+    EXPECT_EQ(props.min_timestamp, 1000u);
+    EXPECT_EQ(props.max_timestamp, 2999u);
+    EXPECT_EQ(props.largest_sequence, 5000u);
+    auto scanned = table.Scan("key000007", "key000007");
+    ASSERT_EQ(scanned.size(), 1u);
+    EXPECT_EQ(scanned[0].sequence, 4993u);
+    EXPECT_TRUE(props.OverlapsTimeRange(2999, 5000));
+    EXPECT_FALSE(props.OverlapsTimeRange(3000, 5000));
+    EXPECT_FALSE(props.OverlapsKeyRange("key002000", "key999999"));
+    EXPECT_TRUE(table.Scan("key1", "key2").empty());
+
+    std::string value;
+    ASSERT_TRUE(table.Get("key001234", value));
+    EXPECT_FALSE(table.Get("key001230", value));
+
+    // A truncated file has no valid footer and must not open
+    {
+        std::ifstream in("/tmp/test_footer.sst", std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+        std::ofstream out("/tmp/test_footer_truncated.sst", std::ios::binary);
+        out.write(contents.data(), contents.size() - 1);
+    }
+    SSTable truncated("/tmp/test_footer_truncated.sst");
+    EXPECT_FALSE(truncated.IsOpen());
+    EXPECT_FALSE(truncated.Get("key001234", value));
+
+    // A handle size that wraps around when the trailer is added is rejected
+    {
+        std::ifstream in("/tmp/test_footer.sst", std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)),
+                             std::istreambuf_iterator<char>());
+        // The properties handle's size, the last of the four handles
+        size_t pos = contents.size() - Footer::kEncodedLength + 3 * 16 + 8;
+        contents.replace(pos, 8, 8, '\xff');
+        std::ofstream out("/tmp/test_footer_corrupt.sst", std::ios::binary);
+        out.write(contents.data(), contents.size());
+    }
+    SSTable corrupt("/tmp/test_footer_corrupt.sst");
+    EXPECT_FALSE(corrupt.IsOpen());
+    EXPECT_FALSE(corrupt.Get("key001234", value));
+}
+
+TEST(SSTableTest, BuilderStreamsEntries) {
+    SSTableOptions options;
+    options.max_dict_bytes = 1024;
+    {
+        SSTableBuilder builder("/tmp/test_builder.sst", options);
+        for (int i = 0; i < 20000; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "log:api:%08d", i);
+            builder.Add(key, "{\"level\":\"info\",\"msg\":\"request " +
+                        std::to_string(i) + "\"}", false, i);
+        }
+        ASSERT_TRUE(builder.Finish());
+    }
+
+    SSTable table("/tmp/test_builder.sst");
+    ASSERT_TRUE(table.IsOpen());
+    EXPECT_EQ(table.GetNumEntries(), 20000u);
+    EXPECT_GT(table.GetDictionarySize(), 0u);
+    std::string value;
+    ASSERT_TRUE(table.Get("log:api:00000007", value));
+    EXPECT_EQ(value, "{\"level\":\"info\",\"msg\":\"request 7\"}");
+    ASSERT_TRUE(table.Get("log:api:00019999", value));
+
+    // An abandoned builder leaves no file behind
+    {
+        SSTableBuilder builder("/tmp/test_builder_abandoned.sst", options);
+        builder.Add("key", "value", false, 1);
+    }
+    EXPECT_FALSE(std::ifstream("/tmp/test_builder_abandoned.sst").good());
+}
+
+TEST(SSTableTest, CompactionSplitsByTargetSize) {
+    std::vector<std::string> inputs;
+    for (int t = 0; t < 2; ++t) {
+        std::vector<SSTableEntry> entries;
+        for (int i = 0; i < 4000; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "key%06d", i * 2 + t);
+            entries.push_back({key, std::string(100, 'a' + t), false,
+                               static_cast<uint64_t>(i)});
+        }
+        inputs.push_back("/tmp/test_split_in" + std::to_string(t) + ".sst");
+        ASSERT_TRUE(SSTable::Create(inputs.back(), entries));
+    }
+
+    SSTableOptions options;
+    options.compression = CompressionType::kNone;
+    options.target_file_size = 128 * 1024;
+    std::atomic<int> next{0};
+    // Subcompactions merge disjoint key ranges on their own threads; the
+    // outputs still come back in key order
+    for (size_t subcompactions : {1, 4}) {
+        std::vector<std::string> outputs;
+        ASSERT_TRUE(Compaction::CompactSSTables(
+            inputs,
+            [&] { return "/tmp/test_split_out" + std::to_string(next++) + ".sst"; },
+            options, outputs, false, subcompactions));
+        ASSERT_GT(outputs.size(), subcompactions);
+
+        uint64_t total = 0;
+        std::string previous_last;
+        for (const auto& file : outputs) {
+            SSTable table(file);
+            ASSERT_TRUE(table.IsOpen());
+            EXPECT_GT(table.GetFirstKey(), previous_last);
+            previous_last = table.GetLastKey();
+            total += table.GetNumEntries();
+        }
+        EXPECT_EQ(total, 8000u);
+    }
+}
+
+TEST(SSTableTest, CompactionKeepsNewestVersion) {
+    // Overlapping inputs, oldest first; keys past '~' must survive too
+    std::vector<std::vector<SSTableEntry>> tables = {
+        {{"a", "a1", false, 1, 1}, {"b", "b1", false, 1, 2},
+         {"\xff\xfe", "x1", false, 1, 3}},
+        {{"b", "", true, 2, 5}, {"c", "c2", false, 2, 4}},
+        {{"a", "a3", false, 3, 6}, {"c", "stale", false, 0, 0},
+         {"\xff\xfe", "x3", false, 3, 7}},
+    };
+    std::vector<std::string> inputs;
+    for (size_t t = 0; t < tables.size(); ++t) {
+        inputs.push_back("/tmp/test_merge_in" + std::to_string(t) + ".sst");
+        ASSERT_TRUE(SSTable::Create(inputs.back(), tables[t]));
+    }
+    
+    SSTableOptions options;
+    int next = 0;
+    auto next_output = [&] {
+        return "/tmp/test_merge_out" + std::to_string(next++) + ".sst";
+    };
+    for (bool drop_tombstones : {false, true}) {
+        std::vector<std::string> outputs;
+        ASSERT_TRUE(Compaction::CompactSSTables(inputs, next_output, options,
+                                                outputs, drop_tombstones));
+        ASSERT_EQ(outputs.size(), 1u);
+        SSTable table(outputs[0]);
+        auto entries = table.Scan("", "\xff\xff", SIZE_MAX);
+        ASSERT_EQ(entries.size(), drop_tombstones ? 3u : 4u);
+        EXPECT_EQ(entries.front().value, "a3");
+        EXPECT_EQ(entries.back().value, "x3");
+        std::string value;
+        EXPECT_TRUE(table.Get("c", value));
+        EXPECT_EQ(value, "c2");
+        EXPECT_FALSE(table.Get("b", value));
+    }
+    
+    // An input that cannot be read fails the compaction
+    std::vector<std::string> outputs;
+    inputs.push_back("/tmp/test_merge_missing.sst");
+    std::remove(inputs.back().c_str());
+    EXPECT_FALSE(Compaction::CompactSSTables(inputs, next_output, options,
+                                             outputs));
+    EXPECT_TRUE(outputs.empty());
+}
+
+TEST(SSTableTest, FilterLoadedFromFile) {
+    for (FilterType type : {FilterType::kBloom, FilterType::kXor}) {
+        std::vector<SSTableEntry> entries;
+        for (int i = 0; i < 5000; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "key%06d", i * 2);
+            entries.push_back({key, "v", false, static_cast<uint64_t>(i)});
+        }
+        SSTableOptions options;
+        options.filter_type = type;
+        ASSERT_TRUE(SSTable::Create("/tmp/test_filter.sst", entries, options));
+        
+        SSTable table("/tmp/test_filter.sst");
+        EXPECT_EQ(table.GetFilterType(), type);
+        EXPECT_EQ(table.GetFilterMemoryUsage(), 0u);
+        
+        // Odd keys fall inside the key range but were never written
+        int passed = 0;
+        for (int i = 0; i < 5000; ++i) {
+            char key[32];
+            snprintf(key, sizeof(key), "key%06d", i * 2 + 1);
+            passed += table.MayContain(key);
+            snprintf(key, sizeof(key), "key%06d", i * 2);
+            ASSERT_TRUE(table.MayContain(key));
+        }
+        EXPECT_LT(passed, 150);
+        EXPECT_GT(table.GetFilterMemoryUsage(), 0u);
+    }
+}
+
+TEST(SSTableTest, PrefixFilter) {
+    auto extractor = NewDelimitedPrefixExtractor(':', 2);
+    std::vector<SSTableEntry> entries;
+    for (const char* service : {"api", "auth", "web"}) {
+        for (int i = 0; i < 100; ++i) {
+            entries.push_back({std::string("log:") + service + ":" +
+                               std::to_string(1000 + i), "v", false, 1});
+        }
+    }
+    SSTableOptions options;
+    options.prefix_extractor = extractor;
+    ASSERT_TRUE(SSTable::Create("/tmp/test_prefix.sst", entries, options));
+
+    SSTable table("/tmp/test_prefix.sst");
+    EXPECT_TRUE(table.MayContainPrefix(*extractor, "log:api:"));
+    EXPECT_TRUE(table.MayContainPrefix(*extractor, "log:web:"));
+    int passed = 0;
+    for (int i = 0; i < 100; ++i) {
+        passed += table.MayContainPrefix(*extractor,
+                                         "log:svc" + std::to_string(i) + ":");
+    }
+    EXPECT_LT(passed, 10);
+
+    // A different extractor cannot use this table's prefix filter
+    auto other = NewFixedPrefixExtractor(4);
+    EXPECT_TRUE(table.MayContainPrefix(*other, "nope"));
+}
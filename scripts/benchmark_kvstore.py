@@ -7,6 +7,8 @@ import random
 import string
 import sys
 import os
+import subprocess
+from pathlib import Path
 
 sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
 
@@ -117,6 +119,48 @@ def benchmark_mixed(engine, num_operations=10000, read_ratio=0.8):
     return ops_per_sec
 
 
+def write_wal_and_crash(db_path, wal_mb):
+    """Fill the WAL with about wal_mb MB of writes, then die without closing"""
+    # A memtable larger than the log keeps everything in the WAL
+    store = kvstore.KVStore(db_path, memtable_size_mb=wal_mb * 2)
+    value = generate_random_string(100)
+    batch = kvstore.WriteBatch()
+    for i in range(wal_mb * 1024 * 1024 // 130):
+        batch.put(f"log:api:{i:012d}", value)
+        if len(batch) == 100:
+            store.write(batch)
+            batch.clear()
+    store.write(batch)
+    sys.stdout.flush()
+    os._exit(0)
+
+
+def benchmark_recovery(db_path, wal_sizes_mb=(16, 64, 256)):
+    """Benchmark restart time against the WAL size left behind by a crash"""
+    import shutil
+    
+    print("\nBenchmarking recovery...")
+    results = []
+    for wal_mb in wal_sizes_mb:
+        shutil.rmtree(db_path, ignore_errors=True)
+        subprocess.run([sys.executable, os.path.abspath(__file__),
+                        '--db-path', db_path, '--crash-after-wal-mb', str(wal_mb)],
+                       check=True)
+        wal_bytes = sum(f.stat().st_size for f in Path(db_path).glob('*.log'))
+        
+        start_time = time.time()
+        store = kvstore.KVStore(db_path)
+        elapsed = time.time() - start_time
+        del store
+        
+        rate = wal_bytes / (1024 * 1024) / elapsed
+        print(f"  WAL {wal_bytes / (1024 * 1024):.1f} MB: "
+              f"restart {elapsed:.2f}s ({rate:.1f} MB/s)")
+        results.append((wal_bytes, elapsed))
+    
+    return results
+
+
 def main():
     """Run benchmarks"""
     import argparse
@@ -126,9 +170,19 @@ def main():
                        help='Database path')
     parser.add_argument('--num-ops', type=int, default=10000,
                        help='Number of operations per test')
+    parser.add_argument('--recovery', action='store_true',
+                       help='Only measure restart time against WAL size')
+    parser.add_argument('--crash-after-wal-mb', type=int,
+                       help=argparse.SUPPRESS)
     
     args = parser.parse_args()
     
+    if args.crash_after_wal_mb:
+        write_wal_and_crash(args.db_path, args.crash_after_wal_mb)
+    if args.recovery:
+        benchmark_recovery(args.db_path)
+        return
+    
     # Clean up old database
     import shutil
     if os.path.exists(args.db_path):